@@ -0,0 +1,859 @@
+#include "aot.hh"
+#include "utils.hh"
+#include "vmath.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// bump when generated code changes so that stale cached objects are rebuilt
+const char *const aot_version = "sythin-aot-10";
+// number of samples computed at once by eval_block and eval_notes, each
+// value of them into a lane of an array of this size
+const size_t aot_time_block_size = 64;
+// contraction into fma is disabled so that results match other tiers exactly
+const char *const aot_compiler_flags = "-std=c++11 -O3 -march=native"
+  " -ffp-contract=off -fPIC -shared -w";
+
+// command that objects are built with, $CXX or c++ by default
+static std::string aot_compiler() {
+  const char *compiler = getenv("CXX");
+  if (compiler == nullptr || *compiler == '\0')
+    return "c++";
+  return compiler;
+}
+
+// what command writes to stdout, empty if it can't be run
+static std::string command_output(const std::string &command) {
+  std::string output;
+  FILE *pipe = popen(command.c_str(), "r");
+  if (pipe == nullptr)
+    return output;
+  char buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+    output.append(buffer, size);
+  pclose(pipe);
+  return output;
+}
+
+// version of compiler and macros it predefines with aot_compiler_flags. as
+// those include -march=native, the macros name the host cpu and every
+// instruction set extension that compiled code may use. each compiler is only
+// run once
+static const std::string& compiler_identity(const std::string &compiler) {
+  static std::map<std::string, std::string> identities;
+  auto identity_it = identities.find(compiler);
+  if (identity_it != identities.end())
+    return identity_it->second;
+  return identities[compiler] = command_output(compiler
+      + " --version 2>/dev/null") + command_output(compiler + " "
+      + aot_compiler_flags + " -E -dM -x c++ /dev/null 2>/dev/null");
+}
+
+uint64_t aot_hash_source(const std::string &source
+    , const compile_options_t &options
+    , const inline_options_t &inline_options) {
+  // 64-bit FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  const std::string compiler = aot_compiler();
+  const std::string key = std::string(aot_version) + '\0' + aot_compiler_flags
+    + '\0' + compiler + '\0' + compiler_identity(compiler) + '\0'
+    + (options.recurrences ? "recurrences" : "exact") + '\0'
+    + std::to_string(options.control_period) + '\0'
+    + (options.approximate_math ? "approximate" : "libm") + '\0'
+    + std::to_string((int)options.factor) + '\0'
+    + std::to_string(inline_options.max_definition_nodes) + '\0'
+    + std::to_string(inline_options.max_inlined_nodes) + '\0'
+    + std::to_string(inline_options.max_depth) + '\0' + source;
+  for (const char c : key) {
+    hash ^= (uint8_t)c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static std::string number_literal(double number) {
+  if (std::isnan(number))
+    return "__builtin_nan(\"\")";
+  if (std::isinf(number))
+    return number > 0 ? "__builtin_inf()" : "-__builtin_inf()";
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.17g", number);
+  return buffer;
+}
+
+static std::string reg(uint32_t r) {
+  return "r" + std::to_string(r);
+}
+
+static std::string integer_literal(int64_t integer) {
+  // -9223372036854775808 would be negation of a literal that doesn't fit
+  if (integer == INT64_MIN)
+    return "(-9223372036854775807LL - 1)";
+  return std::to_string(integer) + "LL";
+}
+
+static std::string label(uint32_t ip) {
+  return "l" + std::to_string(ip);
+}
+
+// statement computing instruction i into d from operands a and b
+static std::string transpile_instruction(const bytecode_t &bytecode
+    , const instruction_t &i, const std::string &d, const std::string &a
+    , const std::string &b) {
+  switch (i.opcode) {
+    case opcode_k::sin:    return d + " = sin(" + a + ");";
+    case opcode_k::cos:    return d + " = cos(" + a + ");";
+    case opcode_k::exp:    return d + " = exp(" + a + ");";
+    case opcode_k::inv:    return d + " = -" + a + ";";
+    case opcode_k::abs:    return d + " = fabs(" + a + ");";
+    case opcode_k::floor:  return d + " = floor(" + a + ");";
+    case opcode_k::round:  return d + " = round(" + a + ");";
+    case opcode_k::ceil:   return d + " = ceil(" + a + ");";
+    case opcode_k::sqrt:   return d + " = sqrt(" + a + ");";
+    case opcode_k::plus:   return d + " = " + a + " + " + b + ";";
+    case opcode_k::minus:  return d + " = " + a + " - " + b + ";";
+    case opcode_k::mult:   return d + " = " + a + " * " + b + ";";
+    case opcode_k::divide: return d + " = " + a + " / " + b + ";";
+    case opcode_k::ceq:
+      return d + " = (int64_t)" + a + " == (int64_t)" + b + ";";
+    case opcode_k::cneq:
+      return d + " = (int64_t)" + a + " != (int64_t)" + b + ";";
+    case opcode_k::clt:    return d + " = " + a + " < " + b + ";";
+    case opcode_k::clteq:  return d + " = " + a + " <= " + b + ";";
+    case opcode_k::cgt:    return d + " = " + a + " > " + b + ";";
+    case opcode_k::cgteq:  return d + " = " + a + " <= " + b + ";";
+    case opcode_k::mod:    return d + " = fmod(" + a + ", " + b + ");";
+    case opcode_k::pow:    return d + " = pow(" + a + ", " + b + ");";
+    case opcode_k::move:   return d + " = " + a + ";";
+    case opcode_k::select:
+      return d + " = (int64_t)" + a + " != 0 ? " + b + " : " + d + ";";
+    case opcode_k::jump:
+      return "goto " + label(i.dst) + ";";
+    case opcode_k::jump_if_zero:
+      return "if ((int64_t)" + a + " == 0) goto " + label(i.dst) + ";";
+    case opcode_k::jump_if_no_case:
+      return "if (llround(" + a + ") != llround(" + b + ")) goto "
+        + label(i.dst) + ";";
+    case opcode_k::jump_table: {
+      const jump_table_t &table = bytecode.jump_tables[i.b];
+      std::string code = "switch (llround(" + a + ")) {\n";
+      for (const std::pair<int64_t, uint32_t> &c : table.cases)
+        code += "    case " + integer_literal(c.first) + ": goto "
+          + label(c.second) + ";\n";
+      return code + "    default: goto " + label(table.otherwise) + ";\n  }";
+    }
+    case opcode_k::fail:
+      return "no_matching_clause();";
+    case opcode_k::ret:    return "return " + a + ";";
+    default:
+      die("unexpected opcode <%s>", opcode_kind_to_string(i.opcode).c_str());
+  }
+}
+
+static std::string transpile_instruction(const bytecode_t &bytecode
+    , const instruction_t &i) {
+  return transpile_instruction(bytecode, i, reg(i.dst), reg(i.a), reg(i.b));
+}
+
+// transpiles instructions computing values from register input alone into
+// struct name_t holding them and function name(input, name_t*) filling it in.
+// their registers are marked in hoisted
+static void transpile_hoisted(const bytecode_t &bytecode
+    , const std::vector<instruction_t> &instructions, const std::string &name
+    , uint32_t input, const std::string &constant_declarations
+    , std::vector<bool> *hoisted, std::string *code) {
+  *code += "struct " + name + "_t {\n";
+  for (const instruction_t &i : instructions) {
+    (*hoisted)[i.dst] = true;
+    *code += "  double " + reg(i.dst) + ";\n";
+  }
+  *code += "};\n\n"
+    "static inline void " + name + "(double input, " + name + "_t *values) {\n"
+    "  const double " + reg(input) + " = input;\n" + constant_declarations;
+  for (const instruction_t &i : instructions)
+    *code += "  double " + transpile_instruction(bytecode, i) + "\n"
+      "  values->" + reg(i.dst) + " = " + reg(i.dst) + ";\n";
+  *code += "}\n\n";
+}
+
+static void transpile_definition(const bytecode_t &bytecode, size_t index
+    , std::string *code) {
+  const std::string suffix = std::to_string(index);
+  std::vector<bool> jump_targets(bytecode.instructions.size(), false);
+  for (const instruction_t &i : bytecode.instructions)
+    switch (i.opcode) {
+      case opcode_k::jump:
+      case opcode_k::jump_if_zero:
+      case opcode_k::jump_if_no_case:
+        jump_targets[i.dst] = true;
+        break;
+      default:
+        break;
+    }
+  for (const jump_table_t &table : bytecode.jump_tables) {
+    for (const std::pair<int64_t, uint32_t> &c : table.cases)
+      jump_targets[c.second] = true;
+    jump_targets[table.otherwise] = true;
+  }
+
+  std::vector<bool> is_constant(bytecode.num_registers, false)
+    , of_note(bytecode.num_registers, false)
+    , of_time(bytecode.num_registers, false);
+  std::string constant_declarations;
+  for (const std::pair<uint32_t, double> &constant : bytecode.constants) {
+    is_constant[constant.first] = true;
+    constant_declarations += "  const double " + reg(constant.first) + " = "
+      + number_literal(constant.second) + ";\n";
+  }
+  // index of control or recurrence writing each register
+  const size_t no_input = SIZE_MAX;
+  std::vector<size_t> of_control(bytecode.num_registers, no_input)
+    , of_recurrence(bytecode.num_registers, no_input);
+  for (size_t j = 0; j < bytecode.controls.size(); ++j)
+    of_control[bytecode.controls[j].first] = j;
+  for (size_t j = 0; j < bytecode.recurrences.size(); ++j)
+    of_recurrence[bytecode.recurrences[j].dst] = j;
+
+  // values of note and of time are computed into structs, once per note and
+  // once per sample for all notes, and those of controls once per control
+  // point. registers of the latter are only read through controls
+  const std::string note = "note_" + suffix, time = "time_" + suffix
+    , control = "control_" + suffix;
+  std::vector<bool> of_control_instructions(bytecode.num_registers, false);
+  transpile_hoisted(bytecode, bytecode.note_instructions, note
+      , bytecode_register_f, constant_declarations, &of_note, code);
+  transpile_hoisted(bytecode, bytecode.time_instructions, time
+      , bytecode_register_t, constant_declarations, &of_time, code);
+  transpile_hoisted(bytecode, bytecode.control_instructions, control
+      , bytecode_register_t, constant_declarations, &of_control_instructions
+      , code);
+
+  *code += "static inline double sample_" + suffix + "(const " + note
+    + "_t *note, const " + time + "_t *time, const double *controls"
+    ", const double *waves, double f, double t) {\n";
+  // all registers are declared upfront so that gotos don't cross
+  // initializations
+  *code += "  double " + reg(bytecode_register_f) + " = f, "
+    + reg(bytecode_register_t) + " = t;\n" + constant_declarations;
+  for (uint32_t r = 0; r < bytecode.num_registers; ++r)
+    if (r == bytecode_register_f || r == bytecode_register_t
+        || is_constant[r])
+      continue;
+    else if (of_note[r])
+      *code += "  const double " + reg(r) + " = note->" + reg(r) + ";\n";
+    else if (of_time[r])
+      *code += "  const double " + reg(r) + " = time->" + reg(r) + ";\n";
+    else if (of_control[r] != no_input)
+      *code += "  const double " + reg(r) + " = controls["
+        + std::to_string(of_control[r]) + "];\n";
+    else if (of_recurrence[r] != no_input)
+      *code += "  const double " + reg(r) + " = waves["
+        + std::to_string(of_recurrence[r]) + "];\n";
+    else
+      *code += "  double " + reg(r) + ";\n";
+  for (size_t ip = 0; ip < bytecode.instructions.size(); ++ip) {
+    if (jump_targets[ip])
+      *code += label(ip) + ":\n";
+    *code += "  " + transpile_instruction(bytecode, bytecode.instructions[ip])
+      + "\n";
+  }
+  *code += "}\n\n";
+
+  // registers whose values are computed for a block of samples at once,
+  // each into its lane of array lanes, the same as in vm_t: t and values of
+  // time, and in straight-line code values of controls, of recurrences and
+  // of all instructions
+  const std::string block = std::to_string(aot_time_block_size);
+  std::vector<size_t> lane(bytecode.num_registers, no_input);
+  size_t num_lanes = 0;
+  {
+    std::vector<bool> in_lanes(bytecode.num_registers, false);
+    in_lanes[bytecode_register_t] = true;
+    for (const instruction_t &i : bytecode.time_instructions)
+      in_lanes[i.dst] = true;
+    if (bytecode.straight_line) {
+      for (const std::pair<uint32_t, uint32_t> &c : bytecode.controls)
+        in_lanes[c.first] = true;
+      for (const recurrence_t &recurrence : bytecode.recurrences)
+        in_lanes[recurrence.dst] = true;
+      for (const instruction_t &i : bytecode.instructions)
+        if (i.opcode != opcode_k::ret)
+          in_lanes[i.dst] = true;
+    }
+    // in order of registers, so that lanes of controls are adjacent like
+    // their registers
+    for (uint32_t r = 0; r < bytecode.num_registers; ++r)
+      if (in_lanes[r])
+        lane[r] = num_lanes++;
+  }
+  auto lanes_of = [&](uint32_t r) {
+    return "lanes[" + std::to_string(lane[r]) + "]";
+  };
+  auto lane_operand = [&](uint32_t r) -> std::string {
+    if (r == bytecode_register_f)
+      return "f";
+    if (is_constant[r])
+      return reg(r);
+    if (of_note[r])
+      return "note->" + reg(r);
+    if (lane[r] == no_input)
+      die("register %u has no lane", r);
+    return lanes_of(r) + "[k]";
+  };
+  // statements computing an instruction for m lanes, with sines, cosines
+  // and exponentials computed by kernels of vmath.hh when approximate
+  auto transpile_lanes = [&](const instruction_t &i) -> std::string {
+    const std::string loop = "  for (size_t k = 0; k < m; ++k)\n    ";
+    if (i.opcode == opcode_k::ret)
+      return loop + "out[k] = " + lane_operand(i.a) + ";\n";
+    const bool vmath = bytecode.approximate_math
+      && (i.opcode == opcode_k::sin || i.opcode == opcode_k::cos
+          || i.opcode == opcode_k::exp);
+    if (!vmath)
+      return loop + transpile_instruction(bytecode, i, lanes_of(i.dst) + "[k]"
+          , lane_operand(i.a), lane_operand(i.b)) + "\n";
+    const std::string kernel = "sythin_vmath[vmath_"
+      + opcode_kind_to_string(i.opcode) + "]";
+    if (lane[i.a] != no_input)
+      return "  " + kernel + "(" + lanes_of(i.a) + ", " + lanes_of(i.dst)
+        + ", m);\n";
+    // the value is the same in every lane, so it is computed once
+    return "  {\n"
+      "    const double x = " + lane_operand(i.a) + ";\n"
+      "    double y;\n"
+      "    " + kernel + "(&x, &y, 1);\n"
+      "    for (size_t k = 0; k < m; ++k)\n"
+      "      " + lanes_of(i.dst) + "[k] = y;\n"
+      "  }\n";
+  };
+
+  *code += "static void time_lanes_" + suffix + "(double (*lanes)[" + block
+    + "], size_t m) {\n" + constant_declarations;
+  for (const instruction_t &i : bytecode.time_instructions)
+    *code += transpile_lanes(i);
+  *code += "}\n\n";
+  if (bytecode.straight_line) {
+    *code += "static void sample_lanes_" + suffix + "(const " + note
+      + "_t *note, double f, double (*lanes)[" + block + "], size_t m"
+      ", float *out) {\n" + constant_declarations;
+    for (const instruction_t &i : bytecode.instructions)
+      *code += transpile_lanes(i);
+    *code += "}\n\n";
+  }
+
+  // rates and offsets of recurrences are values of note, constants or f
+  auto note_operand = [&](uint32_t r) -> std::string {
+    if (r == bytecode_register_f)
+      return "f";
+    return is_constant[r] ? reg(r) : "note." + reg(r);
+  };
+  const std::string num_recurrences
+    = std::to_string(bytecode.recurrences.size())
+    , waves_size = std::to_string(std::max<size_t>(bytecode.recurrences.size()
+          , 1) * aot_time_block_size);
+  std::string exact_recurrences, block_recurrences, note_recurrences;
+  for (size_t j = 0; j < bytecode.recurrences.size(); ++j) {
+    const recurrence_t &recurrence = bytecode.recurrences[j];
+    const std::string arguments = "recurrence_"
+      + opcode_kind_to_string(recurrence.opcode) + ", "
+      + note_operand(recurrence.rate) + ", "
+      + note_operand(recurrence.offset);
+    exact_recurrences += "  waves[" + std::to_string(j)
+      + "] = recurrence_value(" + arguments + ", t);\n";
+    const std::string call = "recurrence(" + arguments + ", start + offset"
+      ", sample_rate, m, " + (bytecode.straight_line
+          ? lanes_of(recurrence.dst) + ", 1"
+          : "waves + " + std::to_string(j) + ", " + num_recurrences) + ");\n";
+    block_recurrences += "    " + call;
+    note_recurrences += "      " + call;
+  }
+
+  // values of controls of a block are computed at its control points and
+  // interpolated for each of its samples, the same as in bytecode_t
+  const size_t period = bytecode.control_period;
+  const std::string num_controls = std::to_string(bytecode.controls.size())
+    , controls_size = std::to_string(std::max<size_t>(bytecode.controls.size()
+          , 1) * aot_time_block_size);
+  std::string control_declarations, exact_controls, block_controls;
+  if (!bytecode.controls.empty()) {
+    const std::string period_literal = std::to_string(period) + "ULL"
+      , points_size = std::to_string(bytecode.controls.size()
+          * ((period + aot_time_block_size - 2) / period + 2));
+    control_declarations = "  " + control + "_t control;\n"
+      "  double points[" + points_size + "];\n";
+    // values of controls are computed by control instructions, or are t or
+    // constants
+    auto control_operand = [&](uint32_t r, const std::string &t) {
+      if (r == bytecode_register_t)
+        return t;
+      return is_constant[r] ? reg(r) : "control." + reg(r);
+    };
+    std::string gather;
+    for (size_t j = 0; j < bytecode.controls.size(); ++j) {
+      const uint32_t value = bytecode.controls[j].second;
+      exact_controls += "  controls[" + std::to_string(j) + "] = "
+        + control_operand(value, "t") + ";\n";
+      gather += "      points[p * " + num_controls + " + " + std::to_string(j)
+        + "] = " + control_operand(value, "point") + ";\n";
+    }
+    exact_controls = "  " + control + "_t control;\n"
+      "  " + control + "(t, &control);\n" + exact_controls;
+    block_controls = "    const uint64_t first = start + offset"
+      " - (start + offset) % " + period_literal + ";\n"
+      "    const size_t num_points = (start + offset + m - 1 - first) / "
+      + period_literal + " + 2;\n"
+      "    for (size_t p = 0; p < num_points; ++p) {\n"
+      "      const double point = (double)(first + p * " + period_literal
+      + ") / sample_rate;\n"
+      "      " + control + "(point, &control);\n" + gather +
+      "    }\n"
+      "    interpolate(points, " + num_controls + ", start + offset, "
+      + period_literal + ", m, " + (bytecode.straight_line
+          ? lanes_of(bytecode.controls.front().first) + ", 1, " + block
+          : "controls, " + num_controls + ", 1") + ");\n";
+  }
+
+  *code += "static double eval_" + suffix + "(double f, double t) {\n"
+    + constant_declarations +
+    "  " + note + "_t note;\n"
+    "  " + time + "_t time;\n"
+    "  double controls[" + std::to_string(std::max<size_t>(
+          bytecode.controls.size(), 1)) + "];\n"
+    "  double waves[" + waves_size + "];\n"
+    "  " + note + "(f, &note);\n"
+    "  " + time + "(t, &time);\n"
+    + exact_controls
+    + exact_recurrences +
+    "  return sample_" + suffix + "(&note, &time, controls, waves, f, t);\n"
+    "}\n\n";
+
+  // blocks start with t and values of time in lanes
+  const std::string time_lanes = "    for (size_t k = 0; k < m; ++k)\n"
+    "      " + lanes_of(bytecode_register_t) + "[k] = (double)(start + offset"
+    " + k) / sample_rate;\n"
+    "    time_lanes_" + suffix + "(lanes, m);\n";
+  const std::string lanes_declaration = "  double lanes["
+    + std::to_string(num_lanes) + "][" + block + "];\n";
+  if (bytecode.straight_line) {
+    *code += "static void eval_block_" + suffix + "(double f, uint64_t start"
+      ", double sample_rate, float *out, size_t n) {\n"
+      + constant_declarations +
+      "  " + note + "_t note;\n"
+      + control_declarations
+      + lanes_declaration +
+      "  " + note + "(f, &note);\n"
+      "  for (size_t offset = 0; offset < n; offset += " + block + ") {\n"
+      "    const size_t m = n - offset < " + block + " ? n - offset : " + block
+      + ";\n"
+      + time_lanes
+      + block_controls
+      + block_recurrences +
+      "    sample_lanes_" + suffix + "(&note, f, lanes, m, out + offset);\n"
+      "  }\n"
+      "}\n\n";
+
+    *code += "static void eval_notes_" + suffix + "(const double *fs"
+      ", size_t num_notes, uint64_t start, double sample_rate"
+      ", float *const *out, size_t n) {\n"
+      + constant_declarations
+      + control_declarations
+      + lanes_declaration +
+      "  for (size_t offset = 0; offset < n; offset += " + block + ") {\n"
+      "    const size_t m = n - offset < " + block + " ? n - offset : " + block
+      + ";\n"
+      + time_lanes
+      + block_controls +
+      "    for (size_t j = 0; j < num_notes; ++j) {\n"
+      "      const double f = fs[j];\n"
+      "      " + note + "_t note;\n"
+      "      " + note + "(f, &note);\n"
+      + note_recurrences +
+      "      sample_lanes_" + suffix + "(&note, f, lanes, m, out[j]"
+      " + offset);\n"
+      "    }\n"
+      "  }\n"
+      "}\n\n";
+    return;
+  }
+
+  // code with jumps runs sample by sample, with values of time taken from
+  // their lanes
+  auto load_time = [&](const std::string &indent) {
+    std::string load = indent + "const double t = "
+      + lanes_of(bytecode_register_t) + "[k];\n";
+    for (const instruction_t &i : bytecode.time_instructions)
+      load += indent + "time." + reg(i.dst) + " = " + lanes_of(i.dst)
+        + "[k];\n";
+    return load;
+  };
+  *code += "static void eval_block_" + suffix + "(double f, uint64_t start"
+    ", double sample_rate, float *out, size_t n) {\n"
+    + constant_declarations +
+    "  " + note + "_t note;\n"
+    "  " + time + "_t time;\n"
+    + control_declarations +
+    "  double controls[" + controls_size + "];\n"
+    "  double waves[" + waves_size + "];\n"
+    + lanes_declaration +
+    "  " + note + "(f, &note);\n"
+    "  for (size_t offset = 0; offset < n; offset += " + block + ") {\n"
+    "    const size_t m = n - offset < " + block + " ? n - offset : " + block
+    + ";\n"
+    + time_lanes
+    + block_controls
+    + block_recurrences +
+    "    for (size_t k = 0; k < m; ++k) {\n"
+    + load_time("      ") +
+    "      out[offset + k] = sample_" + suffix + "(&note, &time, controls"
+    " + k * " + num_controls + ", waves + k * " + num_recurrences + ", f, t);\n"
+    "    }\n"
+    "  }\n"
+    "}\n\n";
+
+  *code += "static void eval_notes_" + suffix + "(const double *fs"
+    ", size_t num_notes, uint64_t start, double sample_rate"
+    ", float *const *out, size_t n) {\n"
+    + constant_declarations +
+    "  " + time + "_t time;\n"
+    + control_declarations +
+    "  double controls[" + controls_size + "];\n"
+    "  double waves[" + waves_size + "];\n"
+    + lanes_declaration +
+    "  for (size_t offset = 0; offset < n; offset += " + block + ") {\n"
+    "    const size_t m = n - offset < " + block + " ? n - offset : " + block
+    + ";\n"
+    + time_lanes
+    + block_controls +
+    "    for (size_t j = 0; j < num_notes; ++j) {\n"
+    "      const double f = fs[j];\n"
+    "      " + note + "_t note;\n"
+    "      " + note + "(f, &note);\n"
+    + note_recurrences +
+    "      for (size_t k = 0; k < m; ++k) {\n"
+    + load_time("        ") +
+    "        out[j][offset + k] = sample_" + suffix + "(&note, &time"
+    ", controls + k * " + num_controls + ", waves + k * " + num_recurrences
+    + ", f, t);\n"
+    "      }\n"
+    "    }\n"
+    "  }\n"
+    "}\n\n";
+}
+
+static void transpile_flags(const char *name, const std::vector<bool> &flags
+    , std::string *code) {
+  *code += "extern const bool " + std::string(name) + "[] = {\n";
+  for (const bool flag : flags)
+    *code += flag ? "  true,\n" : "  false,\n";
+  *code += "  false\n};\n\n";
+}
+
+void aot_transpile(const term_t *const program
+    , const compile_options_t &options, uint64_t source_hash
+    , std::string *code, std::vector<std::string> *skipped) {
+  std::vector<std::string> names;
+  std::vector<bool> uses_f, phase_only, separable;
+  *code = "// generated by sythin, do not edit\n"
+    "#include <cmath>\n"
+    "#include <cstddef>\n"
+    "#include <cstdint>\n"
+    "#include <cstdio>\n"
+    "#include <cstdlib>\n\n"
+    "using namespace std;\n\n"
+    // kernels of vmath.hh, filled in by aot_module_t::load()
+    "enum { vmath_sin, vmath_cos, vmath_exp };\n\n"
+    "extern \"C\" void (*sythin_vmath[3])(const double*, double*, size_t)"
+    " = {};\n\n"
+    "static void no_matching_clause() {\n"
+    "  puts(\"no matching clause in case statement\");\n"
+    "  exit(1);\n"
+    "}\n\n"
+    // same as recurrence_t, so that results match other tiers exactly
+    "enum { recurrence_sin, recurrence_cos, recurrence_exp };\n\n"
+    "static inline double recurrence_value(int opcode, double rate"
+    ", double offset, double t) {\n"
+    "  const double x = rate * t + offset;\n"
+    "  return opcode == recurrence_sin ? sin(x)\n"
+    "    : opcode == recurrence_cos ? cos(x) : exp(x);\n"
+    "}\n\n"
+    "static void recurrence(int opcode, double rate, double offset"
+    ", uint64_t start, double sample_rate, size_t n, double *out"
+    ", size_t stride) {\n"
+    "  const double step = rate / sample_rate;\n"
+    "  if (opcode == recurrence_exp) {\n"
+    "    const double ratio = exp(step);\n"
+    "    double e = 0;\n"
+    "    for (size_t k = 0; k < n; ++k) {\n"
+    "      if (k == 0 || (start + k) % " + std::to_string(recurrence_period)
+    + " == 0)\n"
+    "        e = recurrence_value(opcode, rate, offset"
+    ", (double)(start + k) / sample_rate);\n"
+    "      else\n"
+    "        e *= ratio;\n"
+    "      out[k * stride] = e;\n"
+    "    }\n"
+    "    return;\n"
+    "  }\n"
+    "  const double step_cos = cos(step), step_sin = sin(step);\n"
+    "  double x_sin = 0, x_cos = 0;\n"
+    "  for (size_t k = 0; k < n; ++k) {\n"
+    "    if (k == 0 || (start + k) % " + std::to_string(recurrence_period)
+    + " == 0) {\n"
+    "      const double x = rate * ((double)(start + k) / sample_rate)"
+    " + offset;\n"
+    "      x_sin = sin(x);\n"
+    "      x_cos = cos(x);\n"
+    "    } else {\n"
+    "      const double next_sin = x_sin * step_cos + x_cos * step_sin;\n"
+    "      x_cos = x_cos * step_cos - x_sin * step_sin;\n"
+    "      x_sin = next_sin;\n"
+    "    }\n"
+    "    out[k * stride] = opcode == recurrence_sin ? x_sin : x_cos;\n"
+    "  }\n"
+    "}\n\n"
+    // same as bytecode_t::interpolate_controls()
+    "static void interpolate(const double *points, size_t num_controls"
+    ", uint64_t start, uint64_t period, size_t n, double *out, size_t stride"
+    ", size_t control_stride) {\n"
+    "  for (size_t j = 0; j < num_controls; ++j) {\n"
+    "    const double *before = points + j;\n"
+    "    uint64_t phase = start % period;\n"
+    "    for (size_t k = 0; k < n; ++k) {\n"
+    "      const double after = before[num_controls];\n"
+    "      out[k * stride + j * control_stride] = phase == 0 ? *before\n"
+    "        : *before + (after - *before) * ((double)phase / (double)period);\n"
+    "      if (++phase == period) {\n"
+    "        phase = 0;\n"
+    "        before += num_controls;\n"
+    "      }\n"
+    "    }\n"
+    "  }\n"
+    "}\n\n";
+  for (const std::string &name : get_evaluatable_top_level_functions(program)) {
+    bytecode_t bytecode;
+    std::string error;
+    if (!compile_definition(program, name, options, &bytecode, &error)) {
+      skipped->push_back(name + ": " + error);
+      continue;
+    }
+    transpile_definition(bytecode, names.size(), code);
+    names.push_back(name);
+    uses_f.push_back(bytecode.uses_f);
+    phase_only.push_back(bytecode.phase_only);
+    separable.push_back(bytecode.separable);
+  }
+
+  *code += "extern \"C\" {\n\n"
+    "extern const uint64_t sythin_source_hash = "
+    + std::to_string(source_hash) + "ULL;\n\n"
+    "extern const char *const sythin_definition_names[] = {\n";
+  for (const std::string &name : names)
+    *code += "  \"" + name + "\",\n";
+  *code += "  nullptr\n};\n\n"
+    "extern double (*const sythin_definition_evals[])(double, double) = {\n";
+  for (size_t i = 0; i < names.size(); ++i)
+    *code += "  eval_" + std::to_string(i) + ",\n";
+  *code += "  nullptr\n};\n\n"
+    "extern void (*const sythin_definition_blocks[])(double, uint64_t, double"
+    ", float*, size_t) = {\n";
+  for (size_t i = 0; i < names.size(); ++i)
+    *code += "  eval_block_" + std::to_string(i) + ",\n";
+  *code += "  nullptr\n};\n\n"
+    "extern void (*const sythin_definition_notes[])(const double*, size_t"
+    ", uint64_t, double, float *const*, size_t) = {\n";
+  for (size_t i = 0; i < names.size(); ++i)
+    *code += "  eval_notes_" + std::to_string(i) + ",\n";
+  *code += "  nullptr\n};\n\n";
+  transpile_flags("sythin_definition_uses_f", uses_f, code);
+  transpile_flags("sythin_definition_phase_only", phase_only, code);
+  transpile_flags("sythin_definition_separable", separable, code);
+  *code += "}\n";
+}
+
+static std::string shell_quote(const std::string &string) {
+  std::string quoted = "'";
+  for (const char c : string)
+    if (c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  return quoted + "'";
+}
+
+bool aot_build(const term_t *const program, const compile_options_t &options
+    , uint64_t source_hash, const std::string &output_path
+    , std::vector<message_t> *messages, std::string *error) {
+  std::string code;
+  std::vector<std::string> skipped;
+  aot_transpile(program, options, source_hash, &code, &skipped);
+  for (const std::string &reason : skipped)
+    messages->push_back({ message_k::note, "left out of object: " + reason });
+
+  // the object is built under a temporary name and renamed in place, so that
+  // a concurrently starting instance never loads a partially written file
+  const std::string pid = std::to_string(getpid())
+    , source_path = output_path + "." + pid + ".cc"
+    , temporary_path = output_path + "." + pid + ".tmp";
+  std::ofstream source_file(source_path, std::ofstream::binary);
+  source_file << code;
+  source_file.close();
+  if (!source_file) {
+    *error = "failed to write \"" + source_path + "\"";
+    return false;
+  }
+
+  const std::string command = aot_compiler() + " " + aot_compiler_flags + " -o " + shell_quote(temporary_path) + " "
+    + shell_quote(source_path);
+  const int status = system(command.c_str());
+  remove(source_path.c_str());
+  if (status != 0) {
+    remove(temporary_path.c_str());
+    *error = "compiler command \"" + command + "\" failed";
+    return false;
+  }
+  if (rename(temporary_path.c_str(), output_path.c_str()) != 0) {
+    remove(temporary_path.c_str());
+    *error = "failed to move compiled object to \"" + output_path + "\"";
+    return false;
+  }
+  return true;
+}
+
+aot_module_t::aot_module_t()
+  : _handle(nullptr)
+  , _kernels() {
+}
+
+aot_module_t::~aot_module_t() {
+  if (_handle != nullptr)
+    dlclose(_handle);
+}
+
+bool aot_module_t::load(const std::string &path, uint64_t source_hash
+    , std::string *error) {
+  assertf(_handle == nullptr);
+  // a path without slashes would be searched for in library directories
+  const std::string dl_path = path.find('/') == std::string::npos
+    ? "./" + path : path;
+  _handle = dlopen(dl_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (_handle == nullptr) {
+    *error = dlerror();
+    return false;
+  }
+
+  const uint64_t *hash = (const uint64_t*)dlsym(_handle, "sythin_source_hash");
+  const char *const *names = (const char *const*)dlsym(_handle
+      , "sythin_definition_names");
+  double (*const *evals)(double, double) = (double (*const*)(double, double))
+    dlsym(_handle, "sythin_definition_evals");
+  void (*const *blocks)(double, uint64_t, double, float*, size_t) =
+    (void (*const*)(double, uint64_t, double, float*, size_t))
+    dlsym(_handle, "sythin_definition_blocks");
+  void (*const *notes)(const double*, size_t, uint64_t, double, float *const*
+      , size_t) = (void (*const*)(const double*, size_t, uint64_t, double
+        , float *const*, size_t))dlsym(_handle, "sythin_definition_notes");
+  const bool *uses_f = (const bool*)dlsym(_handle
+      , "sythin_definition_uses_f");
+  const bool *phase_only = (const bool*)dlsym(_handle
+      , "sythin_definition_phase_only");
+  const bool *separable = (const bool*)dlsym(_handle
+      , "sythin_definition_separable");
+  void (**vmath)(const double*, double*, size_t) =
+    (void (**)(const double*, double*, size_t))dlsym(_handle, "sythin_vmath");
+  if (hash == nullptr || names == nullptr || evals == nullptr
+      || blocks == nullptr || notes == nullptr || uses_f == nullptr
+      || phase_only == nullptr || separable == nullptr || vmath == nullptr)
+    *error = "\"" + path + "\" is not a sythin object";
+  else if (*hash != source_hash)
+    *error = "\"" + path + "\" was compiled from a different source, with"
+      " different options or by a different compiler or for a different cpu";
+  else {
+    vmath[0] = vmath_sin;
+    vmath[1] = vmath_cos;
+    vmath[2] = vmath_exp;
+    for (size_t i = 0; names[i] != nullptr; ++i)
+      _kernels[names[i]] = { evals[i], blocks[i], notes[i], uses_f[i]
+        , phase_only[i], separable[i] };
+    return true;
+  }
+  dlclose(_handle);
+  _handle = nullptr;
+  return false;
+}
+
+const aot_kernel_t* aot_module_t::find(const std::string &name) const {
+  auto kernel_it = _kernels.find(name);
+  if (kernel_it == _kernels.end())
+    return nullptr;
+  return &kernel_it->second;
+}
+
+static std::string cache_directory() {
+  const char *xdg_cache = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+  if (xdg_cache != nullptr && *xdg_cache != '\0')
+    return std::string(xdg_cache) + "/sythin";
+  if (home == nullptr || *home == '\0') {
+    const passwd *user = getpwuid(getuid());
+    home = user == nullptr ? nullptr : user->pw_dir;
+  }
+  if (home != nullptr && *home != '\0')
+    return std::string(home) + "/.cache/sythin";
+  return "/tmp/sythin-" + std::to_string(getuid());
+}
+
+// objects in the cache are loaded into the process, so anyone who can put
+// one there can run code as the user. only a directory that the user owns
+// and no one else can write to is trusted
+static bool is_private_directory(const std::string &path) {
+  struct stat status;
+  return stat(path.c_str(), &status) == 0 && S_ISDIR(status.st_mode)
+    && status.st_uid == getuid()
+    && (status.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// mkdir -p
+static bool make_directories(const std::string &path) {
+  for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+    const std::string prefix = path.substr(0, slash);
+    if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+    if (slash == std::string::npos)
+      return true;
+  }
+}
+
+bool aot_load_cached(const std::string &source, const term_t *const program
+    , const compile_options_t &options
+    , const inline_options_t &inline_options, aot_module_t *module
+    , std::vector<message_t> *messages, std::string *error) {
+  const uint64_t hash = aot_hash_source(source, options, inline_options);
+  const std::string directory = cache_directory();
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.so", (unsigned long long)hash);
+  const std::string path = directory + "/" + name;
+
+  if (!make_directories(directory)) {
+    *error = "failed to create cache directory \"" + directory + "\"";
+    return false;
+  }
+  if (!is_private_directory(directory)) {
+    *error = "cache directory \"" + directory + "\" is not owned by the user"
+      " or is writable by others";
+    return false;
+  }
+  if (access(path.c_str(), R_OK) != 0) {
+    messages->push_back({ message_k::note, "compiling object \"" + path
+        + "\"" });
+    if (!aot_build(program, options, hash, path, messages, error))
+      return false;
+  }
+  return module->load(path, hash, error);
+}
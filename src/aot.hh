@@ -0,0 +1,83 @@
+#pragma once
+
+#include "compile.hh"
+#include "optimize.hh"
+#include <cstdint>
+#include <map>
+
+// ahead-of-time compilation of programs into shared objects. every
+// evaluatable definition that compiles to bytecode is transpiled to a C++
+// function, which is then built by the system compiler. the object exports
+// plain C symbols, so it doesn't depend on sythin itself:
+//   sythin_source_hash            uint64_t, hash of the source it was built
+//                                 from
+//   sythin_definition_names       null-terminated array of definition names
+//   sythin_definition_evals       double (*)(double f, double t) for each
+//                                 name
+//   sythin_definition_blocks      block kernels with signature of
+//                                 evaluator_t::eval_block for each name
+//   sythin_definition_notes       kernels rendering several notes at once,
+//                                 with signature of
+//                                 evaluation_context_t::eval_notes
+//   sythin_definition_uses_f      bool for each name, false if it doesn't
+//                                 depend on f
+//   sythin_definition_phase_only  bool for each name, true if it depends on
+//                                 f and t only through f * t
+//   sythin_definition_separable   bool for each name, true if it returns
+//                                 g(f * t) * h(t)
+// and one that sythin fills in when loading it:
+//   sythin_vmath                  kernels vmath_sin, vmath_cos and vmath_exp
+//                                 of vmath.hh, which block kernels of
+//                                 approximate math call on their lanes
+
+struct aot_kernel_t {
+  double (*eval)(double f, double t);
+  void (*eval_block)(double f, uint64_t start, double sample_rate, float *out
+      , size_t n);
+  void (*eval_notes)(const double *f, size_t num_notes, uint64_t start
+      , double sample_rate, float *const *out, size_t n);
+  bool uses_f, phase_only, separable;
+};
+
+// hash of source code together with transpiler version, compiler flags,
+// every compile and inline option, and the compiler with its version and the
+// host cpu it targets. used to key the cache and to check that a loaded
+// object is up to date and can run here. runs the compiler the first time
+uint64_t aot_hash_source(const std::string &source
+    , const compile_options_t &options
+    , const inline_options_t &inline_options);
+
+// writes C++ source of the shared object for program into code. definitions
+// that can't be compiled to bytecode are left out and listed in skipped
+void aot_transpile(const term_t *const program
+    , const compile_options_t &options, uint64_t source_hash
+    , std::string *code, std::vector<std::string> *skipped);
+
+// transpiles program and builds it into shared object at output_path using
+// the compiler from $CXX (c++ by default). definitions that are left out are
+// noted in messages. returns false and sets error if the compiler fails
+bool aot_build(const term_t *const program, const compile_options_t &options
+    , uint64_t source_hash, const std::string &output_path
+    , std::vector<message_t> *messages, std::string *error);
+
+class aot_module_t {
+  void *_handle;
+  std::map<std::string, aot_kernel_t> _kernels;
+public:
+  aot_module_t();
+  ~aot_module_t();
+  // returns false and sets error if object can't be loaded or was built from
+  // a different source than the one with source_hash
+  bool load(const std::string &path, uint64_t source_hash, std::string *error);
+  // null if the definition wasn't compiled into the object
+  const aot_kernel_t* find(const std::string &name) const;
+};
+
+// loads object for source from the cache directory ($XDG_CACHE_HOME/sythin
+// or ~/.cache/sythin), building it first if it isn't there yet, which is
+// noted in messages. the directory must belong to the user and not be
+// writable by others. program must be source optimized with inline_options
+bool aot_load_cached(const std::string &source, const term_t *const program
+    , const compile_options_t &options
+    , const inline_options_t &inline_options, aot_module_t *module
+    , std::vector<message_t> *messages, std::string *error);
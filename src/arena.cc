@@ -0,0 +1,74 @@
+#include "arena.hh"
+#include <algorithm>
+
+arena_t::arena_t(size_t chunk_size)
+  : _chunks()
+  , _chunk_size(chunk_size)
+  , _current(0)
+  , _pointer(nullptr)
+  , _end(nullptr)
+  , _used_before_current(0)
+  , _peak(0) {
+}
+
+arena_t::~arena_t() {
+  for (const std::pair<char*, size_t> &chunk : _chunks)
+    ::operator delete(chunk.first);
+}
+
+void* arena_t::_allocate_slow(size_t size) {
+  if (_pointer != nullptr) {
+    _used_before_current += _pointer - _chunks[_current].first;
+    ++_current;
+  }
+  // skip kept chunks that are too small for this allocation
+  while (_current < _chunks.size() && _chunks[_current].second < size)
+    ++_current;
+  if (_current == _chunks.size()) {
+    const size_t chunk_size = std::max(_chunk_size, size);
+    _chunks.push_back({ (char*)::operator new(chunk_size), chunk_size });
+  }
+  _pointer = _chunks[_current].first + size;
+  _end = _chunks[_current].first + _chunks[_current].second;
+  return _chunks[_current].first;
+}
+
+void arena_t::reset() {
+  _peak = std::max(_peak, used());
+  _current = 0;
+  _used_before_current = 0;
+  if (_chunks.empty())
+    return;
+  _pointer = _chunks[0].first;
+  _end = _chunks[0].first + _chunks[0].second;
+}
+
+void arena_t::rewind(const mark_t &mark) {
+  _peak = std::max(_peak, used());
+  if (mark.pointer == nullptr) {
+    // nothing was allocated when the mark was taken
+    reset();
+    return;
+  }
+  _current = mark.chunk;
+  _pointer = mark.pointer;
+  _end = _chunks[_current].first + _chunks[_current].second;
+  _used_before_current = mark.used_before_chunk;
+}
+
+size_t arena_t::used() const {
+  if (_pointer == nullptr)
+    return 0;
+  return _used_before_current + (_pointer - _chunks[_current].first);
+}
+
+size_t arena_t::peak() const {
+  return std::max(_peak, used());
+}
+
+size_t arena_t::capacity() const {
+  size_t capacity = 0;
+  for (const std::pair<char*, size_t> &chunk : _chunks)
+    capacity += chunk.second;
+  return capacity;
+}
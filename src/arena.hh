@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// bump-pointer allocator for memory that is freed all at once. chunks are
+// kept on reset(), so once the arena has grown to the size needed, allocation
+// is a pointer increment and freeing is O(1). nothing allocated in it is
+// destructed
+class arena_t {
+  std::vector<std::pair<char*, size_t>> _chunks; // memory and its size
+  size_t _chunk_size, _current; // index of chunk allocated from
+  char *_pointer, *_end;
+  size_t _used_before_current; // bytes taken from chunks before current one
+  size_t _peak;
+
+  void* _allocate_slow(size_t size);
+public:
+  static const size_t alignment = alignof(std::max_align_t);
+
+  arena_t(size_t chunk_size);
+  ~arena_t();
+  void* allocate(size_t size) {
+    size = (size + alignment - 1) & ~(alignment - 1);
+    if (size > (size_t)(_end - _pointer))
+      return _allocate_slow(size);
+    void *memory = _pointer;
+    _pointer += size;
+    return memory;
+  }
+  void reset();
+  // position in the arena to free everything allocated after it at once
+  struct mark_t {
+    size_t chunk;
+    char *pointer;
+    size_t used_before_chunk;
+  };
+  mark_t mark() const {
+    return { _current, _pointer, _used_before_current };
+  }
+  void rewind(const mark_t &mark);
+  // bytes currently allocated
+  size_t used() const;
+  // most bytes that were allocated at once since construction
+  size_t peak() const;
+  // bytes reserved from the system
+  size_t capacity() const;
+};
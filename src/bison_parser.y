@@ -16,7 +16,7 @@
 %token <token> TK_ANY TK_BUILTIN_SIN TK_BUILTIN_COS TK_BUILTIN_EXP TK_BUILTIN_INV
 %token <token> TK_BUILTIN_PLUS TK_BUILTIN_MINUS TK_BUILTIN_MULT TK_BUILTIN_DIVIDE
 %token <token> TK_BUILTIN_ABS TK_BUILTIN_FLOOR TK_BUILTIN_ROUND TK_BUILTIN_CEIL
-%token <token> TK_BUILTIN_SQRT
+%token <token> TK_BUILTIN_SQRT TK_BUILTIN_KRATE
 %token <token> TK_WORD_IF TK_WORD_THEN TK_WORD_ELSE TK_WORD_LET TK_WORD_IN
 %token <token> TK_OP_PLUS TK_OP_MINUS TK_OP_MULT TK_OP_DIVIDE TK_OP_CEQ
 %token <token> TK_OP_CNEQ TK_OP_CLT TK_OP_CLTEQ TK_OP_CGT TK_OP_CGTEQ
@@ -70,10 +70,7 @@ body : applications { $$ = $1; }
      };
 
 applications : simple_list {
-               term_t *p = $1->at(0);
-               for (size_t i = 1; i < $1->size(); ++i)
-                 p = term_application(p, $1->at(i));
-               $$ = p;
+               $$ = term_applications(*$1);
                // delete $1
              };
 
@@ -93,52 +90,40 @@ simple : identifier { $$ = $1; }
 /* not the prettiest code, but separating TK_OP_* into separate rule causes
  * shift/reduce conflicts */
 binary_op : simple TK_OP_PLUS simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::plus))), $1), $3);
+               $$ = term_binary_op(builtin_k::plus, $1, $3);
            }
            | simple TK_OP_MINUS simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::minus))), $1), $3);
+               $$ = term_binary_op(builtin_k::minus, $1, $3);
            }
            | simple TK_OP_MULT simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::mult))), $1), $3);
+               $$ = term_binary_op(builtin_k::mult, $1, $3);
            }
            | simple TK_OP_DIVIDE simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::divide))), $1), $3);
+               $$ = term_binary_op(builtin_k::divide, $1, $3);
            }
            | simple TK_OP_CEQ simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::ceq))), $1), $3);
+               $$ = term_binary_op(builtin_k::ceq, $1, $3);
            }
            | simple TK_OP_CNEQ simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::cneq))), $1), $3);
+               $$ = term_binary_op(builtin_k::cneq, $1, $3);
            }
            | simple TK_OP_CLT simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::clt))), $1), $3);
+               $$ = term_binary_op(builtin_k::clt, $1, $3);
            }
            | simple TK_OP_CLTEQ simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::clteq))), $1), $3);
+               $$ = term_binary_op(builtin_k::clteq, $1, $3);
            }
            | simple TK_OP_CGT simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::cgt))), $1), $3);
+               $$ = term_binary_op(builtin_k::cgt, $1, $3);
            }
            | simple TK_OP_CGTEQ simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::cgteq))), $1), $3);
+               $$ = term_binary_op(builtin_k::cgteq, $1, $3);
            }
            | simple TK_OP_MOD simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::mod))), $1), $3);
+               $$ = term_binary_op(builtin_k::mod, $1, $3);
            }
            | simple TK_OP_POW simple {
-               $$ = term_application(term_application(term_value(value_builtin(
-               builtin_binary(builtin_k::pow))), $1), $3);
+               $$ = term_binary_op(builtin_k::pow, $1, $3);
            };
 
 case_of : TK_WORD_CASE body TK_WORD_OF case_statement_list TK_WORD_END {
@@ -188,5 +173,6 @@ builtin : TK_BUILTIN_PLUS   { $$ = builtin_binary(builtin_k::plus); }
         | TK_BUILTIN_FLOOR  { $$ = builtin_unary(builtin_k::floor); }
         | TK_BUILTIN_ROUND  { $$ = builtin_unary(builtin_k::round); }
         | TK_BUILTIN_CEIL   { $$ = builtin_unary(builtin_k::ceil); }
-        | TK_BUILTIN_SQRT   { $$ = builtin_unary(builtin_k::sqrt); };
+        | TK_BUILTIN_SQRT   { $$ = builtin_unary(builtin_k::sqrt); }
+        | TK_BUILTIN_KRATE  { $$ = builtin_unary(builtin_k::krate); };
 
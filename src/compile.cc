@@ -0,0 +1,1538 @@
+#include "compile.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <tuple>
+
+const int max_inlining_depth = 64;
+const size_t max_instructions = 1 << 20;
+// shortest run of case statements with constant values put in a jump table
+const size_t min_jump_table_cases = 2;
+// largest branch of conditional, in nodes, that is computed unconditionally
+const int max_select_nodes = 8;
+
+std::string opcode_kind_to_string(opcode_k kind) {
+  switch (kind) {
+    case opcode_k::sin:             return "sin";
+    case opcode_k::cos:             return "cos";
+    case opcode_k::exp:             return "exp";
+    case opcode_k::inv:             return "inv";
+    case opcode_k::abs:             return "abs";
+    case opcode_k::floor:           return "floor";
+    case opcode_k::round:           return "round";
+    case opcode_k::ceil:            return "ceil";
+    case opcode_k::sqrt:            return "sqrt";
+    case opcode_k::plus:            return "plus";
+    case opcode_k::minus:           return "minus";
+    case opcode_k::mult:            return "mult";
+    case opcode_k::divide:          return "divide";
+    case opcode_k::ceq:             return "ceq";
+    case opcode_k::cneq:            return "cneq";
+    case opcode_k::clt:             return "clt";
+    case opcode_k::clteq:           return "clteq";
+    case opcode_k::cgt:             return "cgt";
+    case opcode_k::cgteq:           return "cgteq";
+    case opcode_k::mod:             return "mod";
+    case opcode_k::pow:             return "pow";
+    case opcode_k::move:            return "move";
+    case opcode_k::select:          return "select";
+    case opcode_k::jump:            return "jump";
+    case opcode_k::jump_if_zero:    return "jump_if_zero";
+    case opcode_k::jump_if_no_case: return "jump_if_no_case";
+    case opcode_k::jump_table:      return "jump_table";
+    case opcode_k::fail:            return "fail";
+    case opcode_k::ret:             return "ret";
+    default:                        return "unhandled";
+  }
+}
+
+// fills regs with pointers to fields of instruction that are registers and
+// returns their number. destination register, if any, comes first
+static int instruction_registers(instruction_t *instruction, uint32_t *regs[3]) {
+  switch (instruction->opcode) {
+    case opcode_k::sin:
+    case opcode_k::cos:
+    case opcode_k::exp:
+    case opcode_k::inv:
+    case opcode_k::abs:
+    case opcode_k::floor:
+    case opcode_k::round:
+    case opcode_k::ceil:
+    case opcode_k::sqrt:
+    case opcode_k::move:
+      regs[0] = &instruction->dst;
+      regs[1] = &instruction->a;
+      return 2;
+    case opcode_k::plus:
+    case opcode_k::minus:
+    case opcode_k::mult:
+    case opcode_k::divide:
+    case opcode_k::ceq:
+    case opcode_k::cneq:
+    case opcode_k::clt:
+    case opcode_k::clteq:
+    case opcode_k::cgt:
+    case opcode_k::cgteq:
+    case opcode_k::mod:
+    case opcode_k::pow:
+    case opcode_k::select:
+      regs[0] = &instruction->dst;
+      regs[1] = &instruction->a;
+      regs[2] = &instruction->b;
+      return 3;
+    case opcode_k::jump_if_zero:
+    case opcode_k::jump_table:
+    case opcode_k::ret:
+      regs[0] = &instruction->a;
+      return 1;
+    case opcode_k::jump_if_no_case:
+      regs[0] = &instruction->a;
+      regs[1] = &instruction->b;
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+uint32_t jump_table_t::target(int64_t value) const {
+  if (dense) {
+    // unsigned, so that values below the first one wrap around past the end
+    const uint64_t index = (uint64_t)value - (uint64_t)cases.front().first;
+    return index < cases.size() ? cases[index].second : otherwise;
+  }
+  auto case_it = std::lower_bound(cases.begin(), cases.end()
+      , std::make_pair(value, (uint32_t)0));
+  if (case_it != cases.end() && case_it->first == value)
+    return case_it->second;
+  return otherwise;
+}
+
+double recurrence_t::value(const double *registers, double t) const {
+  const double x = registers[rate] * t + registers[offset];
+  switch (opcode) {
+    case opcode_k::sin: return sin(x);
+    case opcode_k::cos: return cos(x);
+    default:            return exp(x);
+  }
+}
+
+void recurrence_t::run(const double *registers, uint64_t start
+    , double sample_rate, size_t n, double *out, size_t stride) const {
+  // exact values are taken at multiples of the period, so that a sample
+  // doesn't depend on how samples are split into blocks past its first one
+  const double step = registers[rate] / sample_rate;
+  if (opcode == opcode_k::exp) {
+    const double ratio = exp(step);
+    double e = 0;
+    for (size_t k = 0; k < n; ++k) {
+      if (k == 0 || (start + k) % recurrence_period == 0)
+        e = value(registers, (double)(start + k) / sample_rate);
+      else
+        e *= ratio;
+      out[k * stride] = e;
+    }
+    return;
+  }
+  const double step_cos = cos(step), step_sin = sin(step);
+  double x_sin = 0, x_cos = 0;
+  for (size_t k = 0; k < n; ++k) {
+    if (k == 0 || (start + k) % recurrence_period == 0) {
+      const double x = registers[rate] * ((double)(start + k) / sample_rate)
+        + registers[offset];
+      x_sin = sin(x);
+      x_cos = cos(x);
+    } else {
+      const double next_sin = x_sin * step_cos + x_cos * step_sin;
+      x_cos = x_cos * step_cos - x_sin * step_sin;
+      x_sin = next_sin;
+    }
+    out[k * stride] = opcode == opcode_k::sin ? x_sin : x_cos;
+  }
+}
+
+compile_options_t::compile_options_t()
+  : recurrences(true)
+  , control_period(32)
+  , approximate_math(true)
+  , factor(factor_k::product) {
+}
+
+std::vector<double> bytecode_t::registers() const {
+  std::vector<double> registers(num_registers, 0);
+  for (const std::pair<uint32_t, double> &constant : constants)
+    registers[constant.first] = constant.second;
+  return registers;
+}
+
+void bytecode_t::run_recurrences(const double *registers, uint64_t start
+    , double sample_rate, size_t n, double *values) const {
+  for (size_t j = 0; j < recurrences.size(); ++j)
+    recurrences[j].run(registers, start, sample_rate, n, values + j
+        , recurrences.size());
+}
+
+uint64_t bytecode_t::first_control_point(uint64_t start) const {
+  return start - start % control_period;
+}
+
+size_t bytecode_t::num_control_points(uint64_t start, size_t n) const {
+  // the last sample may need the point after it
+  return (start + n - 1 - first_control_point(start)) / control_period + 2;
+}
+
+void bytecode_t::interpolate_controls(const double *points, uint64_t start
+    , size_t n, double *out, size_t stride, size_t control_stride) const {
+  for (size_t j = 0; j < controls.size(); ++j) {
+    const double *before = points + j;
+    uint64_t phase = start % control_period;
+    for (size_t k = 0; k < n; ++k) {
+      const double after = before[controls.size()];
+      out[k * stride + j * control_stride] = phase == 0 ? *before
+        : *before + (after - *before)
+          * ((double)phase / (double)control_period);
+      if (++phase == control_period) {
+        phase = 0;
+        before += controls.size();
+      }
+    }
+  }
+}
+
+static void print_hoisted(const char *kind
+    , const std::vector<instruction_t> &instructions) {
+  for (instruction_t instruction : instructions) {
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&instruction, regs);
+    printf("%s: %s", kind, opcode_kind_to_string(instruction.opcode).c_str());
+    for (int r = 0; r < num_regs; ++r)
+      printf("%s r%u", r ? "," : "", *regs[r]);
+    printf("\n");
+  }
+}
+
+void bytecode_t::pretty_print() const {
+  for (const std::pair<uint32_t, double> &constant : constants)
+    printf("r%u = %g\n", constant.first, constant.second);
+  print_hoisted("note", note_instructions);
+  print_hoisted("time", time_instructions);
+  print_hoisted("control", control_instructions);
+  for (const std::pair<uint32_t, uint32_t> &control : controls)
+    printf("control: r%u = r%u every %zu samples\n", control.first
+        , control.second, control_period);
+  for (const recurrence_t &recurrence : recurrences)
+    printf("recurrence: %s r%u, r%u * t + r%u\n"
+        , opcode_kind_to_string(recurrence.opcode).c_str(), recurrence.dst
+        , recurrence.rate, recurrence.offset);
+  for (size_t i = 0; i < instructions.size(); ++i) {
+    instruction_t instruction = instructions[i];
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&instruction, regs);
+    printf("%4zu: %s", i, opcode_kind_to_string(instruction.opcode).c_str());
+    for (int r = 0; r < num_regs; ++r)
+      printf("%s r%u", r ? "," : "", *regs[r]);
+    switch (instruction.opcode) {
+      case opcode_k::jump:
+        printf(" %u", instruction.dst);
+        break;
+      case opcode_k::jump_if_zero:
+      case opcode_k::jump_if_no_case:
+        printf(", %u", instruction.dst);
+        break;
+      case opcode_k::jump_table:
+        printf(", table %u", instruction.b);
+        break;
+      default:
+        break;
+    }
+    printf("\n");
+  }
+  for (size_t i = 0; i < jump_tables.size(); ++i) {
+    printf("table %zu:", i);
+    for (const std::pair<int64_t, uint32_t> &c : jump_tables[i].cases)
+      printf(" %lld -> %u,", (long long)c.first, c.second);
+    printf(" otherwise -> %u\n", jump_tables[i].otherwise);
+  }
+}
+
+static opcode_k builtin_opcode(builtin_k kind) {
+  switch (kind) {
+    case builtin_k::sin:    return opcode_k::sin;
+    case builtin_k::cos:    return opcode_k::cos;
+    case builtin_k::exp:    return opcode_k::exp;
+    case builtin_k::inv:    return opcode_k::inv;
+    case builtin_k::plus:   return opcode_k::plus;
+    case builtin_k::minus:  return opcode_k::minus;
+    case builtin_k::mult:   return opcode_k::mult;
+    case builtin_k::divide: return opcode_k::divide;
+    case builtin_k::ceq:    return opcode_k::ceq;
+    case builtin_k::cneq:   return opcode_k::cneq;
+    case builtin_k::clt:    return opcode_k::clt;
+    case builtin_k::clteq:  return opcode_k::clteq;
+    case builtin_k::cgt:    return opcode_k::cgt;
+    case builtin_k::cgteq:  return opcode_k::cgteq;
+    case builtin_k::mod:    return opcode_k::mod;
+    case builtin_k::pow:    return opcode_k::pow;
+    case builtin_k::abs:    return opcode_k::abs;
+    case builtin_k::floor:  return opcode_k::floor;
+    case builtin_k::round:  return opcode_k::round;
+    case builtin_k::ceil:   return opcode_k::ceil;
+    case builtin_k::sqrt:   return opcode_k::sqrt;
+    default:                die("unexpected builtin kind");
+  }
+}
+
+struct cenv_t;
+
+enum class cvalue_k {
+  number,
+  lambda,
+  builtin,
+  partial,
+  pending // let binding that isn't compiled yet
+};
+
+// value known at compile time. of these, only numbers are left for runtime
+struct cvalue_t {
+  cvalue_k kind;
+  union {
+    uint32_t reg;
+    struct {
+      const value_t *value; // outermost of directly nested lambdas
+      cenv_t *env;
+      // frame of arguments given so far while there are fewer than arity
+      cenv_t *args;
+      uint32_t num_args;
+    } lambda;
+    builtin_k builtin;
+    struct {
+      builtin_k kind;
+      const term_t *parameter; // compiled in env when builtin is saturated
+      cenv_t *env;
+    } partial;
+  };
+};
+
+// bindings of one group of lambdas or let by slot, like frame_t in the tree
+// walker
+struct cenv_t {
+  std::vector<cvalue_t> slots;
+  cenv_t *parent;
+};
+
+// opcode and operands of instruction computing a value
+typedef std::tuple<opcode_k, uint32_t, uint32_t> value_key_t;
+
+struct compiler_t {
+  bytecode_t *bytecode;
+  std::string *error;
+  std::vector<cenv_t*> envs;
+  std::map<uint64_t, uint32_t> constant_registers; // by bit pattern of value
+  // registers of values computed on every path to the current instruction.
+  // since definitions are inlined at each use, identical subterms compile to
+  // identical instructions, which are emitted once this way
+  std::map<value_key_t, uint32_t> value_registers;
+  std::vector<value_key_t> value_log; // keys in order of computation
+  size_t control_period;
+  // registers of controls by register of the value they mark
+  std::map<uint32_t, uint32_t> control_registers;
+  int depth;
+};
+
+static bool compile_term(compiler_t *c, const term_t *term, cenv_t *env
+    , cvalue_t *result);
+
+static bool fail(compiler_t *c, const std::string &error) {
+  *c->error = error;
+  return false;
+}
+
+static cenv_t* new_env(compiler_t *c, cenv_t *parent, size_t num_slots) {
+  cenv_t *env = new cenv_t;
+  env->slots.resize(num_slots);
+  env->parent = parent;
+  c->envs.push_back(env);
+  return env;
+}
+
+static uint32_t new_register(compiler_t *c) {
+  return c->bytecode->num_registers++;
+}
+
+static uint32_t constant_register(compiler_t *c, double number) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  auto constant_it = c->constant_registers.find(bits);
+  if (constant_it != c->constant_registers.end())
+    return constant_it->second;
+  uint32_t reg = new_register(c);
+  c->constant_registers[bits] = reg;
+  c->bytecode->constants.push_back({ reg, number });
+  return reg;
+}
+
+static size_t emit(compiler_t *c, opcode_k opcode, uint32_t dst, uint32_t a
+    , uint32_t b) {
+  c->bytecode->instructions.push_back({ opcode, dst, a, b });
+  return c->bytecode->instructions.size() - 1;
+}
+
+// returns register holding result of opcode on a and b, emitting instruction
+// for it only if it isn't computed yet. all opcodes that compute values are
+// pure, so one computation can be shared
+static uint32_t emit_value(compiler_t *c, opcode_k opcode, uint32_t a
+    , uint32_t b) {
+  value_key_t key(opcode, a, b);
+  auto value_it = c->value_registers.find(key);
+  if (value_it != c->value_registers.end())
+    return value_it->second;
+  uint32_t reg = new_register(c);
+  emit(c, opcode, reg, a, b);
+  c->value_registers[key] = reg;
+  c->value_log.push_back(key);
+  return reg;
+}
+
+// value of x marked with krate. it gets a register of a control, which is
+// read but never written by instructions, and lower_controls() later either
+// computes it at control points or lets it be x again
+static uint32_t control_register(compiler_t *c, uint32_t x) {
+  if (c->control_period < 2)
+    return x;
+  auto control_it = c->control_registers.find(x);
+  if (control_it != c->control_registers.end())
+    return control_it->second;
+  uint32_t reg = new_register(c);
+  c->control_registers[x] = reg;
+  c->bytecode->controls.push_back({ reg, x });
+  return reg;
+}
+
+static uint32_t emit_unary(compiler_t *c, builtin_k kind, uint32_t x) {
+  if (kind == builtin_k::krate)
+    return control_register(c, x);
+  return emit_value(c, builtin_opcode(kind), x, 0);
+}
+
+// values computed in a conditional branch aren't there on other paths, so
+// they are forgotten when the branch ends
+static size_t enter_branch(compiler_t *c) {
+  return c->value_log.size();
+}
+
+static void leave_branch(compiler_t *c, size_t mark) {
+  while (c->value_log.size() > mark) {
+    c->value_registers.erase(c->value_log.back());
+    c->value_log.pop_back();
+  }
+}
+
+static void patch_jump_here(compiler_t *c, size_t jump) {
+  c->bytecode->instructions[jump].dst = c->bytecode->instructions.size();
+}
+
+static void set_number(cvalue_t *value, uint32_t reg) {
+  value->kind = cvalue_k::number;
+  value->reg = reg;
+}
+
+static bool compile_number(compiler_t *c, const term_t *term, cenv_t *env
+    , uint32_t *reg) {
+  cvalue_t value;
+  if (!compile_term(c, term, env, &value))
+    return false;
+  if (value.kind != cvalue_k::number)
+    return fail(c, "term of kind <" + term_kind_to_string(term->kind)
+        + "> evaluates to a function where number is expected");
+  *reg = value.reg;
+  return true;
+}
+
+// value of case statement rounded to integer, if it's a number literal
+static bool constant_case_value(const term_t *value, int64_t *integer) {
+  if (value == nullptr || value->kind != term_k::value
+      || value->value->type.kind != type_k::number)
+    return false;
+  *integer = std::llround(value->value->number);
+  return true;
+}
+
+// whether term is a small expression of numbers at hand that can't fail and
+// calls nothing from libm, so that computing it on paths that don't need it
+// costs less than jumping around it. budget is the number of nodes left
+static bool is_cheap(const term_t *term, int *budget) {
+  if (--*budget < 0)
+    return false;
+  switch (term->kind) {
+    case term_k::value:
+      return term->value->type.kind == type_k::number;
+    case term_k::identifier:
+      // bindings are compiled before they are used, definitions are inlined
+      return term->identifier.resolution == resolution_k::local
+        || term->identifier.resolution == resolution_k::constant;
+    case term_k::if_else:
+      return is_cheap(term->if_else.condition, budget)
+        && is_cheap(term->if_else.then_expr, budget)
+        && is_cheap(term->if_else.else_expr, budget);
+    case term_k::unary_op:
+      switch (term->unary_op.kind) {
+        case builtin_k::inv:
+        case builtin_k::abs:
+        case builtin_k::sqrt:
+          return is_cheap(term->unary_op.x, budget);
+        default:
+          return false;
+      }
+    case term_k::binary_op:
+      switch (term->binary_op.kind) {
+        case builtin_k::mod:
+        case builtin_k::pow:
+          return false;
+        default:
+          return is_cheap(term->binary_op.x, budget)
+            && is_cheap(term->binary_op.y, budget);
+      }
+    default:
+      return false;
+  }
+}
+
+static bool compile_identifier(compiler_t *c, const term_t *term, cenv_t *env
+    , cvalue_t *result) {
+  const std::string &name = *term->identifier.name;
+  switch (term->identifier.resolution) {
+    case resolution_k::local: {
+      const cenv_t *frame = env;
+      for (uint32_t i = 0; i < term->identifier.local.depth; ++i)
+        frame = frame->parent;
+      *result = frame->slots[term->identifier.local.slot];
+      if (result->kind == cvalue_k::pending)
+        return fail(c, "let binding \"" + name
+            + "\" depends on its own value");
+      return true;
+    }
+    case resolution_k::constant:
+      set_number(result, constant_register(c, term->identifier.constant));
+      return true;
+    case resolution_k::definition: {
+      if (++c->depth > max_inlining_depth)
+        return fail(c, "maximum inlining depth exceeded at \"" + name
+            + "\": recursive definitions can't be compiled");
+      bool ok = compile_term(c, term->identifier.definition->definition.body
+          , nullptr, result);
+      --c->depth;
+      return ok;
+    }
+    default:
+      return fail(c, "unknown identifier \"" + name + "\"");
+  }
+}
+
+static bool compile_application(compiler_t *c, const term_t *term
+    , cenv_t *env, cvalue_t *result) {
+  switch (term->application.lambda->kind) {
+    case term_k::identifier:
+    case term_k::application:
+    case term_k::value:
+    case term_k::unary_op:
+    case term_k::binary_op:
+      break;
+    default:
+      return fail(c, "unexpected application lambda kind <"
+          + term_kind_to_string(term->application.lambda->kind) + ">");
+  }
+  cvalue_t lambda;
+  if (!compile_term(c, term->application.lambda, env, &lambda))
+    return false;
+  const term_t *parameter = term->application.parameter;
+  switch (lambda.kind) {
+    case cvalue_k::number:
+      return fail(c, "number can't be applied");
+    case cvalue_k::builtin: {
+      if (builtin_is_binary(lambda.builtin)) {
+        result->kind = cvalue_k::partial;
+        result->partial.kind = lambda.builtin;
+        result->partial.parameter = parameter;
+        result->partial.env = env;
+        return true;
+      }
+      uint32_t x;
+      if (!compile_number(c, parameter, env, &x))
+        return false;
+      set_number(result, emit_unary(c, lambda.builtin, x));
+      return true;
+    }
+    case cvalue_k::partial: {
+      uint32_t x, y;
+      if (!compile_number(c, parameter, env, &y)
+          || !compile_number(c, lambda.partial.parameter, lambda.partial.env
+            , &x))
+        return false;
+      set_number(result, emit_value(c, builtin_opcode(lambda.partial.kind), x
+            , y));
+      return true;
+    }
+    case cvalue_k::lambda: {
+      cvalue_t argument;
+      if (!compile_term(c, parameter, env, &argument))
+        return false;
+      // arguments of directly nested lambdas are gathered in one frame, and
+      // the innermost body is compiled once all of them are given
+      const value_t *function = lambda.lambda.value;
+      const uint32_t num_args = lambda.lambda.num_args;
+      cenv_t *frame = new_env(c, lambda.lambda.env, function->lambda.arity);
+      for (uint32_t i = 0; i < num_args; ++i)
+        frame->slots[i] = lambda.lambda.args->slots[i];
+      frame->slots[num_args] = argument;
+      if (num_args + 1 < function->lambda.arity) {
+        *result = lambda;
+        result->lambda.args = frame;
+        result->lambda.num_args = num_args + 1;
+        return true;
+      }
+      if (++c->depth > max_inlining_depth)
+        return fail(c, "maximum inlining depth exceeded: recursive definitions"
+            " can't be compiled");
+      bool ok = compile_term(c, function->lambda.inner_body, frame, result);
+      --c->depth;
+      return ok;
+    }
+    default:
+      die("unexpected compile-time value kind");
+  }
+}
+
+static bool compile_term(compiler_t *c, const term_t *term, cenv_t *env
+    , cvalue_t *result) {
+  if (c->bytecode->instructions.size() > max_instructions)
+    return fail(c, "definition is too large to be compiled");
+  switch (term->kind) {
+    case term_k::value:
+      switch (term->value->type.kind) {
+        case type_k::number:
+          set_number(result, constant_register(c, term->value->number));
+          return true;
+        case type_k::lambda:
+          result->kind = cvalue_k::lambda;
+          result->lambda.value = term->value;
+          result->lambda.env = env;
+          result->lambda.args = nullptr;
+          result->lambda.num_args = 0;
+          return true;
+        case type_k::builtin:
+          result->kind = cvalue_k::builtin;
+          result->builtin = term->value->builtin->kind;
+          return true;
+        default:
+          die("unexpected value type <%s>"
+              , type_to_string(&term->value->type).c_str());
+      }
+    case term_k::identifier:
+      return compile_identifier(c, term, env, result);
+    case term_k::case_of: {
+      uint32_t value, statement_value, statement_result;
+      if (!compile_number(c, term->case_of.value, env, &value))
+        return false;
+      set_number(result, new_register(c));
+      std::vector<size_t> jumps_to_end;
+      bool exhaustive = false;
+      // values of statements are computed on the way to the following ones,
+      // but not after the case if an earlier statement matched
+      size_t case_mark = enter_branch(c);
+      const std::vector<term_t::case_statement> &statements
+        = *term->case_of.statements;
+      for (size_t s = 0; s < statements.size(); ++s) {
+        const term_t::case_statement &statement = statements[s];
+        size_t run_end = s;
+        int64_t case_value;
+        while (run_end < statements.size()
+            && constant_case_value(statements[run_end].value, &case_value))
+          ++run_end;
+        if (run_end - s >= min_jump_table_cases) {
+          // a run of number literals is matched with one lookup instead of
+          // comparing with each in turn. if none matches, matching goes on
+          // with the statements after the run
+          const uint32_t table = c->bytecode->jump_tables.size();
+          emit(c, opcode_k::jump_table, 0, value, table);
+          std::map<int64_t, uint32_t> targets;
+          for (size_t k = s; k < run_end; ++k) {
+            constant_case_value(statements[k].value, &case_value);
+            // statements with values matched earlier are never chosen
+            if (targets.count(case_value))
+              continue;
+            targets[case_value] = c->bytecode->instructions.size();
+            size_t result_mark = enter_branch(c);
+            if (!compile_number(c, statements[k].result, env
+                  , &statement_result))
+              return false;
+            leave_branch(c, result_mark);
+            emit(c, opcode_k::move, result->reg, statement_result, 0);
+            jumps_to_end.push_back(emit(c, opcode_k::jump, 0, 0, 0));
+          }
+          jump_table_t jump_table;
+          jump_table.cases.assign(targets.begin(), targets.end());
+          jump_table.otherwise = c->bytecode->instructions.size();
+          jump_table.dense = (uint64_t)targets.rbegin()->first
+            - (uint64_t)targets.begin()->first == targets.size() - 1;
+          c->bytecode->jump_tables.push_back(jump_table);
+          s = run_end - 1;
+          continue;
+        }
+        size_t jump_to_next = 0;
+        if (statement.value != nullptr) {
+          if (!compile_number(c, statement.value, env, &statement_value))
+            return false;
+          jump_to_next = emit(c, opcode_k::jump_if_no_case, 0, value
+              , statement_value);
+        }
+        size_t result_mark = enter_branch(c);
+        if (!compile_number(c, statement.result, env, &statement_result))
+          return false;
+        leave_branch(c, result_mark);
+        emit(c, opcode_k::move, result->reg, statement_result, 0);
+        if (statement.value == nullptr) {
+          exhaustive = true;
+          break;
+        }
+        jumps_to_end.push_back(emit(c, opcode_k::jump, 0, 0, 0));
+        patch_jump_here(c, jump_to_next);
+      }
+      leave_branch(c, case_mark);
+      if (!exhaustive)
+        emit(c, opcode_k::fail, 0, 0, 0);
+      for (size_t jump : jumps_to_end)
+        patch_jump_here(c, jump);
+      return true;
+    }
+    case term_k::if_else: {
+      uint32_t condition, then_value, else_value;
+      if (!compile_number(c, term->if_else.condition, env, &condition))
+        return false;
+      set_number(result, new_register(c));
+      int then_budget = max_select_nodes, else_budget = max_select_nodes;
+      if (is_cheap(term->if_else.then_expr, &then_budget)
+          && is_cheap(term->if_else.else_expr, &else_budget)) {
+        // both branches are computed and one of them is picked without
+        // jumps, which keeps code straight-line for block evaluation
+        if (!compile_number(c, term->if_else.then_expr, env, &then_value)
+            || !compile_number(c, term->if_else.else_expr, env, &else_value))
+          return false;
+        emit(c, opcode_k::move, result->reg, else_value, 0);
+        emit(c, opcode_k::select, result->reg, condition, then_value);
+        return true;
+      }
+      size_t jump_to_else = emit(c, opcode_k::jump_if_zero, 0, condition, 0)
+        , mark = enter_branch(c);
+      if (!compile_number(c, term->if_else.then_expr, env, &then_value))
+        return false;
+      leave_branch(c, mark);
+      emit(c, opcode_k::move, result->reg, then_value, 0);
+      size_t jump_to_end = emit(c, opcode_k::jump, 0, 0, 0);
+      patch_jump_here(c, jump_to_else);
+      if (!compile_number(c, term->if_else.else_expr, env, &else_value))
+        return false;
+      leave_branch(c, mark);
+      emit(c, opcode_k::move, result->reg, else_value, 0);
+      patch_jump_here(c, jump_to_end);
+      return true;
+    }
+    case term_k::let_in: {
+      // bindings see each other, see resolve_identifiers(), so they are
+      // compiled in the order they use each other in. lambdas of a group go
+      // first, since they only capture the frame until they are applied
+      const std::vector<term_t*> &definitions = *term->let_in.definitions;
+      cenv_t *let_env = new_env(c, env, definitions.size());
+      for (cvalue_t &slot : let_env->slots)
+        slot.kind = cvalue_k::pending;
+      for (const std::vector<size_t> &group : let_binding_groups(term))
+        for (bool lambdas : { true, false })
+          for (size_t i : group) {
+            const term_t *body = definitions[i]->definition.body;
+            const bool lambda = body->kind == term_k::value
+              && body->value->type.kind == type_k::lambda;
+            if (lambda != lambdas)
+              continue;
+            cvalue_t value;
+            if (!compile_term(c, body, let_env, &value))
+              return false;
+            let_env->slots[i] = value;
+          }
+      return compile_term(c, term->let_in.body, let_env, result);
+    }
+    case term_k::application:
+      return compile_application(c, term, env, result);
+    case term_k::unary_op: {
+      uint32_t x;
+      if (!compile_number(c, term->unary_op.x, env, &x))
+        return false;
+      set_number(result, emit_unary(c, term->unary_op.kind, x));
+      return true;
+    }
+    case term_k::binary_op: {
+      uint32_t x, y;
+      if (!compile_number(c, term->binary_op.x, env, &x)
+          || !compile_number(c, term->binary_op.y, env, &y))
+        return false;
+      set_number(result, emit_value(c, builtin_opcode(term->binary_op.kind), x
+            , y));
+      return true;
+    }
+    default:
+      return fail(c, "unexpected term kind <" + term_kind_to_string(term->kind)
+          + ">");
+  }
+}
+
+// whether instruction computes a value from its operands alone. results of
+// conditionals are written by several moves, so those aren't
+static bool is_value_instruction(const instruction_t &instruction) {
+  switch (instruction.opcode) {
+    case opcode_k::move:
+    case opcode_k::select:
+    case opcode_k::jump:
+    case opcode_k::jump_if_zero:
+    case opcode_k::jump_if_no_case:
+    case opcode_k::jump_table:
+    case opcode_k::fail:
+    case opcode_k::ret:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// takes instructions marked in removed out, retargeting jumps. jumps to a
+// removed instruction go to the next one that is left
+static void remove_instructions(bytecode_t *bytecode
+    , const std::vector<bool> &removed) {
+  std::vector<instruction_t> instructions;
+  // instruction indices after removed instructions are taken out
+  std::vector<uint32_t> index(bytecode->instructions.size() + 1);
+  for (size_t i = 0; i < bytecode->instructions.size(); ++i) {
+    index[i] = instructions.size();
+    if (!removed[i])
+      instructions.push_back(bytecode->instructions[i]);
+  }
+  index.back() = instructions.size();
+  for (instruction_t &instruction : instructions)
+    switch (instruction.opcode) {
+      case opcode_k::jump:
+      case opcode_k::jump_if_zero:
+      case opcode_k::jump_if_no_case:
+        instruction.dst = index[instruction.dst];
+        break;
+      default:
+        break;
+    }
+  for (jump_table_t &table : bytecode->jump_tables) {
+    for (std::pair<int64_t, uint32_t> &c : table.cases)
+      c.second = index[c.second];
+    table.otherwise = index[table.otherwise];
+  }
+  bytecode->instructions.swap(instructions);
+}
+
+// moves instructions computing values from registers marked in from alone
+// out of instructions into hoisted, marking their results too. with
+// unconditional, only ones that run on every path are moved
+static void hoist_values(bytecode_t *bytecode, std::vector<bool> *from
+    , bool unconditional, std::vector<instruction_t> *hoisted) {
+  std::vector<bool> removed(bytecode->instructions.size(), false);
+  // instructions before the farthest target of jumps seen so far are
+  // skipped on some paths, as all jumps go forward
+  uint32_t farthest_target = 0;
+  for (size_t i = 0; i < bytecode->instructions.size(); ++i) {
+    instruction_t instruction = bytecode->instructions[i];
+    switch (instruction.opcode) {
+      case opcode_k::jump:
+      case opcode_k::jump_if_zero:
+      case opcode_k::jump_if_no_case:
+        farthest_target = std::max(farthest_target, instruction.dst);
+        break;
+      case opcode_k::jump_table: {
+        const jump_table_t &table = bytecode->jump_tables[instruction.b];
+        for (const std::pair<int64_t, uint32_t> &c : table.cases)
+          farthest_target = std::max(farthest_target, c.second);
+        farthest_target = std::max(farthest_target, table.otherwise);
+        break;
+      }
+      default:
+        break;
+    }
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&instruction, regs);
+    bool hoist = is_value_instruction(instruction)
+      && (!unconditional || farthest_target <= i);
+    for (int r = 1; r < num_regs && hoist; ++r)
+      hoist = (*from)[*regs[r]];
+    if (hoist) {
+      (*from)[instruction.dst] = true;
+      hoisted->push_back(instruction);
+      removed[i] = true;
+    }
+  }
+  remove_instructions(bytecode, removed);
+}
+
+// specializes bytecode for a note: instructions computing values from f and
+// constants only, like "2 * pi * f", are moved to note instructions, so that
+// for a given f only instructions that depend on t are left to run for every
+// sample. values are computed once even if they are only needed in a branch,
+// since all of them are pure, and note instructions run once per note anyway
+static void split_note_instructions(bytecode_t *bytecode) {
+  std::vector<bool> of_note(bytecode->num_registers, false);
+  of_note[bytecode_register_f] = true;
+  for (const std::pair<uint32_t, double> &constant : bytecode->constants)
+    of_note[constant.first] = true;
+  hoist_values(bytecode, &of_note, false, &bytecode->note_instructions);
+}
+
+// moves instructions computing values from t and constants only, like
+// "exp (-5 * t)" of an envelope, to time instructions, which notes played at
+// the same time can share. unlike values of note, these are computed for
+// every sample, so ones that are only needed in a branch are left there
+static void split_time_instructions(bytecode_t *bytecode) {
+  std::vector<bool> of_time(bytecode->num_registers, false);
+  of_time[bytecode_register_t] = true;
+  for (const std::pair<uint32_t, double> &constant : bytecode->constants)
+    of_time[constant.first] = true;
+  hoist_values(bytecode, &of_time, true, &bytecode->time_instructions);
+}
+
+// copies instruction computing reg, after those computing its operands, to
+// control instructions, unless it's there already, and returns register of
+// the copy. copies get registers of their own, so that running control
+// instructions at control points leaves values of every sample alone
+static uint32_t copy_control_value(compiler_t *c
+    , const std::vector<size_t> &definitions, std::vector<uint32_t> *copies
+    , uint32_t reg) {
+  if ((*copies)[reg] != UINT32_MAX)
+    return (*copies)[reg];
+  instruction_t instruction = c->bytecode->instructions[definitions[reg]];
+  uint32_t *regs[3];
+  int num_regs = instruction_registers(&instruction, regs);
+  for (int r = 1; r < num_regs; ++r)
+    *regs[r] = copy_control_value(c, definitions, copies, *regs[r]);
+  instruction.dst = new_register(c);
+  c->bytecode->control_instructions.push_back(instruction);
+  (*copies)[reg] = instruction.dst;
+  return instruction.dst;
+}
+
+// makes values marked with krate that are computed from t and constants by
+// instructions of their own controls, computed by copies of those
+// instructions. others are left as they were, so their registers are
+// replaced by those of the values they mark. instructions computing only
+// what controls replaced are left dead. runs first, so that values read
+// from controls aren't taken for values of time
+static void lower_controls(compiler_t *c) {
+  bytecode_t *bytecode = c->bytecode;
+  const uint32_t num_registers = bytecode->num_registers;
+  // of f and t, which come first
+  std::vector<bool> of_time { false, true };
+  of_time.resize(num_registers, false);
+  std::vector<size_t> definitions(num_registers, SIZE_MAX);
+  std::vector<uint32_t> copies { UINT32_MAX, bytecode_register_t }
+    , renames(num_registers);
+  copies.resize(num_registers, UINT32_MAX);
+  for (const std::pair<uint32_t, double> &constant : bytecode->constants) {
+    of_time[constant.first] = true;
+    copies[constant.first] = constant.first;
+  }
+  for (size_t ip = 0; ip < bytecode->instructions.size(); ++ip) {
+    instruction_t instruction = bytecode->instructions[ip];
+    if (!is_value_instruction(instruction))
+      continue;
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&instruction, regs);
+    bool time = true;
+    for (int r = 1; r < num_regs; ++r)
+      time = time && of_time[*regs[r]];
+    of_time[instruction.dst] = time;
+    definitions[instruction.dst] = ip;
+  }
+
+  for (uint32_t r = 0; r < num_registers; ++r)
+    renames[r] = r;
+  std::vector<std::pair<uint32_t, uint32_t>> controls;
+  // marked values come before their marks, so marks of marks are renamed
+  // to what the inner ones are renamed to
+  for (const std::pair<uint32_t, uint32_t> &control : bytecode->controls)
+    if (of_time[control.second])
+      controls.push_back({ control.first, copy_control_value(c, definitions
+            , &copies, control.second) });
+    else
+      renames[control.first] = renames[control.second];
+  bytecode->controls = controls;
+  // registers of controls are never written, so all of them can be renamed
+  for (instruction_t &instruction : bytecode->instructions) {
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&instruction, regs);
+    for (int r = 0; r < num_regs; ++r)
+      *regs[r] = renames[*regs[r]];
+  }
+}
+
+// rate or offset of a value rate * t + offset, a register or one of these
+const uint32_t affine_zero = UINT32_MAX, affine_one = UINT32_MAX - 1;
+
+// of_f is set if rate or offset depends on f
+struct affine_t {
+  bool valid, of_f;
+  uint32_t rate, offset;
+};
+
+static uint32_t affine_register(compiler_t *c, uint32_t term) {
+  if (term == affine_zero)
+    return constant_register(c, 0);
+  if (term == affine_one)
+    return constant_register(c, 1);
+  return term;
+}
+
+// note instructions computing rates and offsets are added at the end, as
+// they only depend on earlier ones
+static uint32_t note_value(compiler_t *c, opcode_k opcode, uint32_t a
+    , uint32_t b) {
+  const uint32_t dst = new_register(c);
+  c->bytecode->note_instructions.push_back({ opcode, dst, a, b });
+  return dst;
+}
+
+// term of a sum or a difference of affine values
+static uint32_t affine_add(compiler_t *c, opcode_k opcode, uint32_t x
+    , uint32_t y) {
+  if (y == affine_zero)
+    return x;
+  if (x == affine_zero)
+    return opcode == opcode_k::plus ? y
+      : note_value(c, opcode_k::inv, affine_register(c, y), 0);
+  return note_value(c, opcode, affine_register(c, x), affine_register(c, y));
+}
+
+// term of an affine value multiplied or divided by value of note y
+static uint32_t affine_scale(compiler_t *c, opcode_k opcode, uint32_t x
+    , uint32_t y) {
+  if (x == affine_zero)
+    return x;
+  if (x == affine_one && opcode == opcode_k::mult)
+    return y;
+  return note_value(c, opcode, affine_register(c, x), y);
+}
+
+// replaces sines, cosines and exponentials of values of the form
+// rate * t + offset with recurrences, where rate and offset are computed
+// from values of note, like 2 * pi * f of "sin (2 * pi * f * t)". arguments
+// of these are then left unused, unless something else uses them too. ones
+// that don't depend on f are left to time instructions, which notes share.
+// runs after note instructions are split off, while each value has its
+// register
+static void lower_recurrences(compiler_t *c) {
+  bytecode_t *bytecode = c->bytecode;
+  const uint32_t num_registers = bytecode->num_registers;
+  std::vector<bool> of_note(num_registers, false)
+    , of_f(num_registers, false)
+    , lowered(bytecode->instructions.size(), false);
+  of_note[bytecode_register_f] = true;
+  of_f[bytecode_register_f] = true;
+  for (const std::pair<uint32_t, double> &constant : bytecode->constants)
+    of_note[constant.first] = true;
+  for (instruction_t i : bytecode->note_instructions) {
+    of_note[i.dst] = true;
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&i, regs);
+    for (int r = 1; r < num_regs; ++r)
+      of_f[i.dst] = of_f[i.dst] || of_f[*regs[r]];
+  }
+  // f is of note, t is 1 * t + 0
+  std::vector<affine_t> affine { { false, false, 0, 0 }
+    , { true, false, affine_one, affine_zero } };
+  affine.resize(num_registers, { false, false, 0, 0 });
+  auto operand = [&](uint32_t reg) -> affine_t {
+    return of_note[reg] ? affine_t { true, of_f[reg], affine_zero, reg }
+      : affine[reg];
+  };
+
+  for (size_t ip = 0; ip < bytecode->instructions.size(); ++ip) {
+    const instruction_t &i = bytecode->instructions[ip];
+    if (!is_value_instruction(i))
+      continue;
+    const affine_t a = operand(i.a);
+    affine_t &d = affine[i.dst];
+    switch (i.opcode) {
+      case opcode_k::sin:
+      case opcode_k::cos:
+      case opcode_k::exp:
+        if (a.valid && a.of_f && a.rate != affine_zero) {
+          bytecode->recurrences.push_back({ i.opcode, i.dst
+              , affine_register(c, a.rate), affine_register(c, a.offset) });
+          lowered[ip] = true;
+        }
+        break;
+      case opcode_k::inv:
+        if (a.valid)
+          d = { true, a.of_f
+            , affine_add(c, opcode_k::minus, affine_zero, a.rate)
+            , affine_add(c, opcode_k::minus, affine_zero, a.offset) };
+        break;
+      case opcode_k::plus:
+      case opcode_k::minus: {
+        const affine_t b = operand(i.b);
+        if (a.valid && b.valid)
+          d = { true, a.of_f || b.of_f
+            , affine_add(c, i.opcode, a.rate, b.rate)
+            , affine_add(c, i.opcode, a.offset, b.offset) };
+        break;
+      }
+      case opcode_k::mult:
+      case opcode_k::divide:
+        if (a.valid && of_note[i.b])
+          d = { true, a.of_f || of_f[i.b]
+            , affine_scale(c, i.opcode, a.rate, i.b)
+            , affine_scale(c, i.opcode, a.offset, i.b) };
+        else if (i.opcode == opcode_k::mult && of_note[i.a]
+            && operand(i.b).valid) {
+          const affine_t b = operand(i.b);
+          d = { true, b.of_f || of_f[i.a]
+            , affine_scale(c, i.opcode, b.rate, i.a)
+            , affine_scale(c, i.opcode, b.offset, i.a) };
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  remove_instructions(bytecode, lowered);
+}
+
+// removes value instructions whose results nothing reads, last ones first
+static void eliminate_dead_values(bytecode_t *bytecode) {
+  std::vector<uint32_t> reads(bytecode->num_registers, 0);
+  for (std::vector<instruction_t> *list : { &bytecode->note_instructions
+      , &bytecode->time_instructions, &bytecode->instructions })
+    for (instruction_t instruction : *list) {
+      uint32_t *regs[3];
+      int num_regs = instruction_registers(&instruction, regs);
+      for (int r = is_value_instruction(instruction) ? 1 : 0; r < num_regs
+          ; ++r)
+        ++reads[*regs[r]];
+    }
+  for (const recurrence_t &recurrence : bytecode->recurrences) {
+    ++reads[recurrence.rate];
+    ++reads[recurrence.offset];
+  }
+
+  std::vector<bool> removed(bytecode->instructions.size(), false);
+  auto remove_if_dead = [&](instruction_t instruction) {
+    if (!is_value_instruction(instruction) || reads[instruction.dst] != 0)
+      return false;
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&instruction, regs);
+    for (int r = 1; r < num_regs; ++r)
+      --reads[*regs[r]];
+    return true;
+  };
+  for (size_t ip = bytecode->instructions.size(); ip-- > 0; )
+    removed[ip] = remove_if_dead(bytecode->instructions[ip]);
+  remove_instructions(bytecode, removed);
+  for (std::vector<instruction_t> *list : { &bytecode->time_instructions
+      , &bytecode->note_instructions }) {
+    std::vector<instruction_t> left;
+    for (size_t ip = list->size(); ip-- > 0; )
+      if (!remove_if_dead((*list)[ip]))
+        left.push_back((*list)[ip]);
+    list->assign(left.rbegin(), left.rend());
+  }
+}
+
+// value of weight w is multiplied by 2^w when f is multiplied by a power of
+// two and t is divided by it. zero fits any weight, and registers not
+// written yet have none
+const int any_weight = INT_MAX, no_weight = INT_MIN;
+
+static bool unify_weights(int a, int b, int *weight) {
+  *weight = a == any_weight ? b : a;
+  return a == any_weight || b == any_weight || a == b;
+}
+
+// whether instructions depend on f and t only through their product, like
+// "sin (2 * pi * f * t)" does: scaling f by a power of two and t by its
+// inverse then gives the same result bit for bit, barring overflow and
+// underflow, since such scaling commutes with rounding. weights are 1 for f,
+// -1 for t and 0 for constants. products and quotients add and subtract them,
+// sums, remainders and ordering comparisons need equal ones, and functions,
+// equality comparisons, truth values and case values need 0. must be run
+// before registers are allocated, while each one holds a single value or the
+// result of a conditional
+static bool depends_on_phase_only(const bytecode_t *bytecode) {
+  // of f and t, which come first
+  std::vector<int> weights { 1, -1 };
+  weights.resize(bytecode->num_registers, no_weight);
+  for (const std::pair<uint32_t, double> &constant : bytecode->constants)
+    weights[constant.first] = constant.second == 0 ? any_weight : 0;
+  for (const instruction_t &i : bytecode->instructions) {
+    // jumps keep their target in dst and jump tables theirs in b
+    int a = i.opcode == opcode_k::jump || i.opcode == opcode_k::fail
+      ? 0 : weights[i.a]
+      , b = i.opcode == opcode_k::jump_table ? 0 : weights[i.b], w = 0;
+    if (a == no_weight)
+      return false;
+    switch (i.opcode) {
+      case opcode_k::sin:
+      case opcode_k::cos:
+      case opcode_k::exp:
+      case opcode_k::floor:
+      case opcode_k::round:
+      case opcode_k::ceil:
+        if (!unify_weights(a, 0, &w))
+          return false;
+        break;
+      case opcode_k::inv:
+      case opcode_k::abs:
+      case opcode_k::move:
+        w = a;
+        break;
+      case opcode_k::sqrt:
+        // square root of 4^k x is exactly 2^k times that of x
+        if (a != any_weight && a % 2 != 0)
+          return false;
+        w = a == any_weight ? a : a / 2;
+        break;
+      case opcode_k::mult:
+      case opcode_k::divide:
+        if (b == no_weight)
+          return false;
+        if (a == any_weight || b == any_weight)
+          w = any_weight;
+        else
+          w = i.opcode == opcode_k::mult ? a + b : a - b;
+        break;
+      case opcode_k::plus:
+      case opcode_k::minus:
+      case opcode_k::mod:
+        if (b == no_weight || !unify_weights(a, b, &w))
+          return false;
+        break;
+      case opcode_k::ceq:
+      case opcode_k::cneq:
+        // operands are truncated to integers before they are compared
+        if (b == no_weight || !unify_weights(a, 0, &w)
+            || !unify_weights(b, 0, &w))
+          return false;
+        break;
+      case opcode_k::clt:
+      case opcode_k::clteq:
+      case opcode_k::cgt:
+      case opcode_k::cgteq:
+        if (b == no_weight || !unify_weights(a, b, &w))
+          return false;
+        w = 0;
+        break;
+      case opcode_k::pow:
+        if (b == no_weight || !unify_weights(a, 0, &w)
+            || !unify_weights(b, 0, &w))
+          return false;
+        break;
+      case opcode_k::select:
+        if (b == no_weight || !unify_weights(a, 0, &w))
+          return false;
+        w = b;
+        break;
+      case opcode_k::jump_if_no_case:
+        if (b == no_weight || !unify_weights(b, 0, &w))
+          return false;
+        // fallthrough
+      case opcode_k::jump_if_zero:
+      case opcode_k::jump_table:
+      case opcode_k::ret:
+        if (!unify_weights(a, 0, &w))
+          return false;
+        continue;
+      case opcode_k::jump:
+      case opcode_k::fail:
+        continue;
+    }
+    // results of conditionals are written once in each branch
+    if (weights[i.dst] != no_weight
+        && !unify_weights(weights[i.dst], w, &w))
+      return false;
+    weights[i.dst] = w;
+  }
+  return true;
+}
+
+// makes instructions return the value of register factor instead of the
+// product of it with another one, and takes out instructions that only the
+// other one needed, moves of conditionals too. jumps are kept, and so are
+// the values they test
+static void return_factor(bytecode_t *bytecode, uint32_t factor) {
+  bytecode->instructions.back().a = factor;
+  std::vector<bool> needed(bytecode->num_registers, false)
+    , removed(bytecode->instructions.size(), false);
+  // all jumps go forward, so every read of a register comes after its writes
+  for (size_t ip = bytecode->instructions.size(); ip-- > 0; ) {
+    instruction_t instruction = bytecode->instructions[ip];
+    const bool writes = is_value_instruction(instruction)
+      || instruction.opcode == opcode_k::move
+      || instruction.opcode == opcode_k::select;
+    if (writes && !needed[instruction.dst]) {
+      removed[ip] = true;
+      continue;
+    }
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&instruction, regs);
+    for (int r = writes ? 1 : 0; r < num_regs; ++r)
+      needed[*regs[r]] = true;
+  }
+  remove_instructions(bytecode, removed);
+}
+
+// whether instructions return a product g(f * t) * h(t), see
+// bytecode_t::separable. registers of g and h are written to phase and time.
+// must be run where depends_on_phase_only() is
+static bool find_factors(const bytecode_t *bytecode, uint32_t *phase
+    , uint32_t *time) {
+  if (bytecode->instructions.empty()
+      || bytecode->instructions.back().opcode != opcode_k::ret)
+    return false;
+  const uint32_t result = bytecode->instructions.back().a;
+  const instruction_t *product = nullptr;
+  for (size_t ip = 0; ip + 1 < bytecode->instructions.size(); ++ip) {
+    const instruction_t &i = bytecode->instructions[ip];
+    switch (i.opcode) {
+      case opcode_k::ret:
+        return false;
+      case opcode_k::jump:
+      case opcode_k::jump_if_zero:
+      case opcode_k::jump_if_no_case:
+      case opcode_k::jump_table:
+      case opcode_k::fail:
+        break;
+      default:
+        // results of conditionals are written by several moves, while a
+        // value written once is computed on every path to ret
+        if (i.dst == result) {
+          if (product != nullptr)
+            return false;
+          product = &i;
+        }
+    }
+  }
+  if (product == nullptr || product->opcode != opcode_k::mult)
+    return false;
+  for (const std::pair<uint32_t, uint32_t> &factors : {
+      std::make_pair(product->a, product->b)
+      , std::make_pair(product->b, product->a) }) {
+    bytecode_t g = *bytecode, h = *bytecode;
+    return_factor(&g, factors.first);
+    return_factor(&h, factors.second);
+    if (!depends_on_phase_only(&g))
+      continue;
+    bool uses_f = false;
+    for (instruction_t instruction : h.instructions) {
+      uint32_t *regs[3];
+      int num_regs = instruction_registers(&instruction, regs);
+      for (int r = 0; r < num_regs; ++r)
+        uses_f |= *regs[r] == bytecode_register_f;
+    }
+    if (uses_f)
+      continue;
+    *phase = factors.first;
+    *time = factors.second;
+    return true;
+  }
+  return false;
+}
+
+// renumbers registers so that f, t, constants and values of note and of time
+// come first, and temporary registers with non-overlapping lifetimes share
+// the same index. since all jumps go forward, a value can only flow between
+// its first and last appearance in the instruction list
+static void allocate_registers(bytecode_t *bytecode) {
+  const uint32_t unassigned = UINT32_MAX;
+  std::vector<uint32_t> mapping(bytecode->num_registers, unassigned)
+    , first(bytecode->num_registers, unassigned)
+    , last(bytecode->num_registers, 0);
+  uint32_t next_register = 0;
+  mapping[bytecode_register_f] = next_register++;
+  mapping[bytecode_register_t] = next_register++;
+  for (std::pair<uint32_t, double> &constant : bytecode->constants) {
+    mapping[constant.first] = next_register++;
+    constant.first = mapping[constant.first];
+  }
+  // values of note live for all samples of it, values of time, controls and
+  // recurrences are copied between runs as ranges, and control instructions
+  // run in between, so they are never shared
+  for (std::vector<instruction_t> *hoisted : { &bytecode->note_instructions
+      , &bytecode->time_instructions, &bytecode->control_instructions })
+    for (instruction_t &instruction : *hoisted) {
+      mapping[instruction.dst] = next_register++;
+      uint32_t *regs[3];
+      int num_regs = instruction_registers(&instruction, regs);
+      for (int r = 0; r < num_regs; ++r)
+        *regs[r] = mapping[*regs[r]];
+    }
+  for (std::pair<uint32_t, uint32_t> &control : bytecode->controls) {
+    control.first = mapping[control.first] = next_register++;
+    control.second = mapping[control.second];
+  }
+  for (recurrence_t &recurrence : bytecode->recurrences) {
+    recurrence.dst = mapping[recurrence.dst] = next_register++;
+    recurrence.rate = mapping[recurrence.rate];
+    recurrence.offset = mapping[recurrence.offset];
+  }
+
+  for (size_t i = 0; i < bytecode->instructions.size(); ++i) {
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&bytecode->instructions[i], regs);
+    for (int r = 0; r < num_regs; ++r) {
+      first[*regs[r]] = std::min<uint32_t>(first[*regs[r]], i);
+      last[*regs[r]] = std::max<uint32_t>(last[*regs[r]], i);
+    }
+  }
+
+  // (last use, register) of temporaries that are currently alive
+  typedef std::pair<uint32_t, uint32_t> active_t;
+  std::priority_queue<active_t, std::vector<active_t>
+    , std::greater<active_t>> active;
+  std::vector<uint32_t> free_registers;
+  for (size_t i = 0; i < bytecode->instructions.size(); ++i) {
+    uint32_t *regs[3];
+    int num_regs = instruction_registers(&bytecode->instructions[i], regs);
+    for (int r = 0; r < num_regs; ++r) {
+      uint32_t reg = *regs[r];
+      if (mapping[reg] != unassigned || first[reg] != i)
+        continue;
+      while (!active.empty() && active.top().first < i) {
+        free_registers.push_back(active.top().second);
+        active.pop();
+      }
+      if (free_registers.empty())
+        mapping[reg] = next_register++;
+      else {
+        mapping[reg] = free_registers.back();
+        free_registers.pop_back();
+      }
+      active.push({ last[reg], mapping[reg] });
+    }
+    for (int r = 0; r < num_regs; ++r)
+      *regs[r] = mapping[*regs[r]];
+  }
+  bytecode->num_registers = next_register;
+}
+
+bool compile_definition(const term_t *const program, const std::string &name
+    , const compile_options_t &options, bytecode_t *bytecode
+    , std::string *error) {
+  const term_t *def = nullptr;
+  for (const term_t *const term : *program->program.terms)
+    if (term->kind == term_k::definition && *term->definition.name == name) {
+      def = term;
+      break;
+    }
+  if (def == nullptr) {
+    *error = "no definition \"" + name + "\" found";
+    return false;
+  }
+
+  const term_t *main_lam = def->definition.body;
+  assertf(main_lam->kind == term_k::value);
+  assertf(main_lam->value->type.kind == type_k::lambda);
+  const value_t *lam_freq = main_lam->value;
+  const term_t *lam_time_term = lam_freq->lambda.body;
+  assertf(lam_time_term->kind == term_k::value);
+  assertf(lam_time_term->value->type.kind == type_k::lambda);
+
+  bytecode->note_instructions.clear();
+  bytecode->time_instructions.clear();
+  bytecode->recurrences.clear();
+  bytecode->controls.clear();
+  bytecode->control_instructions.clear();
+  bytecode->control_period = options.control_period;
+  bytecode->approximate_math = options.approximate_math;
+  bytecode->instructions.clear();
+  bytecode->jump_tables.clear();
+  bytecode->constants.clear();
+  bytecode->num_registers = 2;
+
+  compiler_t c;
+  c.bytecode = bytecode;
+  c.error = error;
+  c.control_period = options.control_period;
+  c.depth = 0;
+
+  cenv_t *main_env = new_env(&c, nullptr, lam_freq->lambda.arity);
+  set_number(&main_env->slots[0], bytecode_register_f);
+  set_number(&main_env->slots[1], bytecode_register_t);
+
+  cvalue_t result;
+  bool ok = lam_freq->lambda.arity == 2
+    ? compile_term(&c, lam_freq->lambda.inner_body, main_env, &result)
+    : fail(&c, "definition evaluates to a function, expected number");
+  if (ok && result.kind != cvalue_k::number)
+    ok = fail(&c, "definition evaluates to a function, expected number");
+  if (ok) {
+    emit(&c, opcode_k::ret, 0, result.reg, 0);
+    if (!bytecode->controls.empty()) {
+      lower_controls(&c);
+      eliminate_dead_values(bytecode);
+    }
+    // of the definition itself, so before recurrences are lowered
+    bytecode->phase_only = depends_on_phase_only(bytecode);
+    uint32_t phase, time;
+    bytecode->separable = !bytecode->phase_only
+      && find_factors(bytecode, &phase, &time);
+    if (options.factor != factor_k::product) {
+      ok = bytecode->separable || fail(&c, "definition is not a product of a"
+          " value that depends on f and t only through f * t and one of t");
+      if (ok) {
+        return_factor(bytecode, options.factor == factor_k::phase ? phase
+            : time);
+        bytecode->phase_only = options.factor == factor_k::phase;
+        bytecode->separable = false;
+      }
+    }
+  }
+  if (ok) {
+    split_note_instructions(bytecode);
+    if (options.recurrences) {
+      lower_recurrences(&c);
+      eliminate_dead_values(bytecode);
+    }
+    split_time_instructions(bytecode);
+    allocate_registers(bytecode);
+    bytecode->uses_f = false;
+    for (std::vector<instruction_t> *list : { &bytecode->note_instructions
+        , &bytecode->time_instructions, &bytecode->instructions })
+      for (instruction_t instruction : *list) {
+        uint32_t *regs[3];
+        int num_regs = instruction_registers(&instruction, regs);
+        for (int r = 0; r < num_regs; ++r)
+          bytecode->uses_f |= *regs[r] == bytecode_register_f;
+      }
+    for (const recurrence_t &recurrence : bytecode->recurrences)
+      bytecode->uses_f |= recurrence.rate == bytecode_register_f
+        || recurrence.offset == bytecode_register_f;
+    bytecode->straight_line = true;
+    for (const instruction_t &instruction : bytecode->instructions)
+      switch (instruction.opcode) {
+        case opcode_k::jump:
+        case opcode_k::jump_if_zero:
+        case opcode_k::jump_if_no_case:
+        case opcode_k::jump_table:
+        case opcode_k::fail:
+          bytecode->straight_line = false;
+          break;
+        default:
+          break;
+      }
+  }
+
+  for (const cenv_t *const env : c.envs)
+    delete env;
+
+  return ok;
+}
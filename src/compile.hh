@@ -0,0 +1,174 @@
+#pragma once
+
+#include "lang.hh"
+#include <cstdint>
+
+// all operands are register indices. registers 0 and 1 hold f and t, constant
+// registers are filled in once before running and are never written to
+enum class opcode_k : uint8_t {
+  // r[dst] = op(r[a])
+  sin,
+  cos,
+  exp,
+  inv,
+  abs,
+  floor,
+  round,
+  ceil,
+  sqrt,
+  // r[dst] = r[a] op r[b]
+  plus,
+  minus,
+  mult,
+  divide,
+  ceq,
+  cneq,
+  clt,
+  clteq,
+  cgt,
+  cgteq,
+  mod,
+  pow,
+  // r[dst] = r[a]
+  move,
+  // r[dst] = r[b] if r[a] truncated to integer is not zero, r[dst] is kept
+  // otherwise. lets conditionals with cheap branches run without jumps
+  select,
+  // jumps store instruction index of the target in dst. all jumps go forward
+  jump,
+  jump_if_zero,    // if r[a] truncated to integer is zero
+  jump_if_no_case, // if r[a] and r[b] rounded to integers are not equal
+  jump_table,      // to target of r[a] rounded to integer in jump table b
+  fail,            // no matching clause in case statement
+  ret              // return r[a]
+};
+
+std::string opcode_kind_to_string(opcode_k kind);
+
+struct instruction_t {
+  opcode_k opcode;
+  uint32_t dst, a, b;
+};
+
+const uint32_t bytecode_register_f = 0, bytecode_register_t = 1;
+
+// targets of a run of case statements whose values are known at compile time
+struct jump_table_t {
+  // values rounded to integers and instruction indices, sorted by value
+  std::vector<std::pair<int64_t, uint32_t>> cases;
+  uint32_t otherwise; // instruction index if no value matches
+  bool dense; // values are consecutive, so that targets can be indexed
+  uint32_t target(int64_t value) const;
+};
+
+// samples between exact values of a recurrence_t
+const size_t recurrence_period = 64;
+
+// sine, cosine or exponential of rate * t + offset, where rate and offset are
+// registers of values of note or constants. instead of instructions, drivers
+// write it to register dst before running instructions for a sample. blocks
+// of consecutive samples compute it by recurrence, rotating sine and cosine
+// by the angle between samples or multiplying by the ratio between them, and
+// start anew from an exact value every recurrence_period samples, so that
+// rounding errors, of about that many ulps at most, don't add up
+struct recurrence_t {
+  opcode_k opcode; // sin, cos or exp
+  uint32_t dst, rate, offset;
+  // exact value at time t with values of note in registers
+  double value(const double *registers, double t) const;
+  // writes values at times (start + k) / sample_rate to out[k * stride] for
+  // k < n
+  void run(const double *registers, uint64_t start, double sample_rate
+      , size_t n, double *out, size_t stride) const;
+};
+
+// part of a definition to compile, see bytecode_t::separable
+enum class factor_k {
+  product, // the whole definition
+  phase,   // g of a definition that returns g(f * t) * h(t)
+  time     // h of it
+};
+
+struct compile_options_t {
+  // compute sines, cosines and exponentials of values affine in t, with
+  // coefficients that depend on f, by recurrence, see recurrence_t. off for
+  // renders that must match evaluation of each sample on its own bit for bit
+  bool recurrences;
+  // values marked with krate that depend on nothing but t and constants are
+  // computed exactly at samples that are multiples of control_period and
+  // interpolated linearly in between. others, and all of them if it's below
+  // 2, are computed for every sample as if they weren't marked
+  size_t control_period;
+  // block evaluation of bytecode computes sin, cos and exp by approximations
+  // of vmath.hh, which are within 1 ulp but don't match <cmath> bit for bit
+  bool approximate_math;
+  // compiling a factor of a definition that isn't separable fails
+  factor_k factor;
+  compile_options_t();
+};
+
+struct bytecode_t {
+  // values that depend on nothing but f and constants, computed once per
+  // note before instructions are run for each of its samples. they have no
+  // jumps and their registers aren't written by instructions
+  std::vector<instruction_t> note_instructions;
+  // values that depend on nothing but t and constants and are needed on every
+  // path, computed before instructions for each sample. notes played at the
+  // same time can share them. their registers are consecutive, in order of
+  // these instructions, and aren't written by instructions either
+  std::vector<instruction_t> time_instructions;
+  // their registers are consecutive too, in order
+  std::vector<recurrence_t> recurrences;
+  // values computed at control rate, see compile_options_t. drivers write
+  // interpolated values to the first register of each pair before running
+  // instructions for a sample. those registers are consecutive, in order.
+  // control instructions compute the exact value at a control point into the
+  // second register, from t and constants alone, with registers of their own
+  std::vector<std::pair<uint32_t, uint32_t>> controls;
+  std::vector<instruction_t> control_instructions;
+  size_t control_period;
+  bool approximate_math; // see compile_options_t
+  std::vector<instruction_t> instructions;
+  std::vector<jump_table_t> jump_tables;
+  std::vector<std::pair<uint32_t, double>> constants; // register and its value
+  uint32_t num_registers;
+  bool straight_line; // instructions contain no jumps
+  bool uses_f; // if not, all notes sound the same
+  // depends on f and t only through f * t, so that notes an octave apart are
+  // the same waveform, one played twice as fast as the other. bit for bit
+  // only without recurrences, which restart at multiples of
+  // recurrence_period and step by the rate of each note
+  bool phase_only;
+  // not phase_only, but returns a product g(f * t) * h(t) of a value that is
+  // and one that depends on nothing but t, so that notes an octave apart
+  // share the waveform of g
+  bool separable;
+  // register file to run bytecode with, constants filled in
+  std::vector<double> registers() const;
+  // writes values of recurrences at times (start + k) / sample_rate for
+  // k < n to values, those of sample k from values[k * recurrences.size()].
+  // registers hold values of note
+  void run_recurrences(const double *registers, uint64_t start
+      , double sample_rate, size_t n, double *values) const;
+  // control points needed to interpolate controls for n samples from start,
+  // the first of which is at sample first_control_point(start)
+  uint64_t first_control_point(uint64_t start) const;
+  size_t num_control_points(uint64_t start, size_t n) const;
+  // writes values of controls for n samples from start, interpolated
+  // between their values at control points, those of sample k to
+  // out[k * stride + j * control_stride]. values at control point p are at
+  // points[p * controls.size()]
+  void interpolate_controls(const double *points, uint64_t start, size_t n
+      , double *out, size_t stride, size_t control_stride) const;
+  void pretty_print() const;
+};
+
+// compiles top-level definition "name f t = ..." of a validated program into
+// bytecode. all lambdas, let bindings and partially applied builtins are
+// resolved at compile time and inlined, so that only numbers are left at
+// runtime, and what only depends on f or t is split off into note or time
+// instructions. returns false and sets error if the definition uses
+// something that can't be compiled that way, e.g. recursion
+bool compile_definition(const term_t *const program, const std::string &name
+    , const compile_options_t &options, bytecode_t *bytecode
+    , std::string *error);
@@ -1,339 +1,658 @@
 #include "eval.hh"
 #include "utils.hh"
+#include <algorithm>
 #include <cmath>
 
-static value_t* evaluate_term(term_t *term, const term_t *const program
-    , std::vector<value_t*> *garbage);
-
-static value_t* evaluate_application(const term_t *const term
-    , const term_t *const program, std::vector<value_t*> *garbage) {
-  value_t *lambda = nullptr;
-  switch (term->application.lambda->kind) {
-    case term_k::identifier:
-    case term_k::application:
-    case term_k::value:
-      lambda = evaluate_term(term->application.lambda, program, garbage);
-      break;
-    default:
-      die("unexpected application lambda kind <%s>"
-          , term_kind_to_string(term->application.lambda->kind).c_str());
+// enough for frames and closures of one sample of typical patches
+const size_t tree_arena_chunk_size = 4096;
+
+// what terms evaluate to in the tree walker. numbers are stored inline so
+// that arithmetic doesn't allocate, while lambdas and builtins point either
+// into the program or to values allocated during evaluation, as do partial
+// applications
+struct object_t {
+  type_k kind;
+  union {
+    double number;
+    value_t *function;
+    // body of let binding, evaluated in its frame. null while it's evaluated
+    const term_t *thunk;
+  };
+};
+
+// bindings of one lambda application or let evaluation. identifiers refer to
+// them by (depth, slot) as assigned by resolve_identifiers(). let bindings are
+// thunks until first used, when they are replaced by what they evaluate to
+struct frame_t {
+  frame_t *parent;
+  object_t slots[1]; // actually as many as there are bindings
+};
+
+// frames and values created during evaluation live in the evaluator's arena,
+// which is reset after each eval(). they are never destructed, since they
+// share names and bodies with the program
+static frame_t* new_frame(frame_t *parent, size_t num_slots
+    , arena_t *arena) {
+  frame_t *frame = (frame_t*)arena->allocate(sizeof(frame_t)
+      + (std::max<size_t>(num_slots, 1) - 1) * sizeof(object_t));
+  frame->parent = parent;
+  return frame;
+}
+
+static object_t object_number(double number) {
+  object_t object;
+  object.kind = type_k::number;
+  object.number = number;
+  return object;
+}
+
+static object_t object_function(value_t *function) {
+  object_t object;
+  object.kind = function->type.kind;
+  object.function = function;
+  return object;
+}
+
+static std::string object_type_to_string(const object_t &object) {
+  if (object.kind == type_k::number)
+    return "number";
+  return type_to_string(&object.function->type);
+}
+
+// number of arguments function is applied to at once
+static uint32_t function_arity(const value_t *function) {
+  if (function->type.kind == type_k::builtin)
+    return builtin_is_binary(function->builtin->kind) ? 2 : 1;
+  return function->lambda.arity;
+}
+
+static object_t object_partial(value_t *function, frame_t *args
+    , uint32_t num_args, arena_t *arena) {
+  value_t *partial = (value_t*)arena->allocate(sizeof(value_t));
+  partial->type.kind = type_k::partial;
+  partial->partial.function = function;
+  partial->partial.args = args;
+  partial->partial.num_args = num_args;
+  return object_function(partial);
+}
+
+static void check_builtin_parameter(builtin_k kind, const object_t &parameter
+    , const char *what) {
+  if (parameter.kind != type_k::number)
+    die("builtin %s/1: %s of type <%s>, expected <number>"
+        , builtin_kind_to_string(kind).c_str(), what
+        , object_type_to_string(parameter).c_str());
+}
+
+// the tree walker recurses on subterms on the native stack, but only so deep.
+// past max_native_depth evaluation is suspended: every level that waits for a
+// value leaves a continuation saying what to do with it on a stack on the
+// heap, and the walker goes on with the term it stopped at from the bottom of
+// the native stack. calls in tail position don't nest at all, the walker goes
+// on with the callee's body in place of the call. so recursive definitions
+// take constant native stack however deep they recurse
+const int max_native_depth = 128;
+
+enum class continuation_k : uint8_t {
+  force,          // store value in slot of let binding that was used
+  case_value,     // match value against statements of case
+  case_statement, // match value of statement against that of case
+  if_condition,   // take branch that value selects
+  unary_op,       // apply operator to value
+  binary_op_x,    // keep value as x and evaluate y
+  binary_op_y,    // apply operator to x and value
+  apply,          // apply value to arguments of application
+  argument        // keep value as next argument of function being applied
+};
+
+// call whose body is being evaluated in tail position. a call of the same
+// function from there with numbers only starts over in place of the current
+// one: the arena is rewound to where its frame was allocated, which makes
+// self-tail-recursion a loop in constant memory. this is safe unless
+// something allocated since then can still be reached, which for numbers as
+// arguments is only possible through let bindings outside of the call, so
+// forcing them to anything but a number is counted as an escape
+struct activation_t {
+  const value_t *callee; // null outside of tail position of any call
+  arena_t::mark_t mark;
+  uint64_t escapes; // walker's escapes when the call started
+};
+
+struct continuation_t {
+  continuation_k kind;
+  const term_t *term; // term whose subterm is being evaluated
+  frame_t *env;
+  activation_t activation; // of term, for its subterms in tail position
+  union {
+    object_t *slot; // force
+    object_t x; // binary_op_y
+    struct {
+      long long value; // rounded
+      size_t statement; // index of statement being matched
+    } case_of;
+    struct {
+      // function being applied, null while it's being evaluated, the number
+      // of spine arguments left to take and of ones taken that are on the
+      // stack of values
+      value_t *callee;
+      uint32_t n, num_args;
+    } apply;
+  };
+};
+
+struct walker_t {
+  arena_t *arena;
+  std::vector<continuation_t> continuations;
+  std::vector<object_t> values; // arguments taken but not bound yet
+  // where evaluation was suspended, or what is evaluated in place of a call
+  // in tail position
+  const term_t *term;
+  frame_t *env;
+  activation_t activation;
+  uint64_t escapes;
+  explicit walker_t(arena_t *arena) : arena(arena) {}
+};
+
+// how resuming a continuation or applying a function ended
+enum class step_k : uint8_t {
+  value,     // with a value
+  term,      // with walker's term to evaluate in its place, in tail position
+  suspended
+};
+
+static const activation_t no_activation = { nullptr, { 0, nullptr, 0 }, 0 };
+
+static bool evaluate(walker_t *w, const term_t *term, frame_t *env
+    , const activation_t *tail, int depth, object_t *value);
+
+static continuation_t* push_continuation(walker_t *w, continuation_k kind
+    , const term_t *term, frame_t *env, const activation_t *tail) {
+  w->continuations.push_back(continuation_t());
+  continuation_t *k = &w->continuations.back();
+  k->kind = kind;
+  k->term = term;
+  k->env = env;
+  k->activation = tail == nullptr ? no_activation : *tail;
+  return k;
+}
+
+// i-th parameter from the top of spine of applications "h a1 ... an", an being
+// the 0th
+static const term_t* spine_argument(const term_t *term, uint32_t i) {
+  for (; i > 0; --i)
+    term = term->application.lambda;
+  return term->application.parameter;
+}
+
+static long long case_value(const object_t &value) {
+  if (value.kind != type_k::number)
+    die("anything but numbers are not supported in case statements yet");
+  return std::llround(value.number);
+}
+
+// finds result of the first statement of case term from the statement-th on
+// that matches value. literals are compared right away rather than evaluated
+static bool match_case(walker_t *w, const term_t *term, frame_t *env
+    , const activation_t *tail, long long value, size_t statement, int depth
+    , const term_t **result) {
+  const std::vector<term_t::case_statement> &statements
+    = *term->case_of.statements;
+  for (size_t s = statement; s < statements.size(); ++s) {
+    const term_t *const label = statements[s].value;
+    if (label == nullptr) {
+    } else if (label->kind == term_k::value
+        && label->value->type.kind == type_k::number) {
+      if (value != std::llround(label->value->number))
+        continue;
+    } else {
+      object_t label_value;
+      if (!evaluate(w, label, env, nullptr, depth + 1, &label_value)) {
+        continuation_t *k = push_continuation(w
+            , continuation_k::case_statement, term, env, tail);
+        k->case_of.value = value;
+        k->case_of.statement = s;
+        return false;
+      }
+      if (value != case_value(label_value))
+        continue;
+    }
+    *result = statements[s].result;
+    return true;
   }
+  die("no matching clause in case statement");
+}
 
-  switch (lambda->type.kind) {
-    case type_k::builtin: {
-      value_t *applied_parameter
-        = evaluate_term(term->application.parameter, program, garbage);
-      switch (lambda->builtin->kind) {
-        case builtin_k::sin: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin sin/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(sin(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+static const term_t* if_branch(const term_t *term, const object_t &condition) {
+  if (condition.kind != type_k::number)
+    die("anything but numbers are not supported in if statements yet");
+  return (int64_t)condition.number == 0 ? term->if_else.else_expr
+    : term->if_else.then_expr;
+}
+
+static object_t unary_op(const term_t *term, const object_t &x) {
+  const builtin_k kind = term->unary_op.kind;
+  if (!term->unary_op.typed)
+    check_builtin_parameter(kind, x, "unexpected parameter");
+  return object_number(builtin_apply_unary(kind, x.number));
+}
+
+static object_t binary_op(const term_t *term, const object_t &x
+    , const object_t &y) {
+  const builtin_k kind = term->binary_op.kind;
+  if (!term->binary_op.typed) {
+    check_builtin_parameter(kind, x, "unexpected parameter");
+    check_builtin_parameter(kind, y, "applied to value");
+  }
+  return object_number(builtin_apply_binary(kind, x.number, y.number));
+}
+
+// goes on applying function of k, or *value if it's null, to arguments of its
+// application, as many at once as the function's arity asks for, so that
+// saturated calls of lambdas with several arguments make one frame and
+// "op x y" doesn't allocate. on suspension k is pushed
+static step_k continue_application(walker_t *w, continuation_t *k, int depth
+    , object_t *value) {
+  std::vector<object_t> &values = w->values;
+  arena_t *arena = w->arena;
+  while (true) {
+    if (k->apply.callee == nullptr) {
+      if (value->kind == type_k::number)
+        die("unexpected application lambda type <%s>"
+            , object_type_to_string(*value).c_str());
+      k->apply.callee = value->function;
+      k->apply.num_args = 0;
+      if (value->kind == type_k::partial) {
+        // partial application may be applied again, so it isn't modified
+        const value_t *partial = value->function;
+        k->apply.callee = partial->partial.function;
+        for (uint32_t i = 0; i < partial->partial.num_args; ++i)
+          values.push_back(partial->partial.args->slots[i]);
+        k->apply.num_args = partial->partial.num_args;
+      }
+    }
+    value_t *callee = k->apply.callee;
+    const uint32_t arity = function_arity(callee)
+      , num_args = k->apply.num_args;
+    if (num_args < arity && k->apply.n > 0) {
+      const term_t *argument = spine_argument(k->term, --k->apply.n);
+      if (!evaluate(w, argument, k->env, nullptr, depth + 1, value)) {
+        k->kind = continuation_k::argument;
+        w->continuations.push_back(*k);
+        return step_k::suspended;
+      }
+      values.push_back(*value);
+      ++k->apply.num_args;
+      continue;
+    }
+    const object_t *args = values.data() + values.size() - num_args;
+    if (callee->type.kind == type_k::builtin) {
+      // operands are checked once both are there
+      const builtin_k kind = callee->builtin->kind;
+      if (num_args < arity) {
+        frame_t *bound = new_frame(nullptr, 1, arena);
+        bound->slots[0] = args[0];
+        *value = object_partial(callee, bound, 1, arena);
+      } else if (arity == 1) {
+        check_builtin_parameter(kind, args[0], "unexpected parameter");
+        *value = object_number(builtin_apply_unary(kind, args[0].number));
+      } else {
+        check_builtin_parameter(kind, args[0], "unexpected parameter");
+        check_builtin_parameter(kind, args[1], "applied to value");
+        *value = object_number(builtin_apply_binary(kind, args[0].number
+              , args[1].number));
+      }
+      values.resize(values.size() - num_args);
+    } else if (num_args < arity) {
+      frame_t *frame = new_frame(callee->lambda.env, arity, arena);
+      std::copy(args, args + num_args, frame->slots);
+      values.resize(values.size() - num_args);
+      *value = object_partial(callee, frame, num_args, arena);
+    } else {
+      bool in_place = k->apply.n == 0 && k->activation.callee == callee
+        && k->activation.escapes == w->escapes;
+      for (uint32_t i = 0; i < arity && in_place; ++i)
+        in_place = args[i].kind == type_k::number;
+      if (in_place)
+        arena->rewind(k->activation.mark);
+      activation_t activation;
+      activation.callee = callee;
+      activation.mark = arena->mark();
+      activation.escapes = w->escapes;
+      frame_t *frame = new_frame(callee->lambda.env, arity, arena);
+      std::copy(args, args + arity, frame->slots);
+      values.resize(values.size() - arity);
+      if (k->apply.n == 0) {
+        w->term = callee->lambda.inner_body;
+        w->env = frame;
+        w->activation = activation;
+        return step_k::term;
+      }
+      // the body's value is applied to the arguments that are left
+      k->apply.callee = nullptr;
+      if (!evaluate(w, callee->lambda.inner_body, frame, &activation
+            , depth + 1, value)) {
+        k->kind = continuation_k::apply;
+        w->continuations.push_back(*k);
+        return step_k::suspended;
+      }
+      continue;
+    }
+    if (k->apply.n == 0)
+      return step_k::value;
+    k->apply.callee = nullptr;
+  }
+}
+
+// evaluates term in env with what the native stack has room for, recursing
+// on subterms and going on with terms in tail position in place. returns
+// false if evaluation was suspended, with the term to go on with in walker
+// and continuations of levels that wait for its value pushed innermost first
+static bool evaluate(walker_t *w, const term_t *term, frame_t *env
+    , const activation_t *tail, int depth, object_t *value) {
+  if (depth > max_native_depth) {
+    w->term = term;
+    w->env = env;
+    w->activation = tail == nullptr ? no_activation : *tail;
+    return false;
+  }
+  activation_t own;
+  while (true) {
+    switch (term->kind) {
+      case term_k::value: {
+        if (term->value->type.kind == type_k::number) {
+          *value = object_number(term->value->number);
+          return true;
         }
-        case builtin_k::cos: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin cos/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(cos(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+        // lambdas capture the frame they are created in. ones outside of any
+        // lambda or let have nothing to capture and can be used as they are
+        if (term->value->type.kind != type_k::lambda || env == nullptr) {
+          *value = object_function(term->value);
+          return true;
         }
-        case builtin_k::exp: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin exp/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(exp(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+        value_t *closure = (value_t*)w->arena->allocate(sizeof(value_t));
+        closure->type = term->value->type;
+        closure->lambda.arg = term->value->lambda.arg;
+        closure->lambda.body = term->value->lambda.body;
+        closure->lambda.arity = term->value->lambda.arity;
+        closure->lambda.inner_body = term->value->lambda.inner_body;
+        closure->lambda.env = env;
+        *value = object_function(closure);
+        return true;
+      }
+      case term_k::identifier:
+        switch (term->identifier.resolution) {
+          case resolution_k::local: {
+            frame_t *frame = env;
+            for (uint32_t i = 0; i < term->identifier.local.depth; ++i)
+              frame = frame->parent;
+            object_t &binding = frame->slots[term->identifier.local.slot];
+            if (binding.kind == type_k::thunk) {
+              // bindings see each other, so they can refer to themselves. the
+              // body is taken out while it's evaluated to tell when one does
+              // before it has a value
+              const term_t *thunk = binding.thunk;
+              if (thunk == nullptr)
+                die("let binding \"%s\" depends on its own value"
+                    , term->identifier.name->c_str());
+              binding.thunk = nullptr;
+              if (!evaluate(w, thunk, frame, nullptr, depth + 1, value)) {
+                push_continuation(w, continuation_k::force, term, env, tail)
+                  ->slot = &binding;
+                return false;
+              }
+              binding = *value;
+              if (value->kind != type_k::number)
+                ++w->escapes;
+            }
+            *value = binding;
+            return true;
+          }
+          case resolution_k::definition:
+            term = term->identifier.definition->definition.body;
+            env = nullptr;
+            continue;
+          case resolution_k::constant:
+            *value = object_number(term->identifier.constant);
+            return true;
+          default:
+            die("unknown identifier \"%s\"", term->identifier.name->c_str());
         }
-        case builtin_k::inv: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin inv/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(-applied_parameter->number);
-          garbage->push_back(result);
-          return result;
+      case term_k::case_of: {
+        if (!evaluate(w, term->case_of.value, env, nullptr, depth + 1
+              , value)) {
+          push_continuation(w, continuation_k::case_value, term, env, tail);
+          return false;
         }
-        case builtin_k::abs: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin abs/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(std::fabs(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+        if (!match_case(w, term, env, tail, case_value(*value), 0, depth
+              , &term))
+          return false;
+        continue;
+      }
+      case term_k::if_else:
+        if (!evaluate(w, term->if_else.condition, env, nullptr, depth + 1
+              , value)) {
+          push_continuation(w, continuation_k::if_condition, term, env
+              , tail);
+          return false;
         }
-        case builtin_k::floor: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin floor/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(std::floor(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+        term = if_branch(term, *value);
+        continue;
+      case term_k::let_in: {
+        // bindings are evaluated on first use, so that ones not used on the
+        // path taken cost nothing
+        const std::vector<term_t*> &definitions = *term->let_in.definitions;
+        frame_t *frame = new_frame(env, definitions.size(), w->arena);
+        for (size_t i = 0; i < definitions.size(); ++i) {
+          frame->slots[i].kind = type_k::thunk;
+          frame->slots[i].thunk = definitions[i]->definition.body;
         }
-        case builtin_k::round: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin round/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(std::round(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+        term = term->let_in.body;
+        env = frame;
+        continue;
+      }
+      case term_k::application: {
+        // "h a1 ... an" evaluates h and applies it to the arguments
+        uint32_t n = 0;
+        const term_t *head = term;
+        for (; head->kind == term_k::application; ++n)
+          head = head->application.lambda;
+        switch (head->kind) {
+          case term_k::identifier:
+          case term_k::value:
+          case term_k::unary_op:
+          case term_k::binary_op:
+            break;
+          default:
+            die("unexpected application lambda kind <%s>"
+                , term_kind_to_string(head->kind).c_str());
         }
-        case builtin_k::ceil: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin ceil/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(std::ceil(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+        continuation_t k;
+        k.kind = continuation_k::apply;
+        k.term = term;
+        k.env = env;
+        k.activation = tail == nullptr ? no_activation : *tail;
+        k.apply.callee = nullptr;
+        k.apply.n = n;
+        if (!evaluate(w, head, env, nullptr, depth + 1, value)) {
+          w->continuations.push_back(k);
+          return false;
         }
-        case builtin_k::sqrt: {
-          if (applied_parameter->type.kind != type_k::number)
-            die("builtin sqrt/1: unexpected parameter of type <%s>, expected"
-                " <number>" , type_to_string(&applied_parameter->type).c_str());
-          value_t *result = value_number(std::sqrt(applied_parameter->number));
-          garbage->push_back(result);
-          return result;
+        switch (continue_application(w, &k, depth, value)) {
+          case step_k::value:
+            return true;
+          case step_k::suspended:
+            return false;
+          default:
+            break;
         }
-        case builtin_k::plus:
-        case builtin_k::minus:
-        case builtin_k::mult:
-        case builtin_k::divide:
-        case builtin_k::ceq:
-        case builtin_k::cneq:
-        case builtin_k::clt:
-        case builtin_k::clteq:
-        case builtin_k::cgt:
-        case builtin_k::cgteq:
-        case builtin_k::mod:
-        case builtin_k::pow:
-          if (lambda->builtin->binary_op.x == nullptr) {
-            lambda->builtin->binary_op.x = term->application.parameter;
-            return lambda;
-          } else {
-            value_t *stored_parameter
-              = evaluate_term(lambda->builtin->binary_op.x, program, garbage);
-            if (stored_parameter->type.kind != type_k::number)
-              die("builtin %s/1: unexpected parameter of type <%s>, expected"
-                  " <number>"
-                  , builtin_kind_to_string(lambda->builtin->kind).c_str()
-                  , type_to_string(&stored_parameter->type).c_str());
-            if (applied_parameter->type.kind != type_k::number)
-              die("builtin %s/1: applied to value of type <%s>, expected"
-                  " <number>"
-                  , builtin_kind_to_string(lambda->builtin->kind).c_str()
-                  , type_to_string(&applied_parameter->type).c_str());
-            lambda->builtin->binary_op.x = nullptr;
-            value_t *result;
-            switch (lambda->builtin->kind) { // :born_to_think:
-              case builtin_k::plus:
-                result = value_number(stored_parameter->number
-                    + applied_parameter->number);
-                break;
-              case builtin_k::minus:
-                result = value_number(stored_parameter->number
-                    - applied_parameter->number);
-                break;
-              case builtin_k::mult:
-                result = value_number(stored_parameter->number
-                    * applied_parameter->number);
-                break;
-              case builtin_k::divide:
-                result = value_number(stored_parameter->number
-                    / applied_parameter->number);
-                break;
-              case builtin_k::ceq:
-                result = value_number((int64_t)stored_parameter->number
-                    == (int64_t)applied_parameter->number);
-                break;
-              case builtin_k::cneq:
-                result = value_number((int64_t)stored_parameter->number
-                    != (int64_t)applied_parameter->number);
-                break;
-              case builtin_k::clt:
-                result = value_number(stored_parameter->number
-                    < applied_parameter->number);
-                break;
-              case builtin_k::clteq:
-                result = value_number(stored_parameter->number
-                    <= applied_parameter->number);
-                break;
-              case builtin_k::cgt:
-                result = value_number(stored_parameter->number
-                    > applied_parameter->number);
-                break;
-              case builtin_k::cgteq:
-                result = value_number(stored_parameter->number
-                    <= applied_parameter->number);
-                break;
-              case builtin_k::mod:
-                result = value_number(std::fmod(stored_parameter->number
-                      , applied_parameter->number));
-                break;
-              case builtin_k::pow:
-                result = value_number(std::pow(stored_parameter->number
-                      , applied_parameter->number));
-                break;
-              default: // silence warning
-                break;
-            }
-            garbage->push_back(result);
-            return result;
-          }
-        default:
-          die("unexpected builtin kind");
+        term = w->term;
+        env = w->env;
+        own = w->activation;
+        tail = &own;
+        continue;
       }
-      break;
-    }
-    case type_k::lambda: {
-      value_t *parameter = evaluate_term(term->application.parameter, program
-          , garbage);
-      if (!lambda->lambda.body->scope)
-        lambda->lambda.body->scope = new scope_t;
-      (*lambda->lambda.body->scope)[*lambda->lambda.arg] = parameter;
-      return evaluate_term(lambda->lambda.body, program, garbage);
-      // maybe delete scope here and return later? probably not
+      case term_k::unary_op:
+        if (!evaluate(w, term->unary_op.x, env, nullptr, depth + 1, value)) {
+          push_continuation(w, continuation_k::unary_op, term, env, tail);
+          return false;
+        }
+        *value = unary_op(term, *value);
+        return true;
+      case term_k::binary_op: {
+        object_t x;
+        if (!evaluate(w, term->binary_op.x, env, nullptr, depth + 1, &x)) {
+          push_continuation(w, continuation_k::binary_op_x, term, env, tail);
+          return false;
+        }
+        if (!evaluate(w, term->binary_op.y, env, nullptr, depth + 1, value)) {
+          push_continuation(w, continuation_k::binary_op_y, term, env, tail)
+            ->x = x;
+          return false;
+        }
+        *value = binary_op(term, x, *value);
+        return true;
+      }
+      default:
+        die("unexpected term kind <%s>"
+            , term_kind_to_string(term->kind).c_str());
     }
-    default:
-      die("unexpected application lambda type <%s>"
-          , type_to_string(&lambda->type).c_str());
   }
 }
 
-static value_t* evaluate_term(term_t *term, const term_t *const program
-    , std::vector<value_t*> *garbage) {
-  switch (term->kind) {
-    case term_k::value:
-      return term->value;
+// goes on with what k waits for now that *value is there, from the bottom of
+// the native stack
+static step_k resume(walker_t *w, continuation_t *k, object_t *value) {
+  const term_t *result;
+  switch (k->kind) {
+    case continuation_k::force:
+      *k->slot = *value;
+      if (value->kind != type_k::number)
+        ++w->escapes;
+      return step_k::value;
+    case continuation_k::case_value:
+      if (!match_case(w, k->term, k->env, &k->activation, case_value(*value)
+            , 0, 0, &result))
+        return step_k::suspended;
       break;
-    case term_k::identifier: {
-      // identifier can be in scope
-      value_t *value;
-      if (term->lookup(*term->identifier.name, value))
-        return value;
-      // or be a top-level definition
-      const term_t *definition = nullptr;
-      for (const term_t *const tl_term : *program->program.terms) {
-        if (tl_term->kind != term_k::definition)
-          continue;
-        if (*tl_term->definition.name != *term->identifier.name)
-          continue;
-        definition = tl_term;
-      }
-      if (definition != nullptr)
-        return evaluate_term(definition->definition.body, program, garbage);
-      die("unknown identifier \"%s\"", term->identifier.name->c_str());
-    }
-    case term_k::case_of: {
-      value_t *value = evaluate_term(term->case_of.value, program, garbage);
-      if (value->type.kind != type_k::number)
-        die("anything but numbers are not supported in case statements yet");
-      term_t *result = nullptr;
-      for (const term_t::case_statement &statement : *term->case_of.statements)
-        if (statement.value == nullptr) {
-          result = statement.result;
-          break;
-        } else {
-          value_t *statement_value = evaluate_term(statement.value, program
-              , garbage);
-          if (statement_value->type.kind != type_k::number)
-            die("anything but numbers are not supported in case statements yet");
-          if (std::llround(value->number) == std::llround(statement_value->number)) {
-            result = statement.result;
-            break;
-          }
-        }
-      if (result == nullptr)
-        die("no matching clause in case statement");
-      return evaluate_term(result, program, garbage);
+    case continuation_k::case_statement:
+      if (k->case_of.value == case_value(*value))
+        result = k->term->case_of.statements->at(k->case_of.statement).result;
+      else if (!match_case(w, k->term, k->env, &k->activation
+            , k->case_of.value, k->case_of.statement + 1, 0, &result))
+        return step_k::suspended;
       break;
-    }
-    case term_k::if_else: {
-      value_t *condition = evaluate_term(term->if_else.condition, program, garbage);
-      if (condition->type.kind != type_k::number)
-        die("anything but numbers are not supported in if statements yet");
-      if ((int64_t)condition->number == 0)
-        return evaluate_term(term->if_else.else_expr, program, garbage);
-      else
-        return evaluate_term(term->if_else.then_expr, program, garbage);
+    case continuation_k::if_condition:
+      result = if_branch(k->term, *value);
       break;
-    }
-    case term_k::let_in: {
-      if (!term->scope)
-        term->scope = new scope_t;
-      for (const term_t *definition : *term->let_in.definitions) {
-        std::string name = *definition->definition.name;
-        term_t *body = definition->definition.body;
-        (*term->scope)[name] = evaluate_term(body, program, garbage);
+    case continuation_k::unary_op:
+      *value = unary_op(k->term, *value);
+      return step_k::value;
+    case continuation_k::binary_op_x: {
+      const object_t x = *value;
+      if (!evaluate(w, k->term->binary_op.y, k->env, nullptr, 1, value)) {
+        push_continuation(w, continuation_k::binary_op_y, k->term, k->env
+            , &k->activation)->x = x;
+        return step_k::suspended;
       }
-      return evaluate_term(term->let_in.body, program, garbage);
-      break;
+      *value = binary_op(k->term, x, *value);
+      return step_k::value;
     }
-    case term_k::application:
-      return evaluate_application(term, program, garbage);
+    case continuation_k::binary_op_y:
+      *value = binary_op(k->term, k->x, *value);
+      return step_k::value;
+    case continuation_k::argument:
+      w->values.push_back(*value);
+      ++k->apply.num_args;
+      return continue_application(w, k, 0, value);
+    case continuation_k::apply:
+      return continue_application(w, k, 0, value);
     default:
-      die("unexpected term kind <%s>", term_kind_to_string(term->kind).c_str());
+      die("unexpected continuation kind");
   }
+  w->term = result;
+  w->env = k->env;
+  w->activation = k->activation;
+  return step_k::term;
 }
 
-static void clear_scopes_rec(term_t *term) {
-  switch (term->kind) {
-    case term_k::program:
-      for (term_t *tl_term : *term->program.terms)
-        clear_scopes_rec(tl_term);
-      break;
-    case term_k::definition:
-      clear_scopes_rec(term->definition.body);
-      break;
-    case term_k::application:
-      clear_scopes_rec(term->application.lambda);
-      clear_scopes_rec(term->application.parameter);
-      break;
-    case term_k::case_of:
-      clear_scopes_rec(term->case_of.value);
-      for (const term_t::case_statement &statement : *term->case_of.statements) {
-        if (statement.value)
-          clear_scopes_rec(statement.value);
-        clear_scopes_rec(statement.result);
-      }
-      break;
-    case term_k::if_else:
-      clear_scopes_rec(term->if_else.condition);
-      clear_scopes_rec(term->if_else.then_expr);
-      clear_scopes_rec(term->if_else.else_expr);
-      break;
-    case term_k::let_in:
-      for (term_t *definition : *term->let_in.definitions)
-        clear_scopes_rec(definition);
-      clear_scopes_rec(term->let_in.body);
-      break;
-    case term_k::value:
-      switch (term->value->type.kind) {
-        case type_k::lambda:
-          clear_scopes_rec(term->value->lambda.body);
-          break;
-        default:
-          break;
-      }
-      break;
-    default:
-      break;
+static object_t evaluate_term(const term_t *const term, frame_t *env
+    , walker_t *w) {
+  const size_t base = w->continuations.size();
+  w->term = term;
+  w->env = env;
+  w->activation = no_activation;
+  w->escapes = 0;
+  object_t value;
+  step_k step = step_k::term;
+  while (true) {
+    size_t segment = w->continuations.size();
+    if (step != step_k::value) {
+      const activation_t activation = w->activation;
+      step = evaluate(w, w->term, w->env, &activation, 0, &value)
+        ? step_k::value : step_k::suspended;
+    } else if (segment == base)
+      return value;
+    else {
+      continuation_t k = w->continuations.back();
+      w->continuations.pop_back();
+      --segment;
+      step = resume(w, &k, &value);
+    }
+    // levels of native stack pushed their continuations as they returned
+    if (step == step_k::suspended)
+      std::reverse(w->continuations.begin() + segment
+          , w->continuations.end());
   }
-  if (term->scope != nullptr) {
-    delete term->scope;
-    term->scope = nullptr;
+}
+
+std::string evaluation_tier_kind_to_string(evaluation_tier_k kind) {
+  switch (kind) {
+    case evaluation_tier_k::tree:     return "tree";
+    case evaluation_tier_k::bytecode: return "bytecode";
+    case evaluation_tier_k::native:   return "native";
+    case evaluation_tier_k::aot:      return "aot";
+    default:                          return "unhandled";
   }
 }
 
-double evaluate_definition(term_t *program, const std::string &name, double f
-    , double t) {
-  program->scope = new scope_t {
-    { "pi", value_number(M_PI) }
-  };
+evaluator_t::evaluator_t(const term_t *program, const std::string &name
+    , evaluation_tier_k max_tier, const aot_module_t *module
+    , const compile_options_t &options)
+  : _program(program)
+  , _main(nullptr)
+  , _tier(evaluation_tier_k::tree)
+  , _fallback_reason("")
+  , _jit(nullptr)
+  , _kernel(nullptr) {
+  if (max_tier == evaluation_tier_k::aot && module != nullptr) {
+    _kernel = module->find(name);
+    if (_kernel != nullptr) {
+      _tier = evaluation_tier_k::aot;
+      return;
+    }
+    _fallback_reason = "definition is not in the compiled object";
+  }
+  if (max_tier == evaluation_tier_k::tree
+      || !compile_definition(_program, name, options, &_bytecode
+        , &_fallback_reason)) {
+    _prepare_tree(name);
+    return;
+  }
+  _tier = evaluation_tier_k::bytecode;
+  if (max_tier == evaluation_tier_k::bytecode)
+    return;
+  _jit = new jit_t(&_bytecode);
+  if (_jit->compile(&_fallback_reason))
+    _tier = evaluation_tier_k::native;
+  else {
+    delete _jit;
+    _jit = nullptr;
+  }
+}
 
-  term_t *def = nullptr;
-  for (term_t *const term : *program->program.terms) {
+void evaluator_t::_prepare_tree(const std::string &name) {
+  const term_t *def = nullptr;
+  for (const term_t *const term : *_program->program.terms) {
     if (term->kind != term_k::definition)
       continue;
     if (*term->definition.name != name)
@@ -344,47 +663,166 @@ double evaluate_definition(term_t *program, const std::string &name, double f
   if (def == nullptr)
     die("no definition \"%s\" found", name.c_str());
 
-  def->scope = new scope_t;
-
-  term_t *main_lam = def->definition.body;
+  const term_t *main_lam = def->definition.body;
   assertf(main_lam->kind == term_k::value);
   assertf(main_lam->value->type.kind == type_k::lambda);
-  value_t *lam_freq = main_lam->value;
-  std::map<std::string, value_t*> main_parameter_value_freq;
-  (*def->scope)[*lam_freq->lambda.arg] = value_number(f);
+  const value_t *lam_freq = main_lam->value;
+  assertf(lam_freq->lambda.arity >= 2);
 
-  term_t *lam_time_term = lam_freq->lambda.body;
+  const term_t *lam_time_term = lam_freq->lambda.body;
   assertf(lam_time_term->kind == term_k::value);
   assertf(lam_time_term->value->type.kind == type_k::lambda);
-  value_t *lam_time = lam_time_term->value;
-  std::map<std::string, value_t*> main_parameter_value_time;
-  (*def->scope)[*lam_time->lambda.arg] = value_number(t);
 
-  term_t *main_body = lam_time->lambda.body;
+  _main = main_lam->value;
+}
 
-  std::vector<value_t*> garbage;
-  for (const auto &program_scope_pair : *program->scope)
-    garbage.push_back(program_scope_pair.second);
-  for (const auto &main_scope_pair : *def->scope)
-    garbage.push_back(main_scope_pair.second);
+evaluator_t::~evaluator_t() {
+  if (_jit != nullptr)
+    delete _jit;
+}
 
-  value_t *program_result = evaluate_term(main_body, program, &garbage);
+evaluation_tier_k evaluator_t::tier() const {
+  return _tier;
+}
 
-  if (program_result->type.kind != type_k::number)
-    die("program returned value of type <%s>, expected <number>"
-        , type_to_string(&program_result->type).c_str());
-  double result = program_result->number;
+const std::string& evaluator_t::fallback_reason() const {
+  return _fallback_reason;
+}
+
+bool evaluator_t::uses_f() const {
+  switch (_tier) {
+    case evaluation_tier_k::aot:
+      return _kernel->uses_f;
+    case evaluation_tier_k::tree:
+      return true;
+    default:
+      return _bytecode.uses_f;
+  }
+}
+
+bool evaluator_t::phase_only() const {
+  switch (_tier) {
+    case evaluation_tier_k::aot:
+      return _kernel->phase_only;
+    case evaluation_tier_k::tree:
+      return false;
+    default:
+      return _bytecode.phase_only;
+  }
+}
+
+bool evaluator_t::separable() const {
+  switch (_tier) {
+    case evaluation_tier_k::aot:
+      return _kernel->separable;
+    case evaluation_tier_k::tree:
+      return false;
+    default:
+      return _bytecode.separable;
+  }
+}
+
+evaluation_context_t::evaluation_context_t(const evaluator_t *evaluator)
+  : _evaluator(evaluator)
+  , _arena(tree_arena_chunk_size)
+  , _walker(new walker_t(&_arena))
+  , _vm(nullptr)
+  , _jit_registers()
+  , _jit_lanes()
+  , _jit_control_points() {
+  switch (_evaluator->_tier) {
+    case evaluation_tier_k::bytecode:
+      _vm = new vm_t(&_evaluator->_bytecode);
+      break;
+    case evaluation_tier_k::native:
+      _jit_registers = _evaluator->_bytecode.registers();
+      _jit_lanes = _evaluator->_jit->lanes();
+      break;
+    default:
+      break;
+  }
+}
+
+evaluation_context_t::~evaluation_context_t() {
+  delete _walker;
+  if (_vm != nullptr)
+    delete _vm;
+}
+
+double evaluation_context_t::eval(double f, double t) {
+  switch (_evaluator->_tier) {
+    case evaluation_tier_k::aot:
+      return _evaluator->_kernel->eval(f, t);
+    case evaluation_tier_k::native:
+      return _evaluator->_jit->run(_jit_registers.data(), f, t);
+    case evaluation_tier_k::bytecode:
+      return _vm->run(f, t);
+    default:
+      break;
+  }
 
-  for (const value_t *const value : garbage)
-    delete value;
+  // f and t are the first two arguments of the definition's frame. if it takes
+  // more, the result is a partial application, which is reported below
+  value_t *definition = _evaluator->_main;
+  frame_t *frame = new_frame(nullptr, definition->lambda.arity, &_arena);
+  frame->slots[0] = object_number(f);
+  frame->slots[1] = object_number(t);
 
-  delete def->scope;
-  def->scope = nullptr;
-  delete program->scope;
-  program->scope = nullptr;
+  object_t program_result = definition->lambda.arity == 2
+    ? evaluate_term(definition->lambda.inner_body, frame, _walker)
+    : object_partial(definition, frame, 2, &_arena);
 
-  clear_scopes_rec(program);
+  if (program_result.kind != type_k::number)
+    die("program returned value of type <%s>, expected <number>"
+        , object_type_to_string(program_result).c_str());
+  double result = program_result.number;
+
+  _arena.reset();
 
   return result;
 }
 
+void evaluation_context_t::eval_block(double f, uint64_t start
+    , double sample_rate, float *out, size_t n) {
+  switch (_evaluator->_tier) {
+    case evaluation_tier_k::aot:
+      _evaluator->_kernel->eval_block(f, start, sample_rate, out, n);
+      break;
+    case evaluation_tier_k::native:
+      _evaluator->_jit->run_block(_jit_registers.data(), _jit_lanes.data()
+          , &_jit_control_points, f, start, sample_rate, out, n);
+      break;
+    case evaluation_tier_k::bytecode:
+      _vm->run_block(f, start, sample_rate, out, n);
+      break;
+    default:
+      for (size_t i = 0; i < n; ++i)
+        out[i] = eval(f, (double)(start + i) / sample_rate);
+      break;
+  }
+}
+
+void evaluation_context_t::eval_notes(const double *f, size_t num_notes
+    , uint64_t start, double sample_rate, float *const *out, size_t n) {
+  switch (_evaluator->_tier) {
+    case evaluation_tier_k::aot:
+      _evaluator->_kernel->eval_notes(f, num_notes, start, sample_rate, out
+          , n);
+      break;
+    case evaluation_tier_k::native:
+      _evaluator->_jit->run_notes(_jit_registers.data(), _jit_lanes.data()
+          , &_jit_control_points, f, num_notes, start, sample_rate, out, n);
+      break;
+    case evaluation_tier_k::bytecode:
+      _vm->run_notes(f, num_notes, start, sample_rate, out, n);
+      break;
+    default:
+      for (size_t j = 0; j < num_notes; ++j)
+        eval_block(f[j], start, sample_rate, out[j], n);
+      break;
+  }
+}
+
+size_t evaluation_context_t::tree_memory_peak() const {
+  return _arena.peak();
+}
@@ -1,7 +1,86 @@
 #pragma once
 
+#include "aot.hh"
+#include "arena.hh"
 #include "lang.hh"
+#include "jit.hh"
+#include "vm.hh"
+#include <cstdint>
 
-double evaluate_definition(term_t *program, const std::string &name, double f
-    , double t);
+enum class evaluation_tier_k {
+  tree,     // walks term_t directly, supports everything
+  bytecode, // see compile.hh
+  native,   // bytecode translated to machine code, see jit.hh
+  aot       // kernel loaded from a precompiled shared object, see aot.hh
+};
 
+std::string evaluation_tier_kind_to_string(evaluation_tier_k kind);
+
+// prepares one top-level definition of form "name f t = ..." for repeated
+// evaluation. lookup of the definition and validation of its shape are done
+// once in the constructor. if module contains the definition, its kernel is
+// used. otherwise the definition is compiled to bytecode and then to native
+// code as far as max_tier allows it, falling back to the previous tier if a
+// step fails. options are those of compile_definition, and module should be
+// built with the same ones. evaluator is immutable after construction,
+// evaluation itself is done through evaluation_context_t. program and module
+// must outlive it
+class evaluator_t {
+  const term_t *_program;
+  value_t *_main; // lambda of the definition, for the tree walker
+  evaluation_tier_k _tier;
+  std::string _fallback_reason;
+  bytecode_t _bytecode;
+  jit_t *_jit;
+  const aot_kernel_t *_kernel;
+
+  void _prepare_tree(const std::string &name);
+  friend class evaluation_context_t;
+public:
+  evaluator_t(const term_t *program, const std::string &name
+      , evaluation_tier_k max_tier = evaluation_tier_k::aot
+      , const aot_module_t *module = nullptr
+      , const compile_options_t &options = compile_options_t());
+  ~evaluator_t();
+  evaluation_tier_k tier() const;
+  // why a higher tier than the one used couldn't be used, empty if it could
+  const std::string& fallback_reason() const;
+  // false if the definition doesn't depend on f, so that all notes sound the
+  // same. the tree walker can't tell, so it's true on tree tier
+  bool uses_f() const;
+  // true if the definition depends on f and t only through f * t, see
+  // bytecode_t::phase_only. false on tree tier
+  bool phase_only() const;
+  // see bytecode_t::separable. false on tree tier
+  bool separable() const;
+};
+
+struct walker_t;
+
+// mutable state for evaluating with an evaluator: tree walker's arena and
+// stacks and registers of bytecode. each thread needs a context of its own,
+// while any number of contexts may share one evaluator. evaluator must
+// outlive context
+class evaluation_context_t {
+  const evaluator_t *_evaluator;
+  arena_t _arena; // allocated from by tree walker during eval()
+  walker_t *_walker;
+  vm_t *_vm; // null unless evaluator is on bytecode tier
+  std::vector<double> _jit_registers;
+  std::vector<double> _jit_lanes;
+  std::vector<double> _jit_control_points;
+public:
+  evaluation_context_t(const evaluator_t *evaluator);
+  ~evaluation_context_t();
+  double eval(double f, double t);
+  // fills out[0..n) with samples at times (start + i) / sample_rate
+  void eval_block(double f, uint64_t start, double sample_rate, float *out
+      , size_t n);
+  // like eval_block() for notes of frequencies f[0..num_notes), into
+  // out[j][0..n). values that depend on t alone are computed once for all
+  // notes, except on tree tier
+  void eval_notes(const double *f, size_t num_notes, uint64_t start
+      , double sample_rate, float *const *out, size_t n);
+  // most bytes tree walker had allocated during one eval(), 0 for other tiers
+  size_t tree_memory_peak() const;
+};
@@ -0,0 +1,445 @@
+#include "infer.hh"
+#include "utils.hh"
+#include <set>
+
+enum class itype_k {
+  variable,
+  number,
+  function
+};
+
+// type during inference, referred to by index. unification binds variables
+// to other types, so that they form a union-find forest
+struct itype_t {
+  itype_k kind;
+  uint32_t binding; // of a variable, itself while unbound
+  uint32_t takes, returns; // of a function
+};
+
+// type of a binding, whose generalized variables are replaced by fresh ones
+// at every use
+struct scheme_t {
+  uint32_t type;
+  std::vector<uint32_t> generalized;
+};
+
+// types of arguments of lambdas and of let bindings, in frames as assigned by
+// resolve_identifiers(), innermost last
+typedef std::vector<std::vector<scheme_t>> infer_frames_t;
+
+enum class infer_state_k {
+  visiting,
+  typed,
+  ill_typed
+};
+
+struct infer_definition_t {
+  infer_state_k state;
+  scheme_t scheme;
+  std::set<const term_t*> references; // top-level definitions it uses
+  std::vector<term_t*> operators;
+  std::vector<std::pair<value_t*, uint32_t>> lambdas; // and their types
+};
+
+struct inferrer_t {
+  std::vector<itype_t> types;
+  std::map<const term_t*, infer_definition_t> definitions;
+  // definitions being inferred, which refer to each other monomorphically
+  std::vector<const term_t*> visiting;
+  std::vector<message_t> *messages;
+  std::string error; // of last unification or lookup that failed
+};
+
+static uint32_t new_type(inferrer_t *in, itype_k kind, uint32_t takes = 0
+    , uint32_t returns = 0) {
+  const uint32_t type = in->types.size();
+  in->types.push_back({ kind, type, takes, returns });
+  return type;
+}
+
+static uint32_t new_variable(inferrer_t *in) {
+  return new_type(in, itype_k::variable);
+}
+
+static uint32_t new_function(inferrer_t *in, uint32_t takes
+    , uint32_t returns) {
+  return new_type(in, itype_k::function, takes, returns);
+}
+
+// representative of type, which is an unbound variable or not a variable
+static uint32_t find(inferrer_t *in, uint32_t type) {
+  while (in->types[type].kind == itype_k::variable
+      && in->types[type].binding != type)
+    type = in->types[type].binding;
+  return type;
+}
+
+// type as written in the program, with variables numbered in order of
+// appearance in names
+static type_t* to_type(inferrer_t *in, uint32_t type
+    , std::map<uint32_t, uint32_t> *names) {
+  type = find(in, type);
+  type_t *result = new type_t;
+  switch (in->types[type].kind) {
+    case itype_k::number:
+      result->kind = type_k::number;
+      break;
+    case itype_k::function:
+      result->kind = type_k::lambda;
+      result->lambda.takes = to_type(in, in->types[type].takes, names);
+      result->lambda.returns = to_type(in, in->types[type].returns, names);
+      break;
+    default: {
+      result->kind = type_k::variable;
+      auto name_it = names->find(type);
+      if (name_it == names->end())
+        name_it = names->insert({ type, names->size() }).first;
+      result->variable = name_it->second;
+      break;
+    }
+  }
+  return result;
+}
+
+static bool occurs(inferrer_t *in, uint32_t variable, uint32_t type) {
+  type = find(in, type);
+  if (type == variable)
+    return true;
+  if (in->types[type].kind != itype_k::function)
+    return false;
+  return occurs(in, variable, in->types[type].takes)
+    || occurs(in, variable, in->types[type].returns);
+}
+
+static bool unify(inferrer_t *in, uint32_t a, uint32_t b) {
+  a = find(in, a);
+  b = find(in, b);
+  if (a == b)
+    return true;
+  if (in->types[b].kind == itype_k::variable)
+    std::swap(a, b);
+  if (in->types[a].kind == itype_k::variable) {
+    if (!occurs(in, a, b)) {
+      in->types[a].binding = b;
+      return true;
+    }
+  } else if (in->types[a].kind == in->types[b].kind) {
+    if (in->types[a].kind == itype_k::number)
+      return true;
+    return unify(in, in->types[a].takes, in->types[b].takes)
+      && unify(in, in->types[a].returns, in->types[b].returns);
+  }
+  std::map<uint32_t, uint32_t> names;
+  type_t *type_a = to_type(in, a, &names), *type_b = to_type(in, b, &names);
+  in->error = "can't match <" + type_to_string(type_a) + "> with <"
+    + type_to_string(type_b) + ">";
+  delete type_a;
+  delete type_b;
+  return false;
+}
+
+static void free_variables(inferrer_t *in, uint32_t type
+    , std::set<uint32_t> *variables) {
+  type = find(in, type);
+  if (in->types[type].kind == itype_k::variable)
+    variables->insert(type);
+  else if (in->types[type].kind == itype_k::function) {
+    free_variables(in, in->types[type].takes, variables);
+    free_variables(in, in->types[type].returns, variables);
+  }
+}
+
+static void free_variables(inferrer_t *in, const scheme_t &scheme
+    , std::set<uint32_t> *variables) {
+  std::set<uint32_t> in_scheme;
+  free_variables(in, scheme.type, &in_scheme);
+  for (uint32_t generalized : scheme.generalized)
+    in_scheme.erase(find(in, generalized));
+  variables->insert(in_scheme.begin(), in_scheme.end());
+}
+
+// generalizes variables of type that nothing in scope refers to
+static scheme_t generalize(inferrer_t *in, uint32_t type
+    , const infer_frames_t &frames) {
+  std::set<uint32_t> in_scope, in_type;
+  for (const std::vector<scheme_t> &frame : frames)
+    for (const scheme_t &scheme : frame)
+      free_variables(in, scheme, &in_scope);
+  for (const term_t *const definition : in->visiting)
+    free_variables(in, in->definitions.at(definition).scheme.type, &in_scope);
+  free_variables(in, type, &in_type);
+  scheme_t scheme { type, {} };
+  for (uint32_t variable : in_type)
+    if (in_scope.find(variable) == in_scope.end())
+      scheme.generalized.push_back(variable);
+  return scheme;
+}
+
+static uint32_t instantiate(inferrer_t *in, uint32_t type
+    , std::map<uint32_t, uint32_t> *fresh) {
+  type = find(in, type);
+  auto fresh_it = fresh->find(type);
+  if (fresh_it != fresh->end())
+    return fresh_it->second;
+  if (in->types[type].kind != itype_k::function)
+    return type;
+  const uint32_t takes = instantiate(in, in->types[type].takes, fresh)
+    , returns = instantiate(in, in->types[type].returns, fresh);
+  return new_function(in, takes, returns);
+}
+
+static uint32_t instantiate(inferrer_t *in, const scheme_t &scheme) {
+  if (scheme.generalized.empty())
+    return scheme.type;
+  std::map<uint32_t, uint32_t> fresh;
+  for (uint32_t variable : scheme.generalized)
+    fresh[find(in, variable)] = new_variable(in);
+  return instantiate(in, scheme.type, &fresh);
+}
+
+static void infer_definition(inferrer_t *in, const term_t *definition);
+
+static bool infer_term(inferrer_t *in, term_t *term, infer_frames_t *frames
+    , infer_definition_t *info, uint32_t *type);
+
+static bool infer_number(inferrer_t *in, term_t *term, infer_frames_t *frames
+    , infer_definition_t *info) {
+  uint32_t type;
+  return infer_term(in, term, frames, info, &type)
+    && unify(in, type, new_type(in, itype_k::number));
+}
+
+static bool infer_identifier(inferrer_t *in, const term_t *term
+    , const infer_frames_t &frames, infer_definition_t *info
+    , uint32_t *type) {
+  switch (term->identifier.resolution) {
+    case resolution_k::local:
+      *type = instantiate(in, frames.at(frames.size() - 1
+            - term->identifier.local.depth).at(term->identifier.local.slot));
+      return true;
+    case resolution_k::definition: {
+      const term_t *definition = term->identifier.definition;
+      infer_definition(in, definition);
+      info->references.insert(definition);
+      const infer_definition_t &used = in->definitions.at(definition);
+      // recursive references share the type being inferred
+      *type = used.state == infer_state_k::visiting ? used.scheme.type
+        : instantiate(in, used.scheme);
+      return true;
+    }
+    case resolution_k::constant:
+      *type = new_type(in, itype_k::number);
+      return true;
+    default:
+      in->error = "unknown identifier \"" + *term->identifier.name + "\"";
+      return false;
+  }
+}
+
+static bool infer_term(inferrer_t *in, term_t *term, infer_frames_t *frames
+    , infer_definition_t *info, uint32_t *type) {
+  switch (term->kind) {
+    case term_k::value:
+      switch (term->value->type.kind) {
+        case type_k::number:
+          *type = new_type(in, itype_k::number);
+          return true;
+        case type_k::builtin: {
+          const uint32_t number = new_type(in, itype_k::number);
+          *type = new_function(in, number, number);
+          if (builtin_is_binary(term->value->builtin->kind))
+            *type = new_function(in, number, *type);
+          return true;
+        }
+        case type_k::lambda: {
+          // arguments of directly nested lambdas share one frame
+          std::vector<value_t*> lambdas;
+          frames->push_back({});
+          for (value_t *lambda = term->value
+              ; lambdas.size() < term->value->lambda.arity
+              ; lambda = lambda->lambda.body->value) {
+            lambdas.push_back(lambda);
+            frames->back().push_back({ new_variable(in), {} });
+          }
+          bool ok = infer_term(in, term->value->lambda.inner_body, frames, info
+              , type);
+          for (size_t i = lambdas.size(); ok && i-- > 0; ) {
+            *type = new_function(in, frames->back()[i].type, *type);
+            info->lambdas.push_back({ lambdas[i], *type });
+          }
+          frames->pop_back();
+          return ok;
+        }
+        default:
+          die("unexpected value type <%s>"
+              , type_to_string(&term->value->type).c_str());
+      }
+    case term_k::identifier:
+      return infer_identifier(in, term, *frames, info, type);
+    case term_k::application: {
+      uint32_t lambda, parameter;
+      if (!infer_term(in, term->application.lambda, frames, info, &lambda)
+          || !infer_term(in, term->application.parameter, frames, info
+            , &parameter))
+        return false;
+      *type = new_variable(in);
+      return unify(in, lambda, new_function(in, parameter, *type));
+    }
+    case term_k::case_of: {
+      if (!infer_number(in, term->case_of.value, frames, info))
+        return false;
+      *type = new_variable(in);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        uint32_t result;
+        if ((statement.value != nullptr
+              && !infer_number(in, statement.value, frames, info))
+            || !infer_term(in, statement.result, frames, info, &result)
+            || !unify(in, *type, result))
+          return false;
+      }
+      return true;
+    }
+    case term_k::if_else: {
+      uint32_t then_type, else_type;
+      if (!infer_number(in, term->if_else.condition, frames, info)
+          || !infer_term(in, term->if_else.then_expr, frames, info, &then_type)
+          || !infer_term(in, term->if_else.else_expr, frames, info, &else_type)
+          || !unify(in, then_type, else_type))
+        return false;
+      *type = then_type;
+      return true;
+    }
+    case term_k::let_in: {
+      // bindings that refer to each other are inferred together and see
+      // each other monomorphically, like recursive top-level definitions.
+      // groups before them are already generalized
+      const std::vector<term_t*> &definitions = *term->let_in.definitions;
+      frames->push_back({});
+      for (size_t i = 0; i < definitions.size(); ++i)
+        frames->back().push_back({ new_variable(in), {} });
+      bool ok = true;
+      for (const std::vector<size_t> &group : let_binding_groups(term)) {
+        for (size_t i : group) {
+          uint32_t binding;
+          ok = ok && infer_term(in, definitions[i]->definition.body, frames
+              , info, &binding)
+            && unify(in, frames->back()[i].type, binding);
+        }
+        if (!ok)
+          break;
+        // groups only refer to ones before them, which are generalized, so
+        // only frames out of the let keep variables from being generalized
+        const infer_frames_t outer(frames->begin(), frames->end() - 1);
+        for (size_t i : group)
+          frames->back()[i] = generalize(in, frames->back()[i].type, outer);
+      }
+      ok = ok && infer_term(in, term->let_in.body, frames, info, type);
+      frames->pop_back();
+      return ok;
+    }
+    case term_k::unary_op:
+      info->operators.push_back(term);
+      *type = new_type(in, itype_k::number);
+      return infer_number(in, term->unary_op.x, frames, info);
+    case term_k::binary_op:
+      info->operators.push_back(term);
+      *type = new_type(in, itype_k::number);
+      return infer_number(in, term->binary_op.x, frames, info)
+        && infer_number(in, term->binary_op.y, frames, info);
+    default:
+      die("unexpected term kind <%s>", term_kind_to_string(term->kind).c_str());
+  }
+}
+
+static void infer_definition(inferrer_t *in, const term_t *definition) {
+  if (in->definitions.find(definition) != in->definitions.end())
+    return;
+  infer_definition_t &info = in->definitions[definition];
+  info.state = infer_state_k::visiting;
+  info.scheme = { new_variable(in), {} };
+  in->visiting.push_back(definition);
+  infer_frames_t frames;
+  uint32_t type;
+  in->error.clear();
+  bool ok = infer_term(in, definition->definition.body, &frames, &info, &type)
+    && unify(in, info.scheme.type, type);
+  // definitions that can be played are called with numbers f and t and have
+  // to give a number, which the tiers rely on once operators are typed
+  if (ok && is_evaluatable_definition(definition)) {
+    const uint32_t number = new_type(in, itype_k::number)
+      , instrument = new_function(in, number, new_function(in, number
+            , number));
+    ok = unify(in, info.scheme.type, instrument);
+    if (!ok)
+      in->error = "evaluated with numbers f and t to a number, but " + in->error;
+  }
+  in->visiting.pop_back();
+  if (!ok) {
+    in->messages->push_back({ message_k::error, "definition \""
+        + *definition->definition.name + "\": " + in->error });
+    // uses of it are inferred as if it could be anything
+    const uint32_t anything = new_variable(in);
+    info.state = infer_state_k::ill_typed;
+    info.scheme = { anything, { anything } };
+    return;
+  }
+  info.state = infer_state_k::typed;
+  info.scheme = generalize(in, info.scheme.type, frames);
+}
+
+void infer_types(term_t *program, std::vector<message_t> *messages) {
+  inferrer_t in;
+  in.messages = messages;
+  for (const term_t *const term : *program->program.terms)
+    if (term->kind == term_k::definition)
+      infer_definition(&in, term);
+
+  // what uses an ill-typed definition may get anything from it, and what is
+  // used by either may be passed anything, so their operators stay checked
+  std::set<const term_t*> tainted, untrusted;
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (const auto &definition : in.definitions) {
+      if (tainted.count(definition.first))
+        continue;
+      bool uses_tainted = definition.second.state == infer_state_k::ill_typed;
+      for (const term_t *const used : definition.second.references)
+        uses_tainted = uses_tainted || tainted.count(used);
+      if (uses_tainted) {
+        tainted.insert(definition.first);
+        changed = true;
+      }
+    }
+  }
+  std::vector<const term_t*> untrusted_stack(tainted.begin(), tainted.end());
+  while (!untrusted_stack.empty()) {
+    const term_t *definition = untrusted_stack.back();
+    untrusted_stack.pop_back();
+    if (!untrusted.insert(definition).second)
+      continue;
+    for (const term_t *const used : in.definitions.at(definition).references)
+      untrusted_stack.push_back(used);
+  }
+
+  for (const auto &definition : in.definitions) {
+    const infer_definition_t &info = definition.second;
+    if (info.state != infer_state_k::typed)
+      continue;
+    std::map<uint32_t, uint32_t> names;
+    for (const std::pair<value_t*, uint32_t> &lambda : info.lambdas) {
+      type_t *type = to_type(&in, lambda.second, &names);
+      delete lambda.first->type.lambda.takes;
+      delete lambda.first->type.lambda.returns;
+      lambda.first->type.lambda = type->lambda;
+      type->kind = type_k::number; // its parts now belong to the lambda
+      delete type;
+    }
+    if (untrusted.count(definition.first))
+      continue;
+    for (term_t *const term : info.operators)
+      if (term->kind == term_k::unary_op)
+        term->unary_op.typed = true;
+      else
+        term->binary_op.typed = true;
+  }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "lang.hh"
+
+// infers Hindley-Milner types of top-level definitions of a resolved program.
+// top-level definitions and let bindings are polymorphic, and builtins take
+// and return numbers. every definition that doesn't type check is reported
+// once as an error. lambdas of those that do get their types filled in, and
+// their operators are marked typed unless definitions that don't type check
+// can pass them something or get something from them
+void infer_types(term_t *program, std::vector<message_t> *messages);
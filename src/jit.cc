@@ -0,0 +1,761 @@
+#include "jit.hh"
+#include "utils.hh"
+#include "vmath.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sys/mman.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+
+const uint32_t no_register = UINT32_MAX;
+
+// emits machine code into a buffer. registers of bytecode are kept in memory
+// at [rbx + 8 * r], xmm0 and xmm1 are used as scratch. in code run on lanes,
+// lanes of r are at [rbx + 8 * jit_block_size * r], rcx is the offset of the
+// pair of lanes being computed and r13 the number of bytes of lanes to compute
+struct assembler_t {
+  std::vector<uint8_t> code;
+  // bytecode register whose value xmm0 currently holds, to skip reloading it
+  uint32_t xmm0_register = no_register;
+
+  void bytes(std::initializer_list<uint8_t> list) {
+    code.insert(code.end(), list);
+  }
+  void imm32(uint32_t value) {
+    for (int i = 0; i < 4; ++i)
+      code.push_back((value >> (i * 8)) & 0xff);
+  }
+  void imm64(uint64_t value) {
+    for (int i = 0; i < 8; ++i)
+      code.push_back((value >> (i * 8)) & 0xff);
+  }
+  // [rbx + disp32] with xmm register xmm, or general purpose register of that
+  // number, in reg field of ModRM
+  void register_operand(int xmm, uint32_t reg) {
+    code.push_back(0x80 | (xmm << 3) | 3);
+    imm32(reg * sizeof(double));
+  }
+  // movsd xmm, [rbx + 8 * reg]
+  void load(int xmm, uint32_t reg) {
+    if (xmm == 0) {
+      if (xmm0_register == reg)
+        return;
+      xmm0_register = reg;
+    }
+    bytes({ 0xf2, 0x0f, 0x10 });
+    register_operand(xmm, reg);
+  }
+  // movsd [rbx + 8 * reg], xmm0
+  void store(uint32_t reg) {
+    bytes({ 0xf2, 0x0f, 0x11 });
+    register_operand(0, reg);
+    xmm0_register = reg;
+  }
+  // addsd/subsd/... xmm0, [rbx + 8 * reg]
+  void arithmetic(uint8_t opcode, uint32_t reg) {
+    bytes({ 0xf2, 0x0f, opcode });
+    register_operand(0, reg);
+    xmm0_register = no_register;
+  }
+  // roundsd xmm0, [rbx + 8 * reg], mode
+  void round(uint32_t reg, uint8_t mode) {
+    bytes({ 0x66, 0x0f, 0x3a, 0x0b });
+    register_operand(0, reg);
+    code.push_back(mode);
+    xmm0_register = no_register;
+  }
+  // mov rax, function; call rax
+  void call(const void *function) {
+    uint64_t address;
+    memcpy(&address, &function, sizeof(address));
+    bytes({ 0x48, 0xb8 });
+    imm64(address);
+    bytes({ 0xff, 0xd0 });
+    xmm0_register = no_register;
+  }
+  // movzx eax, al; cvtsi2sd xmm0, eax
+  void flag_to_number() {
+    bytes({ 0x0f, 0xb6, 0xc0 });
+    bytes({ 0xf2, 0x0f, 0x2a, 0xc0 });
+    xmm0_register = no_register;
+  }
+  // cmp rax, imm32 if value fits, mov rcx, imm64; cmp rax, rcx otherwise
+  void compare_rax(int64_t value) {
+    if (value == (int32_t)value) {
+      bytes({ 0x48, 0x3d });
+      imm32((uint32_t)value);
+    } else {
+      bytes({ 0x48, 0xb9 });
+      imm64((uint64_t)value);
+      bytes({ 0x48, 0x39, 0xc8 });
+    }
+  }
+  // [rbx + rcx + disp32] of lanes of reg with xmm register xmm in reg field of
+  // ModRM
+  void lane_operand(int xmm, uint32_t reg) {
+    bytes({ uint8_t(0x84 | (xmm << 3)), 0x0b });
+    imm32(reg * jit_block_size * sizeof(double));
+  }
+  // movupd xmm, [rbx + rcx + lanes of reg]
+  void load_lanes(int xmm, uint32_t reg) {
+    bytes({ 0x66, 0x0f, 0x10 });
+    lane_operand(xmm, reg);
+  }
+  // movupd [rbx + rcx + lanes of reg], xmm0
+  void store_lanes(uint32_t reg) {
+    bytes({ 0x66, 0x0f, 0x11 });
+    lane_operand(0, reg);
+  }
+  // xor ecx, ecx. returns position of the loop over pairs of lanes
+  size_t begin_lanes() {
+    bytes({ 0x31, 0xc9 });
+    return code.size();
+  }
+  // add rcx, 16; cmp rcx, r13; jb to begin
+  void end_lanes(size_t begin) {
+    bytes({ 0x48, 0x83, 0xc1, 0x10 });
+    bytes({ 0x4c, 0x39, 0xe9 });
+    patch(jump({ 0x0f, 0x82 }), begin);
+  }
+  // lea rdi/rsi/rdx, [rbx + lanes of reg], given by ModRM of the former
+  void lanes_address(uint8_t modrm, uint32_t reg) {
+    bytes({ 0x48, 0x8d, modrm });
+    imm32(reg * jit_block_size * sizeof(double));
+  }
+  // mov rax, bits; movq xmm, rax; punpcklqdq xmm, xmm
+  void broadcast(int xmm, uint64_t bits) {
+    bytes({ 0x48, 0xb8 });
+    imm64(bits);
+    bytes({ 0x66, 0x48, 0x0f, 0x6e, uint8_t(0xc0 | (xmm << 3)) });
+    bytes({ 0x66, 0x0f, 0x6c, uint8_t(0xc0 | (xmm << 3) | xmm) });
+  }
+  // emits jump with 32-bit relative offset to be patched and returns position
+  // of the offset
+  size_t jump(std::initializer_list<uint8_t> opcode) {
+    bytes(opcode);
+    imm32(0);
+    return code.size() - 4;
+  }
+  void patch(size_t position, size_t target) {
+    uint32_t offset = target - (position + 4);
+    memcpy(&code[position], &offset, sizeof(offset));
+  }
+};
+
+static void jit_fail() {
+  die("no matching clause in case statement");
+}
+
+static const void* unary_function(opcode_k opcode) {
+  double (*function)(double) = nullptr;
+  switch (opcode) {
+    case opcode_k::sin:   function = sin; break;
+    case opcode_k::cos:   function = cos; break;
+    case opcode_k::exp:   function = exp; break;
+    case opcode_k::floor: function = static_cast<double (*)(double)>(std::floor); break;
+    case opcode_k::round: function = static_cast<double (*)(double)>(std::round); break;
+    case opcode_k::ceil:  function = static_cast<double (*)(double)>(std::ceil); break;
+    default:              break;
+  }
+  return reinterpret_cast<const void*>(function);
+}
+
+static const void* binary_function(opcode_k opcode) {
+  double (*function)(double, double) = nullptr;
+  switch (opcode) {
+    case opcode_k::mod:
+      function = static_cast<double (*)(double, double)>(std::fmod);
+      break;
+    case opcode_k::pow:
+      function = static_cast<double (*)(double, double)>(std::pow);
+      break;
+    default:
+      break;
+  }
+  return reinterpret_cast<const void*>(function);
+}
+
+// kernels for lanes of builtins that vmath.hh doesn't have, or approximates
+// when bytecode asks for exact results, computed the same as by vm_t
+static void lanes_sin(const double *x, double *out, size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = sin(x[k]);
+}
+
+static void lanes_cos(const double *x, double *out, size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = cos(x[k]);
+}
+
+static void lanes_exp(const double *x, double *out, size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = exp(x[k]);
+}
+
+static void lanes_ceq(const double *x, const double *y, double *out
+    , size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = (int64_t)x[k] == (int64_t)y[k];
+}
+
+static void lanes_cneq(const double *x, const double *y, double *out
+    , size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = (int64_t)x[k] != (int64_t)y[k];
+}
+
+static void lanes_select(const double *x, const double *y, double *out
+    , size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    if ((int64_t)x[k] != 0)
+      out[k] = y[k];
+}
+
+// searches cases [first, last) of table for value in rax with a tree of
+// comparisons, jumping to the target of the matching case or to otherwise
+static void assemble_search(assembler_t *as, const jump_table_t &table
+    , size_t first, size_t last
+    , std::vector<std::pair<size_t, uint32_t>> *jumps) {
+  if (last - first <= 4) {
+    for (size_t k = first; k < last; ++k) {
+      as->compare_rax(table.cases[k].first);
+      jumps->push_back({ as->jump({ 0x0f, 0x84 }), table.cases[k].second });
+    }
+    jumps->push_back({ as->jump({ 0xe9 }), table.otherwise });
+    return;
+  }
+  const size_t middle = first + (last - first) / 2;
+  // je to target of middle; jg past the lower half
+  as->compare_rax(table.cases[middle].first);
+  jumps->push_back({ as->jump({ 0x0f, 0x84 }), table.cases[middle].second });
+  const size_t jump_to_upper = as->jump({ 0x0f, 0x8f });
+  assemble_search(as, table, first, middle, jumps);
+  as->patch(jump_to_upper, as->code.size());
+  assemble_search(as, table, middle + 1, last, jumps);
+}
+
+// assembles a function of registers running instructions, which are either
+// instructions of bytecode or its note or time instructions
+static bool assemble(const bytecode_t *bytecode
+    , const std::vector<instruction_t> &instructions, assembler_t *as
+    , std::string *error) {
+  const void *const llround_function = reinterpret_cast<const void*>(
+      static_cast<long long (*)(double)>(std::llround));
+  // jump offset position and index of target instruction
+  std::vector<std::pair<size_t, uint32_t>> jumps;
+  std::vector<size_t> instruction_offsets;
+  std::vector<bool> jump_targets(instructions.size() + 1, false);
+  for (const instruction_t &i : instructions)
+    switch (i.opcode) {
+      case opcode_k::jump:
+      case opcode_k::jump_if_zero:
+      case opcode_k::jump_if_no_case:
+        jump_targets[i.dst] = true;
+        break;
+      case opcode_k::jump_table: {
+        const jump_table_t &table = bytecode->jump_tables[i.b];
+        for (const std::pair<int64_t, uint32_t> &c : table.cases)
+          jump_targets[c.second] = true;
+        jump_targets[table.otherwise] = true;
+        break;
+      }
+      default:
+        break;
+    }
+  // rounding towards -inf/+inf without precision exceptions, same as libm
+  const bool has_roundsd = __builtin_cpu_supports("sse4.1");
+  const uint8_t round_floor = 0x9, round_ceil = 0xa;
+
+  // push rbx; push r12; sub rsp, 8 (to keep stack aligned for calls);
+  // mov rbx, rdi
+  as->bytes({ 0x53, 0x41, 0x54, 0x48, 0x83, 0xec, 0x08, 0x48, 0x89, 0xfb });
+
+  for (size_t ip = 0; ip < instructions.size(); ++ip) {
+    const instruction_t &i = instructions[ip];
+    instruction_offsets.push_back(as->code.size());
+    if (jump_targets[ip])
+      as->xmm0_register = no_register;
+    switch (i.opcode) {
+      case opcode_k::floor:
+      case opcode_k::ceil:
+        if (has_roundsd) {
+          as->round(i.a, i.opcode == opcode_k::floor ? round_floor
+              : round_ceil);
+          as->store(i.dst);
+          break;
+        }
+        // fallthrough
+      case opcode_k::sin:
+      case opcode_k::cos:
+      case opcode_k::exp:
+      case opcode_k::round:
+        as->load(0, i.a);
+        as->call(unary_function(i.opcode));
+        as->store(i.dst);
+        break;
+      case opcode_k::inv:
+      case opcode_k::abs:
+        // movq rax, xmm0; btc/btr rax, 63; movq xmm0, rax
+        as->load(0, i.a);
+        as->bytes({ 0x66, 0x48, 0x0f, 0x7e, 0xc0 });
+        if (i.opcode == opcode_k::inv)
+          as->bytes({ 0x48, 0x0f, 0xba, 0xf8, 0x3f });
+        else
+          as->bytes({ 0x48, 0x0f, 0xba, 0xf0, 0x3f });
+        as->bytes({ 0x66, 0x48, 0x0f, 0x6e, 0xc0 });
+        as->xmm0_register = no_register;
+        as->store(i.dst);
+        break;
+      case opcode_k::sqrt:
+        as->arithmetic(0x51, i.a);
+        as->store(i.dst);
+        break;
+      case opcode_k::plus:
+      case opcode_k::minus:
+      case opcode_k::mult:
+      case opcode_k::divide: {
+        const uint8_t opcode = i.opcode == opcode_k::plus ? 0x58
+          : i.opcode == opcode_k::minus ? 0x5c
+          : i.opcode == opcode_k::mult ? 0x59 : 0x5e;
+        as->load(0, i.a);
+        as->arithmetic(opcode, i.b);
+        as->store(i.dst);
+        break;
+      }
+      case opcode_k::ceq:
+      case opcode_k::cneq:
+        // cvttsd2si rax, xmm0; cvttsd2si rcx, xmm1; cmp rax, rcx; sete/setne al
+        as->load(0, i.a);
+        as->load(1, i.b);
+        as->bytes({ 0xf2, 0x48, 0x0f, 0x2c, 0xc0 });
+        as->bytes({ 0xf2, 0x48, 0x0f, 0x2c, 0xc9 });
+        as->bytes({ 0x48, 0x39, 0xc8 });
+        as->bytes({ 0x0f, uint8_t(i.opcode == opcode_k::ceq ? 0x94 : 0x95)
+            , 0xc0 });
+        as->flag_to_number();
+        as->store(i.dst);
+        break;
+      case opcode_k::clt:
+      case opcode_k::clteq:
+      case opcode_k::cgt:
+      case opcode_k::cgteq:
+        // ucomisd leaves flags so that seta/setae are false for NaNs
+        as->load(0, i.a);
+        as->load(1, i.b);
+        if (i.opcode == opcode_k::cgt)
+          as->bytes({ 0x66, 0x0f, 0x2e, 0xc1 }); // ucomisd xmm0, xmm1
+        else
+          as->bytes({ 0x66, 0x0f, 0x2e, 0xc8 }); // ucomisd xmm1, xmm0
+        if (i.opcode == opcode_k::clt || i.opcode == opcode_k::cgt)
+          as->bytes({ 0x0f, 0x97, 0xc0 }); // seta al
+        else
+          as->bytes({ 0x0f, 0x93, 0xc0 }); // setae al
+        as->flag_to_number();
+        as->store(i.dst);
+        break;
+      case opcode_k::mod:
+      case opcode_k::pow:
+        as->load(0, i.a);
+        as->load(1, i.b);
+        as->call(binary_function(i.opcode));
+        as->store(i.dst);
+        break;
+      case opcode_k::move:
+        as->load(0, i.a);
+        as->store(i.dst);
+        break;
+      case opcode_k::select:
+        // cvttsd2si rax, xmm0; mov rcx, [dst]; mov rdx, [b]; test rax, rax;
+        // cmovnz rcx, rdx; mov [dst], rcx
+        as->load(0, i.a);
+        as->bytes({ 0xf2, 0x48, 0x0f, 0x2c, 0xc0 });
+        as->bytes({ 0x48, 0x8b });
+        as->register_operand(1, i.dst);
+        as->bytes({ 0x48, 0x8b });
+        as->register_operand(2, i.b);
+        as->bytes({ 0x48, 0x85, 0xc0 });
+        as->bytes({ 0x48, 0x0f, 0x45, 0xca });
+        as->bytes({ 0x48, 0x89 });
+        as->register_operand(1, i.dst);
+        if (as->xmm0_register == i.dst)
+          as->xmm0_register = no_register;
+        break;
+      case opcode_k::jump:
+        jumps.push_back({ as->jump({ 0xe9 }), i.dst });
+        break;
+      case opcode_k::jump_if_zero:
+        // cvttsd2si rax, xmm0; test rax, rax; jz
+        as->load(0, i.a);
+        as->bytes({ 0xf2, 0x48, 0x0f, 0x2c, 0xc0 });
+        as->bytes({ 0x48, 0x85, 0xc0 });
+        jumps.push_back({ as->jump({ 0x0f, 0x84 }), i.dst });
+        break;
+      case opcode_k::jump_if_no_case:
+        // mov r12, rax; ...; cmp r12, rax; jne
+        as->load(0, i.a);
+        as->call(llround_function);
+        as->bytes({ 0x49, 0x89, 0xc4 });
+        as->load(0, i.b);
+        as->call(llround_function);
+        as->bytes({ 0x49, 0x39, 0xc4 });
+        jumps.push_back({ as->jump({ 0x0f, 0x85 }), i.dst });
+        break;
+      case opcode_k::jump_table: {
+        const jump_table_t &table = bytecode->jump_tables[i.b];
+        as->load(0, i.a);
+        as->call(llround_function);
+        assemble_search(as, table, 0, table.cases.size(), &jumps);
+        break;
+      }
+      case opcode_k::fail:
+        as->call(reinterpret_cast<const void*>(jit_fail));
+        break;
+      case opcode_k::ret:
+        // add rsp, 8; pop r12; pop rbx; ret
+        as->load(0, i.a);
+        as->bytes({ 0x48, 0x83, 0xc4, 0x08, 0x41, 0x5c, 0x5b, 0xc3 });
+        break;
+      default:
+        *error = "opcode <" + opcode_kind_to_string(i.opcode)
+          + "> is not supported by jit";
+        return false;
+    }
+  }
+
+  // note and time instructions just fall off the end
+  if (instructions.empty() || instructions.back().opcode != opcode_k::ret)
+    as->bytes({ 0x48, 0x83, 0xc4, 0x08, 0x41, 0x5c, 0x5b, 0xc3 });
+
+  for (const std::pair<size_t, uint32_t> &jump : jumps)
+    as->patch(jump.first, instruction_offsets.at(jump.second));
+
+  return true;
+}
+
+// assembles a function of lanes running instructions without jumps, which
+// are either instructions of straight-line code or time instructions, on the
+// first m lanes of each register. lanes are computed in pairs, so that odd m
+// computes one more, which lanes() leaves room for. the register returned by
+// instructions is stored in result
+static bool assemble_lanes(const bytecode_t *bytecode
+    , const std::vector<instruction_t> &instructions, assembler_t *as
+    , uint32_t *result, std::string *error) {
+  typedef void (*unary_t)(const double*, double*, size_t);
+  typedef void (*binary_t)(const double*, const double*, double*, size_t);
+  const bool approximate = bytecode->approximate_math;
+  const uint64_t sign_bits = 0x8000000000000000ULL
+    , one_bits = 0x3ff0000000000000ULL;
+  // cmppd predicates
+  const uint8_t less = 1, less_or_equal = 2;
+
+  // push rbx; push r12; push r13 (which keeps stack aligned for calls);
+  // mov rbx, rdi; mov r12, rsi; lea r13, [8 * rsi + 15]; and r13, -16
+  as->bytes({ 0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xfb, 0x49, 0x89
+      , 0xf4 });
+  as->bytes({ 0x4c, 0x8d, 0x2c, 0xf5, 0x0f, 0x00, 0x00, 0x00 });
+  as->bytes({ 0x49, 0x83, 0xe5, 0xf0 });
+
+  for (const instruction_t &i : instructions) {
+    unary_t unary = nullptr;
+    binary_t binary = nullptr;
+    switch (i.opcode) {
+      case opcode_k::sin:   unary = approximate ? vmath_sin : lanes_sin; break;
+      case opcode_k::cos:   unary = approximate ? vmath_cos : lanes_cos; break;
+      case opcode_k::exp:   unary = approximate ? vmath_exp : lanes_exp; break;
+      case opcode_k::abs:   unary = vmath_abs; break;
+      case opcode_k::floor: unary = vmath_floor; break;
+      case opcode_k::round: unary = vmath_round; break;
+      case opcode_k::ceil:  unary = vmath_ceil; break;
+      case opcode_k::mod:   binary = vmath_mod; break;
+      case opcode_k::pow:   binary = vmath_pow; break;
+      case opcode_k::ceq:   binary = lanes_ceq; break;
+      case opcode_k::cneq:  binary = lanes_cneq; break;
+      case opcode_k::select: binary = lanes_select; break;
+      case opcode_k::sqrt: {
+        // sqrtpd xmm0, xmm0
+        const size_t loop = as->begin_lanes();
+        as->load_lanes(0, i.a);
+        as->bytes({ 0x66, 0x0f, 0x51, 0xc0 });
+        as->store_lanes(i.dst);
+        as->end_lanes(loop);
+        break;
+      }
+      case opcode_k::inv: {
+        // xorpd xmm0, xmm1
+        as->broadcast(1, sign_bits);
+        const size_t loop = as->begin_lanes();
+        as->load_lanes(0, i.a);
+        as->bytes({ 0x66, 0x0f, 0x57, 0xc1 });
+        as->store_lanes(i.dst);
+        as->end_lanes(loop);
+        break;
+      }
+      case opcode_k::plus:
+      case opcode_k::minus:
+      case opcode_k::mult:
+      case opcode_k::divide: {
+        // addpd/subpd/mulpd/divpd xmm0, xmm1
+        const uint8_t opcode = i.opcode == opcode_k::plus ? 0x58
+          : i.opcode == opcode_k::minus ? 0x5c
+          : i.opcode == opcode_k::mult ? 0x59 : 0x5e;
+        const size_t loop = as->begin_lanes();
+        as->load_lanes(0, i.a);
+        as->load_lanes(1, i.b);
+        as->bytes({ 0x66, 0x0f, opcode, 0xc1 });
+        as->store_lanes(i.dst);
+        as->end_lanes(loop);
+        break;
+      }
+      case opcode_k::clt:
+      case opcode_k::clteq:
+      case opcode_k::cgt:
+      case opcode_k::cgteq: {
+        // cmppd xmm0, xmm1, predicate; andpd xmm0, xmm2. masks of NaNs are
+        // clear, so those compare false as with scalars
+        const bool swap = i.opcode == opcode_k::cgt;
+        const uint8_t predicate = i.opcode == opcode_k::clt || swap ? less
+          : less_or_equal;
+        as->broadcast(2, one_bits);
+        const size_t loop = as->begin_lanes();
+        as->load_lanes(0, swap ? i.b : i.a);
+        as->load_lanes(1, swap ? i.a : i.b);
+        as->bytes({ 0x66, 0x0f, 0xc2, 0xc1, predicate });
+        as->bytes({ 0x66, 0x0f, 0x54, 0xc2 });
+        as->store_lanes(i.dst);
+        as->end_lanes(loop);
+        break;
+      }
+      case opcode_k::move: {
+        const size_t loop = as->begin_lanes();
+        as->load_lanes(0, i.a);
+        as->store_lanes(i.dst);
+        as->end_lanes(loop);
+        break;
+      }
+      case opcode_k::ret:
+        *result = i.a;
+        break;
+      default:
+        *error = "opcode <" + opcode_kind_to_string(i.opcode)
+          + "> can't be run on lanes by jit";
+        return false;
+    }
+    if (unary != nullptr) {
+      // lea rdi, [a]; lea rsi, [dst]; mov rdx, r12
+      as->lanes_address(0xbb, i.a);
+      as->lanes_address(0xb3, i.dst);
+      as->bytes({ 0x4c, 0x89, 0xe2 });
+      as->call(reinterpret_cast<const void*>(unary));
+    } else if (binary != nullptr) {
+      // lea rdi, [a]; lea rsi, [b]; lea rdx, [dst]; mov rcx, r12
+      as->lanes_address(0xbb, i.a);
+      as->lanes_address(0xb3, i.b);
+      as->lanes_address(0x93, i.dst);
+      as->bytes({ 0x4c, 0x89, 0xe1 });
+      as->call(reinterpret_cast<const void*>(binary));
+    }
+    if (i.opcode == opcode_k::ret)
+      break;
+  }
+
+  // pop r13; pop r12; pop rbx; ret
+  as->bytes({ 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3 });
+  return true;
+}
+
+#endif
+
+jit_t::jit_t(const bytecode_t *bytecode)
+  : _bytecode(bytecode)
+  , _memory(nullptr)
+  , _memory_size(0)
+  , _note_function(nullptr)
+  , _time_function(nullptr)
+  , _control_function(nullptr)
+  , _function(nullptr)
+  , _time_lanes_function(nullptr)
+  , _lanes_function(nullptr)
+  , _lanes_result(0) {
+}
+
+jit_t::~jit_t() {
+  if (_memory != nullptr)
+    munmap(_memory, _memory_size);
+}
+
+bool jit_t::compile(std::string *error) {
+#if defined(__x86_64__) && defined(__linux__)
+  assembler_t as;
+  if (!assemble(_bytecode, _bytecode->note_instructions, &as, error))
+    return false;
+  const size_t time_offset = as.code.size();
+  as.xmm0_register = no_register;
+  if (!assemble(_bytecode, _bytecode->time_instructions, &as, error))
+    return false;
+  const size_t control_offset = as.code.size();
+  as.xmm0_register = no_register;
+  if (!assemble(_bytecode, _bytecode->control_instructions, &as, error))
+    return false;
+  const size_t offset = as.code.size();
+  as.xmm0_register = no_register;
+  if (!assemble(_bytecode, _bytecode->instructions, &as, error))
+    return false;
+  const size_t time_lanes_offset = as.code.size();
+  if (!assemble_lanes(_bytecode, _bytecode->time_instructions, &as
+        , &_lanes_result, error))
+    return false;
+  const size_t lanes_offset = as.code.size();
+  if (_bytecode->straight_line && !assemble_lanes(_bytecode
+        , _bytecode->instructions, &as, &_lanes_result, error))
+    return false;
+
+  _memory_size = as.code.size();
+  _memory = mmap(nullptr, _memory_size, PROT_READ | PROT_WRITE
+      , MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (_memory == MAP_FAILED) {
+    _memory = nullptr;
+    *error = "failed to allocate memory for jit";
+    return false;
+  }
+  memcpy(_memory, as.code.data(), as.code.size());
+  if (mprotect(_memory, _memory_size, PROT_READ | PROT_EXEC) != 0) {
+    *error = "failed to make jit code executable";
+    return false;
+  }
+  _note_function = reinterpret_cast<void (*)(double*)>(_memory);
+  _time_function = reinterpret_cast<void (*)(double*)>((uint8_t*)_memory
+      + time_offset);
+  _control_function = reinterpret_cast<void (*)(double*)>((uint8_t*)_memory
+      + control_offset);
+  _function = reinterpret_cast<double (*)(double*)>((uint8_t*)_memory
+      + offset);
+  _time_lanes_function = reinterpret_cast<void (*)(double*, size_t)>(
+      (uint8_t*)_memory + time_lanes_offset);
+  if (_bytecode->straight_line)
+    _lanes_function = reinterpret_cast<void (*)(double*, size_t)>(
+        (uint8_t*)_memory + lanes_offset);
+  return true;
+#else
+  *error = "jit is only supported on x86-64 linux";
+  return false;
+#endif
+}
+
+double jit_t::run(double *registers, double f, double t) const {
+  registers[bytecode_register_f] = f;
+  _note_function(registers);
+  registers[bytecode_register_t] = t;
+  _time_function(registers);
+  // exact values, as if there was a control point at every sample
+  _control_function(registers);
+  for (const std::pair<uint32_t, uint32_t> &control : _bytecode->controls)
+    registers[control.first] = registers[control.second];
+  for (const recurrence_t &recurrence : _bytecode->recurrences)
+    registers[recurrence.dst] = recurrence.value(registers, t);
+  return _function(registers);
+}
+
+void jit_t::_run_time_lanes(double *registers, double *lanes
+    , std::vector<double> *control_points, uint64_t start
+    , double sample_rate, size_t m) const {
+  double *const t = lanes + bytecode_register_t * jit_block_size;
+  for (size_t k = 0; k < m; ++k)
+    t[k] = (double)(start + k) / sample_rate;
+  _time_lanes_function(lanes, m);
+
+  const std::vector<std::pair<uint32_t, uint32_t>> &controls
+    = _bytecode->controls;
+  if (controls.empty())
+    return;
+  const uint64_t first = _bytecode->first_control_point(start);
+  const size_t num_points = _bytecode->num_control_points(start, m);
+  control_points->resize(num_points * controls.size());
+  double *const points = control_points->data();
+  for (size_t p = 0; p < num_points; ++p) {
+    registers[bytecode_register_t] = (double)(first
+        + p * _bytecode->control_period) / sample_rate;
+    _control_function(registers);
+    for (size_t j = 0; j < controls.size(); ++j)
+      points[p * controls.size() + j] = registers[controls[j].second];
+  }
+  _bytecode->interpolate_controls(points, start, m
+      , lanes + controls.front().first * jit_block_size, 1, jit_block_size);
+}
+
+void jit_t::_run_recurrence_lanes(const double *registers, double *lanes
+    , uint64_t start, double sample_rate, size_t m) const {
+  for (const recurrence_t &recurrence : _bytecode->recurrences)
+    recurrence.run(registers, start, sample_rate, m
+        , lanes + recurrence.dst * jit_block_size, 1);
+}
+
+void jit_t::_run_samples(double *registers, double *lanes, size_t m
+    , float *out) const {
+  if (_lanes_function != nullptr) {
+    // values of note are the same in every lane
+    std::fill_n(lanes + bytecode_register_f * jit_block_size, jit_block_size
+        , registers[bytecode_register_f]);
+    for (const instruction_t &i : _bytecode->note_instructions)
+      std::fill_n(lanes + i.dst * jit_block_size, jit_block_size
+          , registers[i.dst]);
+    _lanes_function(lanes, m);
+    const double *const values = lanes + _lanes_result * jit_block_size;
+    for (size_t k = 0; k < m; ++k)
+      out[k] = values[k];
+    return;
+  }
+  for (size_t k = 0; k < m; ++k) {
+    registers[bytecode_register_t] = lanes[bytecode_register_t
+      * jit_block_size + k];
+    for (const instruction_t &i : _bytecode->time_instructions)
+      registers[i.dst] = lanes[i.dst * jit_block_size + k];
+    for (const std::pair<uint32_t, uint32_t> &control : _bytecode->controls)
+      registers[control.first] = lanes[control.first * jit_block_size + k];
+    for (const recurrence_t &recurrence : _bytecode->recurrences)
+      registers[recurrence.dst] = lanes[recurrence.dst * jit_block_size + k];
+    out[k] = _function(registers);
+  }
+}
+
+std::vector<double> jit_t::lanes() const {
+  std::vector<double> lanes(_bytecode->num_registers * jit_block_size, 0);
+  for (const std::pair<uint32_t, double> &constant : _bytecode->constants)
+    std::fill_n(lanes.begin() + constant.first * jit_block_size
+        , jit_block_size, constant.second);
+  return lanes;
+}
+
+void jit_t::run_block(double *registers, double *lanes
+    , std::vector<double> *control_points, double f, uint64_t start
+    , double sample_rate, float *out, size_t n) const {
+  registers[bytecode_register_f] = f;
+  _note_function(registers);
+  for (size_t offset = 0; offset < n; offset += jit_block_size) {
+    const size_t m = std::min(jit_block_size, n - offset);
+    _run_time_lanes(registers, lanes, control_points, start + offset
+        , sample_rate, m);
+    _run_recurrence_lanes(registers, lanes, start + offset, sample_rate, m);
+    _run_samples(registers, lanes, m, out + offset);
+  }
+}
+
+void jit_t::run_notes(double *registers, double *lanes
+    , std::vector<double> *control_points, const double *f
+    , size_t num_notes, uint64_t start, double sample_rate
+    , float *const *out, size_t n) const {
+  for (size_t offset = 0; offset < n; offset += jit_block_size) {
+    const size_t m = std::min(jit_block_size, n - offset);
+    // instructions don't write registers of time or of controls, so their
+    // lanes are kept for all notes
+    _run_time_lanes(registers, lanes, control_points, start + offset
+        , sample_rate, m);
+    for (size_t j = 0; j < num_notes; ++j) {
+      registers[bytecode_register_f] = f[j];
+      _note_function(registers);
+      _run_recurrence_lanes(registers, lanes, start + offset, sample_rate
+          , m);
+      _run_samples(registers, lanes, m, out[j] + offset);
+    }
+  }
+}
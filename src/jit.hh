@@ -0,0 +1,66 @@
+#pragma once
+
+#include "compile.hh"
+
+// number of samples processed at once by run_block() and run_notes(). each
+// register has as many lanes for them, see lanes()
+const size_t jit_block_size = 64;
+
+// translates bytecode into x86-64 machine code using SSE2 arithmetic. single
+// samples are computed with scalar code that calls transcendental and
+// rounding builtins from libm. blocks compute values of time, and all
+// instructions of straight-line code, on lanes of jit_block_size samples,
+// two at a time, calling the kernels of vmath.hh or libm for builtins as
+// vm_t does, so that results are identical to those of vm_t in both cases.
+// compiled code keeps no state, so it can be run from several threads at
+// once, each with registers of its own, as returned by
+// bytecode_t::registers(), and lanes of its own, as returned by lanes().
+// bytecode must outlive jit
+class jit_t {
+  const bytecode_t *_bytecode;
+  void *_memory;
+  size_t _memory_size;
+  // run note, time and control instructions
+  void (*_note_function)(double *registers);
+  void (*_time_function)(double *registers);
+  void (*_control_function)(double *registers);
+  double (*_function)(double *registers);
+  // run time instructions, or instructions of straight-line code, on the
+  // first m lanes of each register. the latter is null unless code is
+  // straight-line, and leaves the returned value in lanes of _lanes_result
+  void (*_time_lanes_function)(double *lanes, size_t m);
+  void (*_lanes_function)(double *lanes, size_t m);
+  uint32_t _lanes_result;
+  // computes values of time, and of controls, for m samples from start into
+  // their lanes
+  void _run_time_lanes(double *registers, double *lanes
+      , std::vector<double> *control_points, uint64_t start
+      , double sample_rate, size_t m) const;
+  // computes values of recurrences of note computed last for m samples from
+  // start into their lanes
+  void _run_recurrence_lanes(const double *registers, double *lanes
+      , uint64_t start, double sample_rate, size_t m) const;
+  // computes m samples of note computed last, whose values of time, controls
+  // and recurrences are in lanes, into out
+  void _run_samples(double *registers, double *lanes, size_t m, float *out)
+    const;
+public:
+  jit_t(const bytecode_t *bytecode);
+  ~jit_t();
+  // returns false and sets error if bytecode can't be translated on this
+  // machine, in which case jit must not be run
+  bool compile(std::string *error);
+  // jit_block_size lanes for each register, constants filled in
+  std::vector<double> lanes() const;
+  double run(double *registers, double f, double t) const;
+  // values at control points are kept aside in control_points
+  void run_block(double *registers, double *lanes
+      , std::vector<double> *control_points, double f, uint64_t start
+      , double sample_rate, float *out, size_t n) const;
+  // like run_block() for each of num_notes frequencies, into out[j].
+  // values of time and of controls are computed once for all of them
+  void run_notes(double *registers, double *lanes
+      , std::vector<double> *control_points, const double *f
+      , size_t num_notes, uint64_t start, double sample_rate
+      , float *const *out, size_t n) const;
+};
@@ -1,5 +1,8 @@
 #include "lang.hh"
+#include "infer.hh"
+#include "utils.hh"
 #include <algorithm>
+#include <cmath>
 
 std::string type_to_string(const type_t *const type) {
   if (type == nullptr)
@@ -25,11 +28,39 @@ std::string type_to_string(const type_t *const type) {
       return type_str;
     } case type_k::builtin:
       return "builtin";
+    case type_k::partial:
+      return "partial application";
+    case type_k::thunk:
+      return "thunk";
+    case type_k::variable:
+      if (type->variable < 26)
+        return std::string("'") + (char)('a' + type->variable);
+      return "'t" + std::to_string(type->variable);
     default:
       return "unhandled";
   }
 }
 
+type_t::~type_t() {
+  if (kind != type_k::lambda)
+    return;
+  delete lambda.takes;
+  delete lambda.returns;
+}
+
+type_t* type_copy(const type_t *const type) {
+  if (type == nullptr)
+    return nullptr;
+  type_t *copy = new type_t;
+  copy->kind = type->kind;
+  if (type->kind == type_k::lambda) {
+    copy->lambda.takes = type_copy(type->lambda.takes);
+    copy->lambda.returns = type_copy(type->lambda.returns);
+  } else if (type->kind == type_k::variable)
+    copy->variable = type->variable;
+  return copy;
+}
+
 std::string builtin_kind_to_string(builtin_k kind) {
   switch (kind) {
     case builtin_k::sin:    return "sin";
@@ -53,11 +84,12 @@ std::string builtin_kind_to_string(builtin_k kind) {
     case builtin_k::round:  return "round";
     case builtin_k::ceil:   return "ceil";
     case builtin_k::sqrt:   return "sqrt";
+    case builtin_k::krate:  return "krate";
     default:                return "unhandled";
   }
 }
 
-builtin_t::~builtin_t() {
+bool builtin_is_binary(builtin_k kind) {
   switch (kind) {
     case builtin_k::plus:
     case builtin_k::minus:
@@ -71,11 +103,45 @@ builtin_t::~builtin_t() {
     case builtin_k::cgteq:
     case builtin_k::mod:
     case builtin_k::pow:
-      if (binary_op.x)
-        delete binary_op.x;
-      break;
+      return true;
     default:
-      break;
+      return false;
+  }
+}
+
+double builtin_apply_unary(builtin_k kind, double x) {
+  switch (kind) {
+    case builtin_k::sin:   return sin(x);
+    case builtin_k::cos:   return cos(x);
+    case builtin_k::exp:   return exp(x);
+    case builtin_k::inv:   return -x;
+    case builtin_k::abs:   return std::fabs(x);
+    case builtin_k::floor: return std::floor(x);
+    case builtin_k::round: return std::round(x);
+    case builtin_k::ceil:  return std::ceil(x);
+    case builtin_k::sqrt:  return std::sqrt(x);
+    case builtin_k::krate: return x;
+    default:
+      die("unexpected builtin kind");
+  }
+}
+
+double builtin_apply_binary(builtin_k kind, double x, double y) {
+  switch (kind) { // :born_to_think:
+    case builtin_k::plus:   return x + y;
+    case builtin_k::minus:  return x - y;
+    case builtin_k::mult:   return x * y;
+    case builtin_k::divide: return x / y;
+    case builtin_k::ceq:    return (int64_t)x == (int64_t)y;
+    case builtin_k::cneq:   return (int64_t)x != (int64_t)y;
+    case builtin_k::clt:    return x < y;
+    case builtin_k::clteq:  return x <= y;
+    case builtin_k::cgt:    return x > y;
+    case builtin_k::cgteq:  return x <= y;
+    case builtin_k::mod:    return std::fmod(x, y);
+    case builtin_k::pow:    return std::pow(x, y);
+    default:
+      die("unexpected builtin kind");
   }
 }
 
@@ -106,6 +172,11 @@ void value_t::pretty_print() const {
     case type_k::builtin:
       printf("%s", builtin_kind_to_string(builtin->kind).c_str());
       break;
+    case type_k::partial:
+      printf("(partial ");
+      partial.function->pretty_print();
+      printf(" %u)", partial.num_args);
+      break;
     default:
       printf("unhandled");
       break;
@@ -121,6 +192,8 @@ std::string term_kind_to_string(term_k kind) {
     case term_k::if_else:     return "if else";
     case term_k::let_in:      return "let in";
     case term_k::value:       return "value";
+    case term_k::unary_op:    return "unary op";
+    case term_k::binary_op:   return "binary op";
     default:                  return "unhandled";
   }
 }
@@ -165,28 +238,16 @@ term_t::~term_t() {
     case term_k::value:
       delete value;
       break;
+    case term_k::unary_op:
+      delete unary_op.x;
+      break;
+    case term_k::binary_op:
+      delete binary_op.x;
+      delete binary_op.y;
+      break;
     default:
       break;
   }
-  if (scope != nullptr) {
-    delete scope;
-    scope = nullptr;
-  }
-}
-
-bool term_t::lookup(const std::string &identifier, value_t *&value) const {
-  const term_t *it = this;
-  while (it != nullptr) {
-    if (it->scope != nullptr) {
-      auto value_it = it->scope->find(identifier);
-      if (value_it != it->scope->end()) {
-        value = value_it->second;
-        return true;
-      }
-    }
-    it = it->parent;
-  }
-  return false;
 }
 
 void term_t::pretty_print() const {
@@ -248,13 +309,74 @@ void term_t::pretty_print() const {
       break;
     case term_k::value:
       value->pretty_print();
+      break;
+    case term_k::unary_op:
+      printf("(%s ", builtin_kind_to_string(unary_op.kind).c_str());
+      unary_op.x->pretty_print();
+      printf(")");
+      break;
+    case term_k::binary_op:
+      printf("(%s ", builtin_kind_to_string(binary_op.kind).c_str());
+      binary_op.x->pretty_print();
+      printf(" ");
+      binary_op.y->pretty_print();
+      printf(")");
+      break;
     default:
       break;
   }
 }
 
+size_t term_t::count_nodes() const {
+  size_t count = 1;
+  switch (kind) {
+    case term_k::program:
+      for (const term_t *const term : *program.terms)
+        count += term->count_nodes();
+      break;
+    case term_k::definition:
+      count += definition.body->count_nodes();
+      break;
+    case term_k::application:
+      count += application.lambda->count_nodes()
+        + application.parameter->count_nodes();
+      break;
+    case term_k::case_of:
+      count += case_of.value->count_nodes();
+      for (const case_statement &statement : *case_of.statements) {
+        if (statement.value)
+          count += statement.value->count_nodes();
+        count += statement.result->count_nodes();
+      }
+      break;
+    case term_k::if_else:
+      count += if_else.condition->count_nodes()
+        + if_else.then_expr->count_nodes() + if_else.else_expr->count_nodes();
+      break;
+    case term_k::let_in:
+      for (const term_t *const definition : *let_in.definitions)
+        count += definition->count_nodes();
+      count += let_in.body->count_nodes();
+      break;
+    case term_k::value:
+      if (value->type.kind == type_k::lambda)
+        count += value->lambda.body->count_nodes();
+      break;
+    case term_k::unary_op:
+      count += unary_op.x->count_nodes();
+      break;
+    case term_k::binary_op:
+      count += binary_op.x->count_nodes() + binary_op.y->count_nodes();
+      break;
+    default:
+      break;
+  }
+  return count;
+}
+
 std::string message_kind_to_string(message_k kind) {
   switch (kind) {
+    case message_k::note:    return "note";
     case message_k::warning: return "warning";
     case message_k::error:   return "error";
     default:                 return "unhandled";
@@ -268,22 +390,31 @@ bool messages_contain_no_errors(const std::vector<message_t> &messages) {
   return true;
 }
 
+bool is_evaluatable_definition(const term_t *const term) {
+  if (term->kind != term_k::definition)
+    return false;
+  term_t *main_lam = term->definition.body;
+  if (main_lam->kind != term_k::value)
+    return false;
+  if (main_lam->value->type.kind != type_k::lambda)
+    return false;
+  value_t *lam_freq = main_lam->value;
+  term_t *lam_time_term = lam_freq->lambda.body;
+  if (lam_time_term->kind != term_k::value)
+    return false;
+  if (lam_time_term->value->type.kind != type_k::lambda)
+    return false;
+  // "name a b c = ..." takes more than f and t and can't be played
+  const term_t *body = lam_time_term->value->lambda.body;
+  return body->kind != term_k::value || body->value->type.kind
+    != type_k::lambda;
+}
+
 std::vector<std::string> get_evaluatable_top_level_functions(const term_t
     *const term) {
   std::vector<std::string> fs;
   for (const term_t *term : *term->program.terms) {
-    if (term->kind != term_k::definition)
-      continue;
-    term_t *main_lam = term->definition.body;
-    if (main_lam->kind != term_k::value)
-      continue;
-    if (main_lam->value->type.kind != type_k::lambda)
-      continue;
-    value_t *lam_freq = main_lam->value;
-    term_t *lam_time_term = lam_freq->lambda.body;
-    if (lam_time_term->kind != term_k::value)
-      continue;
-    if (lam_time_term->value->type.kind != type_k::lambda)
+    if (!is_evaluatable_definition(term))
       continue;
     std::string def = *term->definition.name;
     if (std::find(fs.begin(), fs.end(), def) == fs.end())
@@ -292,7 +423,7 @@ std::vector<std::string> get_evaluatable_top_level_functions(const term_t
   return fs;
 }
 
-void validate_top_level_functions(const term_t *const term
+void validate_top_level_functions(term_t *term
     , std::vector<message_t> *messages) {
   if (term->kind != term_k::program) {
     messages->push_back({ message_k::error, "program parsing error" });
@@ -319,6 +450,212 @@ void validate_top_level_functions(const term_t *const term
   // if (function_occurence_counter.find("main")
   //     == function_occurence_counter.end())
   //   messages->push_back({ message_k::error, "no main function" });
+
+  infer_types(term, messages);
+}
+
+// names bound by enclosing lambdas and lets, innermost last. slot of a name is
+// its index in the frame, and later bindings of the same name shadow earlier
+typedef std::vector<std::vector<const std::string*>> resolution_frames_t;
+
+static void resolve_rec(term_t *term, const term_t *const program
+    , resolution_frames_t *frames) {
+  switch (term->kind) {
+    case term_k::program:
+      for (term_t *tl_term : *term->program.terms)
+        resolve_rec(tl_term, program, frames);
+      break;
+    case term_k::definition:
+      resolve_rec(term->definition.body, program, frames);
+      break;
+    case term_k::application:
+      resolve_rec(term->application.lambda, program, frames);
+      resolve_rec(term->application.parameter, program, frames);
+      break;
+    case term_k::identifier: {
+      const std::string &name = *term->identifier.name;
+      for (size_t depth = 0; depth < frames->size(); ++depth) {
+        const std::vector<const std::string*> &frame
+          = frames->at(frames->size() - 1 - depth);
+        for (size_t slot = frame.size(); slot-- > 0; )
+          if (*frame[slot] == name) {
+            term->identifier.resolution = resolution_k::local;
+            term->identifier.local.depth = depth;
+            term->identifier.local.slot = slot;
+            return;
+          }
+      }
+      if (name == "pi") {
+        term->identifier.resolution = resolution_k::constant;
+        term->identifier.constant = M_PI;
+        return;
+      }
+      term->identifier.resolution = resolution_k::unresolved;
+      for (const term_t *const tl_term : *program->program.terms)
+        if (tl_term->kind == term_k::definition
+            && *tl_term->definition.name == name) {
+          term->identifier.resolution = resolution_k::definition;
+          term->identifier.definition = tl_term;
+        }
+      break;
+    }
+    case term_k::case_of:
+      resolve_rec(term->case_of.value, program, frames);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          resolve_rec(statement.value, program, frames);
+        resolve_rec(statement.result, program, frames);
+      }
+      break;
+    case term_k::if_else:
+      resolve_rec(term->if_else.condition, program, frames);
+      resolve_rec(term->if_else.then_expr, program, frames);
+      resolve_rec(term->if_else.else_expr, program, frames);
+      break;
+    case term_k::let_in:
+      // every binding sees all of them, itself included
+      frames->push_back({});
+      for (term_t *definition : *term->let_in.definitions)
+        frames->back().push_back(definition->definition.name);
+      for (term_t *definition : *term->let_in.definitions)
+        resolve_rec(definition, program, frames);
+      resolve_rec(term->let_in.body, program, frames);
+      frames->pop_back();
+      break;
+    case term_k::value: {
+      if (term->value->type.kind != type_k::lambda)
+        break;
+      // "\x . \y . body" binds x and y in one frame
+      value_t *lambda = term->value;
+      term_t *body = term;
+      frames->push_back({});
+      while (body->kind == term_k::value
+          && body->value->type.kind == type_k::lambda) {
+        frames->back().push_back(body->value->lambda.arg);
+        body = body->value->lambda.body;
+      }
+      lambda->lambda.arity = frames->back().size();
+      lambda->lambda.inner_body = body;
+      resolve_rec(body, program, frames);
+      frames->pop_back();
+      break;
+    }
+    case term_k::unary_op:
+      resolve_rec(term->unary_op.x, program, frames);
+      break;
+    case term_k::binary_op:
+      resolve_rec(term->binary_op.x, program, frames);
+      resolve_rec(term->binary_op.y, program, frames);
+      break;
+    default:
+      break;
+  }
+}
+
+void resolve_identifiers(term_t *program) {
+  resolution_frames_t frames;
+  resolve_rec(program, program, &frames);
+}
+
+// marks bindings of the frame depth frames out of term that term refers to
+static void mark_references(const term_t *const term, uint32_t depth
+    , std::vector<bool> *refers) {
+  switch (term->kind) {
+    case term_k::application:
+      mark_references(term->application.lambda, depth, refers);
+      mark_references(term->application.parameter, depth, refers);
+      break;
+    case term_k::identifier:
+      if (term->identifier.resolution == resolution_k::local
+          && term->identifier.local.depth == depth)
+        refers->at(term->identifier.local.slot) = true;
+      break;
+    case term_k::case_of:
+      mark_references(term->case_of.value, depth, refers);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          mark_references(statement.value, depth, refers);
+        mark_references(statement.result, depth, refers);
+      }
+      break;
+    case term_k::if_else:
+      mark_references(term->if_else.condition, depth, refers);
+      mark_references(term->if_else.then_expr, depth, refers);
+      mark_references(term->if_else.else_expr, depth, refers);
+      break;
+    case term_k::let_in:
+      for (const term_t *const definition : *term->let_in.definitions)
+        mark_references(definition->definition.body, depth + 1, refers);
+      mark_references(term->let_in.body, depth + 1, refers);
+      break;
+    case term_k::value:
+      if (term->value->type.kind == type_k::lambda)
+        mark_references(term->value->lambda.inner_body, depth + 1, refers);
+      break;
+    case term_k::unary_op:
+      mark_references(term->unary_op.x, depth, refers);
+      break;
+    case term_k::binary_op:
+      mark_references(term->binary_op.x, depth, refers);
+      mark_references(term->binary_op.y, depth, refers);
+      break;
+    default:
+      break;
+  }
+}
+
+// tarjan's algorithm, which finds strongly connected components of the graph
+// of references after all components they refer to
+struct binding_groups_t {
+  std::vector<std::vector<bool>> refers;
+  std::vector<size_t> index, lowest, stack;
+  std::vector<bool> on_stack;
+  size_t num_visited;
+  std::vector<std::vector<size_t>> groups;
+};
+
+static void visit_binding(binding_groups_t *g, size_t i) {
+  g->index[i] = g->lowest[i] = g->num_visited++;
+  g->stack.push_back(i);
+  g->on_stack[i] = true;
+  for (size_t j = 0; j < g->refers[i].size(); ++j) {
+    if (!g->refers[i][j])
+      continue;
+    if (g->index[j] == SIZE_MAX) {
+      visit_binding(g, j);
+      g->lowest[i] = std::min(g->lowest[i], g->lowest[j]);
+    } else if (g->on_stack[j])
+      g->lowest[i] = std::min(g->lowest[i], g->index[j]);
+  }
+  if (g->lowest[i] != g->index[i])
+    return;
+  std::vector<size_t> group;
+  size_t j;
+  do {
+    j = g->stack.back();
+    g->stack.pop_back();
+    g->on_stack[j] = false;
+    group.push_back(j);
+  } while (j != i);
+  std::sort(group.begin(), group.end());
+  g->groups.push_back(group);
+}
+
+std::vector<std::vector<size_t>> let_binding_groups(const term_t *let) {
+  const std::vector<term_t*> &definitions = *let->let_in.definitions;
+  const size_t n = definitions.size();
+  binding_groups_t g;
+  g.refers.assign(n, std::vector<bool>(n, false));
+  for (size_t i = 0; i < n; ++i)
+    mark_references(definitions[i]->definition.body, 0, &g.refers[i]);
+  g.index.assign(n, SIZE_MAX);
+  g.lowest.assign(n, 0);
+  g.on_stack.assign(n, false);
+  g.num_visited = 0;
+  for (size_t i = 0; i < n; ++i)
+    if (g.index[i] == SIZE_MAX)
+      visit_binding(&g, i);
+  return g.groups;
 }
 
 builtin_t* builtin_unary(builtin_k kind) {
@@ -330,7 +667,6 @@ builtin_t* builtin_unary(builtin_k kind) {
 builtin_t* builtin_binary(builtin_k kind) {
   builtin_t *b = new builtin_t;
   b->kind = kind;
-  b->binary_op.x = nullptr;
   return b;
 }
 
@@ -349,6 +685,9 @@ value_t* value_lambda(const std::string &arg, term_t *body) {
   value->type.lambda.returns = nullptr;
   value->lambda.arg = new std::string(arg);
   value->lambda.body = body;
+  value->lambda.arity = 1;
+  value->lambda.inner_body = body;
+  value->lambda.env = nullptr;
   return value;
 }
 
@@ -366,7 +705,6 @@ term_t* term_program(std::vector<term_t*> *terms) {
   for (term_t *term : *t->program.terms)
     term->parent = t;
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
@@ -377,7 +715,6 @@ term_t* term_definition(const std::string &name, term_t *body) {
   t->definition.body = body;
   t->definition.body->parent = t;
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
@@ -389,7 +726,6 @@ term_t* term_application(term_t *lambda, term_t *parameter) {
   t->application.lambda->parent = t;
   t->application.parameter->parent = t;
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
@@ -397,8 +733,8 @@ term_t* term_identifier(const std::string &name) {
   term_t *t = new term_t;
   t->kind = term_k::identifier;
   t->identifier.name = new std::string(name);
+  t->identifier.resolution = resolution_k::unresolved;
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
@@ -415,7 +751,6 @@ term_t* term_case_of(term_t *value
     statement.result->parent = t;
   }
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
@@ -429,7 +764,6 @@ term_t* term_if_else(term_t *condition, term_t *then_expr, term_t *else_expr) {
   t->if_else.then_expr->parent = t;
   t->if_else.else_expr->parent = t;
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
@@ -442,7 +776,6 @@ term_t* term_let_in(std::vector<term_t*> *definitions, term_t *body) {
   t->let_in.body = body;
   t->let_in.body->parent = t;
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
@@ -453,7 +786,130 @@ term_t* term_value(value_t *value) {
   if (value->type.kind == type_k::lambda)
     t->value->lambda.body->parent = t;
   t->parent = nullptr;
-  t->scope = nullptr;
   return t;
 }
 
+term_t* term_unary_op(builtin_k kind, term_t *x) {
+  term_t *t = new term_t;
+  t->kind = term_k::unary_op;
+  t->unary_op.kind = kind;
+  t->unary_op.x = x;
+  t->unary_op.typed = false;
+  t->unary_op.x->parent = t;
+  t->parent = nullptr;
+  return t;
+}
+
+term_t* term_binary_op(builtin_k kind, term_t *x, term_t *y) {
+  term_t *t = new term_t;
+  t->kind = term_k::binary_op;
+  t->binary_op.kind = kind;
+  t->binary_op.x = x;
+  t->binary_op.y = y;
+  t->binary_op.typed = false;
+  t->binary_op.x->parent = t;
+  t->binary_op.y->parent = t;
+  t->parent = nullptr;
+  return t;
+}
+
+term_t* term_applications(const std::vector<term_t*> &terms) {
+  term_t *p = terms.at(0);
+  size_t i = 1;
+  if (p->kind == term_k::value && p->value->type.kind == type_k::builtin) {
+    const builtin_k kind = p->value->builtin->kind;
+    if (!builtin_is_binary(kind) && terms.size() >= 2) {
+      delete p;
+      p = term_unary_op(kind, terms[1]);
+      i = 2;
+    } else if (builtin_is_binary(kind) && terms.size() >= 3) {
+      delete p;
+      p = term_binary_op(kind, terms[1], terms[2]);
+      i = 3;
+    }
+  }
+  for (; i < terms.size(); ++i)
+    p = term_application(p, terms[i]);
+  return p;
+}
+
+value_t* value_copy(const value_t *const value) {
+  switch (value->type.kind) {
+    case type_k::number:
+      return value_number(value->number);
+    case type_k::lambda: {
+      value_t *copy = value_lambda(*value->lambda.arg
+          , term_copy(value->lambda.body));
+      copy->type.lambda.takes = type_copy(value->type.lambda.takes);
+      copy->type.lambda.returns = type_copy(value->type.lambda.returns);
+      copy->lambda.arity = value->lambda.arity;
+      copy->lambda.inner_body = copy->lambda.body;
+      for (uint32_t i = 1; i < copy->lambda.arity; ++i)
+        copy->lambda.inner_body = copy->lambda.inner_body->value->lambda.body;
+      return copy;
+    }
+    case type_k::builtin:
+      return value_builtin(new builtin_t(*value->builtin));
+    default:
+      die("unexpected value type <%s>", type_to_string(&value->type).c_str());
+  }
+}
+
+term_t* term_copy(const term_t *const term) {
+  switch (term->kind) {
+    case term_k::program: {
+      std::vector<term_t*> *terms = new std::vector<term_t*>;
+      for (const term_t *const tl_term : *term->program.terms)
+        terms->push_back(term_copy(tl_term));
+      return term_program(terms);
+    }
+    case term_k::definition:
+      return term_definition(*term->definition.name
+          , term_copy(term->definition.body));
+    case term_k::application:
+      return term_application(term_copy(term->application.lambda)
+          , term_copy(term->application.parameter));
+    case term_k::identifier: {
+      term_t *copy = term_identifier(*term->identifier.name);
+      std::string *name = copy->identifier.name;
+      copy->identifier = term->identifier;
+      copy->identifier.name = name;
+      return copy;
+    }
+    case term_k::case_of: {
+      std::vector<term_t::case_statement> *statements
+        = new std::vector<term_t::case_statement>;
+      for (const term_t::case_statement &statement : *term->case_of.statements)
+        statements->push_back({
+            statement.value ? term_copy(statement.value) : nullptr
+            , term_copy(statement.result) });
+      return term_case_of(term_copy(term->case_of.value), statements);
+    }
+    case term_k::if_else:
+      return term_if_else(term_copy(term->if_else.condition)
+          , term_copy(term->if_else.then_expr)
+          , term_copy(term->if_else.else_expr));
+    case term_k::let_in: {
+      std::vector<term_t*> *definitions = new std::vector<term_t*>;
+      for (const term_t *const definition : *term->let_in.definitions)
+        definitions->push_back(term_copy(definition));
+      return term_let_in(definitions, term_copy(term->let_in.body));
+    }
+    case term_k::value:
+      return term_value(value_copy(term->value));
+    case term_k::unary_op: {
+      term_t *copy = term_unary_op(term->unary_op.kind
+          , term_copy(term->unary_op.x));
+      copy->unary_op.typed = term->unary_op.typed;
+      return copy;
+    }
+    case term_k::binary_op: {
+      term_t *copy = term_binary_op(term->binary_op.kind
+          , term_copy(term->binary_op.x), term_copy(term->binary_op.y));
+      copy->binary_op.typed = term->binary_op.typed;
+      return copy;
+    }
+    default:
+      die("unexpected term kind <%s>", term_kind_to_string(term->kind).c_str());
+  }
+}
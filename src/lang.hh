@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
 #include <vector>
@@ -7,7 +8,10 @@
 enum class type_k {
   number,
   lambda,
-  builtin
+  builtin,
+  partial, // made during evaluation only
+  thunk, // let binding not evaluated yet, in frames of the tree walker only
+  variable // in inferred types, see infer_types()
 };
 
 struct type_t {
@@ -16,12 +20,17 @@ struct type_t {
     struct {
       type_t *takes, *returns;
     } lambda;
+    uint32_t variable; // index among variables of one definition
   };
+  ~type_t();
 };
 
 std::string type_to_string(const type_t *const type);
+type_t* type_copy(const type_t *const type);
 
 struct term_t;
+struct value_t;
+struct frame_t; // see eval.cc
 
 enum class builtin_k {
   sin,
@@ -44,19 +53,18 @@ enum class builtin_k {
   floor,
   round,
   ceil,
-  sqrt
+  sqrt,
+  // identity, marks values that change slowly, see compile_options_t
+  krate
 };
 
 std::string builtin_kind_to_string(builtin_k kind);
+bool builtin_is_binary(builtin_k kind);
+double builtin_apply_unary(builtin_k kind, double x);
+double builtin_apply_binary(builtin_k kind, double x, double y);
 
 struct builtin_t {
   builtin_k kind;
-  union {
-    struct {
-      term_t *x; // can be null for partial application
-    } binary_op;
-  };
-  ~builtin_t();
 };
 
 struct value_t {
@@ -66,8 +74,22 @@ struct value_t {
     struct {
       std::string *arg;
       term_t *body;
+      // directly nested lambdas take their arguments at once, into one frame.
+      // for the outermost of them resolve_identifiers() sets arity to their
+      // number and inner_body to body of the innermost one
+      uint32_t arity;
+      term_t *inner_body;
+      frame_t *env; // captured during evaluation, null in source
     } lambda;
     builtin_t *builtin;
+    struct {
+      // lambda or builtin applied to fewer arguments than its arity. they are
+      // in the first num_args slots of args, which is never changed, so that
+      // partial application can be applied any number of times
+      value_t *function;
+      frame_t *args;
+      uint32_t num_args;
+    } partial;
   };
   ~value_t();
   void pretty_print() const;
@@ -81,12 +103,19 @@ enum class term_k {
   case_of,
   if_else,
   let_in,
-  value
+  value,
+  unary_op,
+  binary_op
 };
 
 std::string term_kind_to_string(term_k kind);
 
-typedef std::map<std::string, value_t*> scope_t;
+enum class resolution_k {
+  unresolved, // unknown identifier, an error if evaluated
+  local,      // argument of enclosing lambda or binding of enclosing let
+  definition, // top-level definition
+  constant    // builtin constant such as pi
+};
 
 struct term_t {
   struct case_statement {
@@ -109,6 +138,17 @@ struct term_t {
     } application;
     struct {
       std::string *name;
+      resolution_k resolution;
+      union {
+        struct {
+          // number of frames, that is lets and groups of directly nested
+          // lambdas, between identifier and its binding, and index of the
+          // binding in the latter
+          uint32_t depth, slot;
+        } local;
+        const term_t *definition;
+        double constant;
+      };
     } identifier;
     struct {
       term_t *value;
@@ -124,17 +164,33 @@ struct term_t {
       term_t *body;
     } let_in;
     value_t *value;
+    // builtins applied to all of their operands, as parsed from "x + y" and
+    // "sin x". builtins as values of their own, such as "(mult 2)", are
+    // applied through applications instead
+    // typed is set by infer_types() when operands are known to be numbers,
+    // so that they aren't checked during evaluation
+    struct {
+      builtin_k kind;
+      term_t *x;
+      bool typed;
+    } unary_op;
+    struct {
+      builtin_k kind;
+      term_t *x, *y;
+      bool typed;
+    } binary_op;
   };
 
   term_t *parent;
-  scope_t *scope;
 
   ~term_t();
-  bool lookup(const std::string &identifier, value_t *&value) const;
   void pretty_print() const;
+  // number of terms in this one, including itself and bodies of lambdas
+  size_t count_nodes() const;
 };
 
 enum class message_k {
+  note, // about how the program is run rather than about the program
   warning,
   error
 };
@@ -148,10 +204,26 @@ struct message_t {
 
 bool messages_contain_no_errors(const std::vector<message_t> &messages);
 
+// whether term is a definition of form "name f t = ...", which can be played
+bool is_evaluatable_definition(const term_t *const term);
 std::vector<std::string> get_evaluatable_top_level_functions(const term_t *const term);
-void validate_top_level_functions(const term_t *const term
+// also infers types, see infer_types()
+void validate_top_level_functions(term_t *term
     , std::vector<message_t> *messages);
 
+// binds every identifier in program to what it refers to, see resolution_k.
+// names are looked up in enclosing lambdas and lets first, then among builtin
+// constants, and then among top-level definitions, where the last one with
+// that name wins. all names bound by a let are visible in each of its
+// bindings as well as in its body, so that local helpers can be recursive
+void resolve_identifiers(term_t *program);
+
+// bindings of let that refer to each other, directly or through other
+// bindings, gathered in groups of indices. bindings of a let see all of its
+// names, so the groups are the order bindings can be given values in: each
+// group refers to no groups after it. identifiers must be resolved
+std::vector<std::vector<size_t>> let_binding_groups(const term_t *let);
+
 builtin_t* builtin_unary(builtin_k kind);
 builtin_t* builtin_binary(builtin_k kind);
 
@@ -168,4 +240,14 @@ term_t* term_case_of(term_t *value
 term_t* term_if_else(term_t *condition, term_t *then_expr, term_t *else_expr);
 term_t* term_let_in(std::vector<term_t*> *terms, term_t *body);
 term_t* term_value(value_t *value);
+term_t* term_unary_op(builtin_k kind, term_t *x);
+term_t* term_binary_op(builtin_k kind, term_t *x, term_t *y);
+// "h a1 ... an" as nested applications, except that a builtin head gets
+// applied to as many of the arguments as it takes by an operator node
+term_t* term_applications(const std::vector<term_t*> &terms);
+
+// deep copies. identifiers keep their resolution, so a copy has to be placed
+// where names it uses refer to the same bindings
+value_t* value_copy(const value_t *const value);
+term_t* term_copy(const term_t *const term);
 
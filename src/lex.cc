@@ -44,6 +44,7 @@ std::string token_kind_to_string(int kind) {
     case TK_BUILTIN_ROUND:  return "TK_BUILTIN_ROUND";
     case TK_BUILTIN_CEIL:   return "TK_BUILTIN_CEIL";
     case TK_BUILTIN_SQRT:   return "TK_BUILTIN_SQRT";
+    case TK_BUILTIN_KRATE:  return "TK_BUILTIN_KRATE";
     case TK_WORD_IF:        return "TK_WORD_IF";
     case TK_WORD_THEN:      return "TK_WORD_THEN";
     case TK_WORD_ELSE:      return "TK_WORD_ELSE";
@@ -278,6 +279,7 @@ token_t* lexer_t::next_token() {
         { "round",  TK_BUILTIN_ROUND },
         { "ceil",   TK_BUILTIN_CEIL },
         { "sqrt",   TK_BUILTIN_SQRT },
+        { "krate",  TK_BUILTIN_KRATE },
         { "let",    TK_WORD_LET },
         { "in",     TK_WORD_IN }
       };
@@ -396,6 +398,8 @@ term_t* lex_parse_string(const std::string &source) {
   lexer_t lexer(source);
   term_t *root = nullptr;
   yyparse(&lexer, &root);
+  if (root != nullptr)
+    resolve_identifiers(root);
   return root;
 }
 
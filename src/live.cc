@@ -1,12 +1,15 @@
+#include "aot.hh"
 #include "eval.hh"
 #include "live.hh"
 #include "utils.hh"
 #include "gfx.hh"
 #include "lex.hh"
+#include "optimize.hh"
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
 #include "imgui.hh"
 #include "../thirdparty/imgui/imgui.h"
+#include <algorithm>
 #include <thread>
 #include <atomic>
 #include <fstream>
@@ -17,6 +20,7 @@ void recalculate_freq_to_note();
 void compute();
 void compute_single();
 void save();
+void prepare_evaluator();
 
 struct passed_data_t {
   struct note_data_t {
@@ -26,15 +30,22 @@ struct passed_data_t {
   };
   term_t *program;
   std::string definition;
+  evaluator_t *evaluator; // null if definition is not chosen
+  evaluation_context_t *context; // of audio callback, null with evaluator
+  aot_module_t *module; // null if not running with aot
   std::map<int, note_data_t> notes; // kinda sloppy but works
   passed_data_t()
     : program(nullptr)
-    , definition("") {
+    , definition("")
+    , evaluator(nullptr)
+    , context(nullptr)
+    , module(nullptr) {
   }
 };
 
 const float sample_rate = 48000, num_computed_seconds = 2;
 const int num_computed_samples = sample_rate * num_computed_seconds + 0.5f;
+const int audio_buffer_samples = 4096, computation_block_samples = 256;
 const std::map<int, std::pair<char, int>> key_notes = {
   { SDLK_a, { 'C', 0 } },
   { SDLK_w, { 'C', 1 } },
@@ -61,21 +72,35 @@ enum class computing_status_t {
 
 static bool g_done = false, g_show_test_window = false;
 static SDL_AudioDeviceID g_dev = 0;
-static std::string g_filename = "";
+static std::string g_filename = "", g_object_filename = "";
 static char g_source[100000]; // stupid
 static passed_data_t *g_passed_data = nullptr;
+// messages about the program, followed by notes about its evaluator
 static std::vector<message_t> g_messages;
+static size_t g_num_program_messages = 0;
 static std::vector<float> g_samples;
+// most bytes tree walker allocated per sample during the last replot
+static size_t g_tree_memory_peak = 0;
 static float g_volume = 20.f, g_frequency = 55.f /* A1 */, g_seconds = 1;
 static std::string g_frequency_to_note = "";
 static int g_octave = 4;
-static bool playing = true, unsaved = false;
+static bool playing = true, unsaved = false, g_aot = false;
+static inline_options_t g_inline_options;
+static compile_options_t g_compile_options;
 static std::vector<std::string> g_definition_list;
 static int g_definition_list_selected_idx = -1;
 static float computed_samples[120][num_computed_samples]
-  , single_computed_samples[num_computed_samples];
-static double computation_progress = 0, g_time = 0, g_computation_time_started = 0;
+  , single_computed_samples[num_computed_samples]
+  , time_computed_samples[num_computed_samples]; // h of separable ones
+// rows of samples of every note. notes that sound the same share a row
+static const float *computed_rows[120];
+static double g_time = 0, g_computation_time_started = 0
+  , g_computation_speedup = 1, g_computation_error = 0;
 static std::thread *computation_thread = nullptr;
+// samples evaluated so far out of all that are being computed, updated by
+// computation workers and read by ui
+static std::atomic<uint64_t> computation_samples_done { 0 }
+  , computation_samples_total { 1 };
 static std::atomic<computing_status_t> computing_status {
   computing_status_t::not_computed };
 
@@ -111,29 +136,35 @@ static double note_idx_to_freq(int note_idx) {
 static void audio_callback(void *userdata, uint8_t *stream, int len) {
   passed_data_t *passed_data = (passed_data_t*)userdata;
   float *stream_ptr = (float*)stream;
-  for (int i = 0; i < 4096; ++i) {
-    *stream_ptr = 0;
-    if (passed_data->definition == ""
-        || computing_status == computing_status_t::computing) {
-      ++stream_ptr;
+  static float note_samples[audio_buffer_samples];
+  for (int i = 0; i < audio_buffer_samples; ++i)
+    stream_ptr[i] = 0;
+  if (passed_data->context == nullptr
+      || computing_status == computing_status_t::computing)
+    return;
+  bool computed = computing_status == computing_status_t::computed
+    || computing_status == computing_status_t::single_computed;
+  for (auto &freq_pair : passed_data->notes) {
+    if (!freq_pair.second.on)
+      continue;
+    uint64_t &c = freq_pair.second.c;
+    if (computed) {
+      for (int i = 0; i < audio_buffer_samples; ++i) {
+        stream_ptr[i] += g_volume / 100.f * computed_rows[freq_pair.first][c];
+        if (c < num_computed_samples - 1)
+          ++c;
+      }
       continue;
     }
-    for (auto &freq_pair : passed_data->notes) {
-      if (!freq_pair.second.on)
-        continue;
-      if (computing_status == computing_status_t::computed
-          || computing_status == computing_status_t::single_computed)
-        *stream_ptr += g_volume / 100.f
-          * computed_samples[freq_pair.first][freq_pair.second.c];
-      else
-        *stream_ptr += g_volume / 100.f
-          * (float)evaluate_definition(passed_data->program
-          , passed_data->definition, note_idx_to_freq(freq_pair.first)
-          , (float)(freq_pair.second.c) / sample_rate);
-      if (freq_pair.second.c < num_computed_samples - 1)
-        ++freq_pair.second.c;
-    }
-    ++stream_ptr;
+    // notes are held at their last sample once they run out
+    int num_evaluated = std::min<uint64_t>(audio_buffer_samples
+        , num_computed_samples - c);
+    passed_data->context->eval_block(note_idx_to_freq(freq_pair.first), c
+        , sample_rate, note_samples, num_evaluated);
+    for (int i = 0; i < audio_buffer_samples; ++i)
+      stream_ptr[i] += g_volume / 100.f
+        * note_samples[std::min(i, num_evaluated - 1)];
+    c = std::min<uint64_t>(c + audio_buffer_samples, num_computed_samples - 1);
   }
 }
 
@@ -147,7 +178,7 @@ static void init() {
   want.freq = sample_rate;
   want.format = AUDIO_F32;
   want.channels = 1;
-  want.samples = 4096;
+  want.samples = audio_buffer_samples;
   want.callback = audio_callback;
   want.userdata = (void*)g_passed_data;
   g_dev = SDL_OpenAudioDevice(nullptr, 0, &want, &have, SDL_AUDIO_ALLOW_ANY_CHANGE);
@@ -263,13 +294,16 @@ static void draw_gui() {
         }
         ImGui::SameLine();
         static char buf[32];
-        sprintf(buf, "%.2f%%", (double)computation_progress * 100.);
-        ImGui::ProgressBar(computation_progress, ImVec2(io.DisplaySize.x / 2.f
+        static double progress;
+        progress = (double)computation_samples_done
+          / (double)computation_samples_total;
+        sprintf(buf, "%.2f%%", progress * 100.);
+        ImGui::ProgressBar(progress, ImVec2(io.DisplaySize.x / 2.f
               - padding * 1.5f - 300, 0), buf);
-        if (computation_progress > 0) {
+        if (progress > 0) {
           ImGui::SameLine();
           double s = ((g_time - g_computation_time_started)
-              * (1. - computation_progress)) / computation_progress;
+              * (1. - progress)) / progress;
           int m = s / 60.;
           if (s > 60)
             ImGui::Text("ETA %dm %.2fs", m, s - m * 60.);
@@ -278,7 +312,12 @@ static void draw_gui() {
         }
         break;
       case computing_status_t::computed:
-        ImGui::Text("[Computed]");
+        if (g_computation_speedup > 1)
+          ImGui::Text("[Computed, %.2fx fewer samples evaluated"
+              ", error at most %g]", g_computation_speedup
+              , g_computation_error);
+        else
+          ImGui::Text("[Computed]");
         break;
       default: die("halt and catch fire");
     }
@@ -370,6 +409,7 @@ static void draw_gui() {
   if (ImGui::Combo("definitions", &g_definition_list_selected_idx
       , definition_list_getter, &g_definition_list, g_definition_list.size(), 8)) {
     g_passed_data->definition = g_definition_list[g_definition_list_selected_idx];
+    prepare_evaluator();
     computing_status = computing_status_t::not_computed;
   }
 
@@ -377,6 +417,13 @@ static void draw_gui() {
     ImGui::PlotLines("", g_samples.data(), g_samples.size(), 0
         , g_passed_data->definition.c_str(), -1.f, 1.f
         , ImVec2(ImGui::GetContentRegionAvailWidth(), 200));
+  if (g_tree_memory_peak != 0)
+    ImGui::Text("Tree walker used at most %zu bytes per sample"
+        , g_tree_memory_peak);
+
+  for (const message_t &message : g_messages)
+    ImGui::TextWrapped("%s: %s", message_kind_to_string(message.kind).c_str()
+        , message.content.c_str());
 
   ImGui::End();
 }
@@ -414,35 +461,138 @@ void save() {
   outs.close();
 }
 
+// computation thread has a context of the current evaluator, so it must be
+// finished before the evaluator is replaced
+static void stop_computation() {
+  if (computation_thread == nullptr)
+    return;
+  if (computing_status == computing_status_t::computing)
+    computing_status = computing_status_t::stopped;
+  computation_thread->join();
+  delete computation_thread;
+  computation_thread = nullptr;
+}
+
+// the audio callback evaluates with the evaluator, so it only has to wait
+// while it's swapped for another one. the old one is returned to be deleted
+// after that
+static void swap_evaluator(evaluator_t **evaluator
+    , evaluation_context_t **context) {
+  SDL_LockAudioDevice(g_dev);
+  std::swap(g_passed_data->evaluator, *evaluator);
+  std::swap(g_passed_data->context, *context);
+  SDL_UnlockAudioDevice(g_dev);
+}
+
+static void delete_evaluator(evaluator_t *evaluator
+    , evaluation_context_t *context) {
+  if (context)
+    delete context;
+  if (evaluator)
+    delete evaluator;
+}
+
+void prepare_evaluator() {
+  stop_computation();
+  g_messages.resize(g_num_program_messages);
+  g_tree_memory_peak = 0;
+  evaluator_t *evaluator = nullptr;
+  evaluation_context_t *context = nullptr;
+  if (g_passed_data->definition != "") {
+    evaluator = new evaluator_t(g_passed_data->program
+        , g_passed_data->definition, evaluation_tier_k::aot
+        , g_passed_data->module, g_compile_options);
+    context = new evaluation_context_t(evaluator);
+    g_messages.push_back({ message_k::note, "evaluating \""
+        + g_passed_data->definition + "\" using "
+        + evaluation_tier_kind_to_string(evaluator->tier()) + " tier" });
+    if (evaluator->fallback_reason() != "")
+      g_messages.push_back({ message_k::note, "fallback reason: "
+          + evaluator->fallback_reason() });
+  }
+  swap_evaluator(&evaluator, &context);
+  delete_evaluator(evaluator, context);
+}
+
+// the new program is parsed, optimized and compiled while the old one goes
+// on playing, which matters most when the compiler is run for aot
 void reload_file() {
-  if (g_passed_data->program)
-    delete g_passed_data->program;
-  g_messages.clear();
+  stop_computation();
+  std::vector<message_t> messages;
 
   std::string source = read_file(g_filename);
   strncpy(g_source, source.c_str(), sizeof(g_source));
 
-  g_passed_data->program = lex_parse_string(g_source);
-  if (!g_passed_data->program)
+  term_t *program = lex_parse_string(g_source);
+  if (!program)
     exit(1);
 
-  g_passed_data->program->pretty_print();
+  size_t num_nodes = program->count_nodes();
+  optimize_program(program, g_inline_options);
+  program->pretty_print();
+  messages.push_back({ message_k::note, "optimization: "
+      + std::to_string(num_nodes) + " -> "
+      + std::to_string(program->count_nodes()) + " nodes" });
+
+  aot_module_t *module = nullptr;
+  if (g_aot || g_object_filename != "") {
+    std::string error;
+    bool loaded;
+    module = new aot_module_t;
+    if (g_object_filename != "")
+      loaded = module->load(g_object_filename
+          , aot_hash_source(source, g_compile_options, g_inline_options)
+          , &error);
+    else
+      loaded = aot_load_cached(source, program, g_compile_options
+          , g_inline_options, module, &messages, &error);
+    if (!loaded) {
+      messages.push_back({ message_k::warning
+          , "failed to load compiled object: " + error });
+      delete module;
+      module = nullptr;
+    }
+  }
 
-  validate_top_level_functions(g_passed_data->program, &g_messages);
-  // for (const message_t &message : messages)
-  //   printf("%s: %s\n", message_kind_to_string(message.kind).c_str()
-  //       , message.content.c_str());
+  validate_top_level_functions(program, &messages);
+
+  // evaluator of the old program is taken out of the audio callback before
+  // the program and module it uses are deleted
+  evaluator_t *evaluator = nullptr;
+  evaluation_context_t *context = nullptr;
+  swap_evaluator(&evaluator, &context);
+  delete_evaluator(evaluator, context);
+  std::swap(g_passed_data->program, program);
+  std::swap(g_passed_data->module, module);
+  if (module)
+    delete module;
+  if (program)
+    delete program;
+  g_messages = messages;
+  // notes are only shown in the ui
+  for (const message_t &message : g_messages)
+    if (message.kind != message_k::note)
+      printf("%s: %s\n", message_kind_to_string(message.kind).c_str()
+          , message.content.c_str());
+  g_num_program_messages = g_messages.size();
 
   g_definition_list = get_evaluatable_top_level_functions(g_passed_data->program);
+  auto definition_it = std::find(g_definition_list.begin()
+      , g_definition_list.end(), g_passed_data->definition);
+  if (definition_it == g_definition_list.end()) {
+    g_passed_data->definition = "";
+    g_definition_list_selected_idx = -1;
+  } else
+    g_definition_list_selected_idx = definition_it - g_definition_list.begin();
+  prepare_evaluator();
 }
 
 void replot() {
-  g_samples.clear();
-  const float amplitude = 32760, scale = 1.f;
-  for (uint64_t i = 0; i < (uint64_t)(sample_rate * g_seconds + 0.5f); i++)
-    g_samples.push_back((float)evaluate_definition(g_passed_data->program
-          , g_passed_data->definition, g_frequency
-          , (double)i / (double)sample_rate) * scale);
+  evaluation_context_t context(g_passed_data->evaluator);
+  g_samples.resize((uint64_t)(sample_rate * g_seconds + 0.5f));
+  context.eval_block(g_frequency, 0, sample_rate, g_samples.data()
+      , g_samples.size());
+  g_tree_memory_peak = context.tree_memory_peak();
 
   recalculate_freq_to_note();
 }
@@ -508,6 +658,44 @@ void recalculate_freq_to_note() {
   }
 }
 
+// evaluates samples [begin, end) of notes with given frequencies into rows of
+// out with evaluator. the work is split into tiles of computation_block_samples samples of
+// all notes, so that values depending on time alone are shared between them.
+// tiles are handed out to a worker per hardware thread, each with evaluation
+// context of its own. workers check for stop before every tile, so stopping
+// takes at most one tile. returns false if computation was stopped
+static bool compute_notes(const evaluator_t *evaluator
+    , const double *frequencies, int num_notes, int begin, int end
+    , float (*out)[num_computed_samples]) {
+  const int num_tiles = (end - begin + computation_block_samples - 1)
+    / computation_block_samples;
+  std::atomic<int> next_tile { 0 };
+  auto worker = [&]() {
+    evaluation_context_t context(evaluator);
+    while (computing_status != computing_status_t::stopped) {
+      int tile = next_tile++;
+      if (tile >= num_tiles)
+        break;
+      int t = begin + tile * computation_block_samples
+        , n = std::min(computation_block_samples, end - t);
+      float *tile_rows[120];
+      for (int i = 0; i < num_notes; ++i)
+        tile_rows[i] = &out[i][t];
+      context.eval_notes(frequencies, num_notes, t, sample_rate, tile_rows, n);
+      computation_samples_done += (uint64_t)n * num_notes;
+    }
+  };
+  int num_workers = std::min<int>(std::max(std::thread::hardware_concurrency()
+        , 1u), num_tiles);
+  std::vector<std::thread> workers;
+  for (int i = 1; i < num_workers; ++i)
+    workers.emplace_back(worker);
+  worker();
+  for (std::thread &w : workers)
+    w.join();
+  return computing_status != computing_status_t::stopped;
+}
+
 void compute() {
   if (computing_status == computing_status_t::stopped) {
     computing_status = computing_status_t::not_computed;
@@ -516,20 +704,84 @@ void compute() {
   computing_status = computing_status_t::computing;
   g_computation_time_started = g_time;
 
-  computation_progress = 0;
-  const double progress_change = 1. / 10. / 12. / (double)num_computed_samples;
-  for (int i = 0; i < 120; ++i) {
-    float f = note_idx_to_freq(i);
-    for (int t = 0; t < num_computed_samples; ++t) {
-      if (computing_status == computing_status_t::stopped) {
-        computing_status = computing_status_t::not_computed;
-        return;
-      }
-      computed_samples[i][t] = evaluate_definition(g_passed_data->program
-          , g_passed_data->definition, f, (double)t / (double)sample_rate);
-      computation_progress += progress_change;
+  // a definition that doesn't depend on f sounds the same for every note
+  int num_notes = g_passed_data->evaluator->uses_f() ? 120 : 1;
+  double frequencies[120];
+  for (int i = 0; i < num_notes; ++i)
+    frequencies[i] = note_idx_to_freq(i);
+  // a definition that depends on f and t only through f * t gives a note the
+  // samples of the note an octave below at every other sample, bit for bit,
+  // so that only the lowest octave is evaluated in full. that relies on
+  // frequencies of octaves being exact multiples of each other, and on
+  // evaluation without recurrences, see bytecode_t::phase_only. a separable
+  // one g(f * t) * h(t) is computed as octaves of g times a row of h shared
+  // by all notes. an object is built with the same options as the
+  // evaluator, so those are evaluated by native code at most
+  const evaluator_t *evaluator = g_passed_data->evaluator;
+  const bool separable = evaluator->separable();
+  bool derive_octaves = num_notes == 120
+    && (evaluator->phase_only() || separable);
+  for (int i = 12; i < num_notes; ++i)
+    derive_octaves &= frequencies[i] == 2 * frequencies[i - 12];
+  evaluator_t *phase_evaluator = nullptr, *time_evaluator = nullptr;
+  if (derive_octaves && (g_compile_options.recurrences || separable)) {
+    const evaluation_tier_k max_tier = std::min(evaluator->tier()
+        , evaluation_tier_k::native);
+    compile_options_t options = g_compile_options;
+    options.recurrences = false;
+    if (separable) {
+      options.factor = factor_k::time;
+      time_evaluator = new evaluator_t(g_passed_data->program
+          , g_passed_data->definition, max_tier, nullptr, options);
+      options.factor = factor_k::phase;
     }
+    phase_evaluator = new evaluator_t(g_passed_data->program
+        , g_passed_data->definition, max_tier, nullptr, options);
+    evaluator = phase_evaluator;
+    derive_octaves = evaluator->phase_only() && (!separable
+        || time_evaluator->tier() != evaluation_tier_k::tree);
+    if (!derive_octaves)
+      evaluator = g_passed_data->evaluator;
   }
+  const bool multiply = derive_octaves && separable;
+  const int half = (num_computed_samples + 1) / 2;
+  computation_samples_done = 0;
+  computation_samples_total = (uint64_t)num_notes * num_computed_samples;
+  if (derive_octaves)
+    computation_samples_total -= (uint64_t)(num_notes - 12) * half;
+  if (multiply)
+    computation_samples_total += num_computed_samples;
+  const bool computed = (!derive_octaves || compute_notes(evaluator
+        , frequencies, 12, 0, half, computed_samples))
+    && compute_notes(evaluator, frequencies, num_notes
+        , derive_octaves ? half : 0, num_computed_samples, computed_samples)
+    && (!multiply || compute_notes(time_evaluator, frequencies, 1, 0
+          , num_computed_samples, &time_computed_samples));
+  delete phase_evaluator;
+  delete time_evaluator;
+  if (!computed) {
+    computing_status = computing_status_t::not_computed;
+    return;
+  }
+  if (derive_octaves)
+    for (int i = 12; i < num_notes; ++i)
+      for (int t = 0; t < half; ++t)
+        computed_samples[i][t] = computed_samples[i - 12][2 * t];
+  // copied samples are the ones their notes would evaluate to, bit for bit.
+  // a product of g and h, each rounded to float, is within 4 roundings of
+  // what the definition gives, so within 2^-21 of the sample itself
+  g_computation_error = 0;
+  if (multiply)
+    for (int i = 0; i < num_notes; ++i)
+      for (int t = 0; t < num_computed_samples; ++t) {
+        computed_samples[i][t] *= time_computed_samples[t];
+        g_computation_error = std::max<double>(g_computation_error
+            , ldexp(fabs(computed_samples[i][t]), -21));
+      }
+  for (int i = 0; i < 120; ++i)
+    computed_rows[i] = computed_samples[num_notes == 1 ? 0 : i];
+  g_computation_speedup = 120. * num_computed_samples
+    / computation_samples_total;
 
   computing_status = computing_status_t::computed;
 }
@@ -542,22 +794,17 @@ void compute_single() {
   computing_status = computing_status_t::computing;
   g_computation_time_started = g_time;
 
-  computation_progress = 0;
-  const double progress_change = 1. / (double)num_computed_samples;
-  float f = note_idx_to_freq(note_details_to_note_idx('A', 4, 0));
-  for (int t = 0; t < num_computed_samples; ++t) {
-    if (computing_status == computing_status_t::stopped) {
-      computing_status = computing_status_t::not_computed;
-      return;
-    }
-    single_computed_samples[t] = evaluate_definition(g_passed_data->program
-        , g_passed_data->definition, f, (double)t / (double)sample_rate);
-    computation_progress += progress_change;
+  double f = note_idx_to_freq(note_details_to_note_idx('A', 4, 0));
+  computation_samples_done = 0;
+  computation_samples_total = num_computed_samples;
+  if (!compute_notes(g_passed_data->evaluator, &f, 1, 0, num_computed_samples
+        , &single_computed_samples)) {
+    computing_status = computing_status_t::not_computed;
+    return;
   }
 
   for (int i = 0; i < 120; ++i)
-    for (int t = 0; t < num_computed_samples; ++t)
-      computed_samples[i][t] = single_computed_samples[t];
+    computed_rows[i] = single_computed_samples;
 
   computing_status = computing_status_t::single_computed;
 
@@ -569,8 +816,15 @@ void compute_single() {
   recalculate_freq_to_note();
 }
 
-void live(const std::string &filename) {
+void live(const std::string &filename, bool aot
+    , const std::string &object_filename
+    , const inline_options_t &inline_options
+    , const compile_options_t &compile_options) {
   g_filename = filename;
+  g_aot = aot;
+  g_object_filename = object_filename;
+  g_inline_options = inline_options;
+  g_compile_options = compile_options;
 
   g_passed_data = new passed_data_t;
   reload_file();
@@ -580,6 +834,10 @@ void live(const std::string &filename) {
 
   gfx_main_loop(&g_done, init, frame, update, key_event, destroy);
 
+  stop_computation();
+  delete_evaluator(g_passed_data->evaluator, g_passed_data->context);
+  if (g_passed_data->module)
+    delete g_passed_data->module;
   if (g_passed_data->program)
     delete g_passed_data->program;
 }
@@ -1,7 +1,18 @@
 #pragma once
 
+#include "compile.hh"
 #include "lang.hh"
+#include "optimize.hh"
 #include <string>
 
-void live(const std::string &filename);
+// if aot is set, definitions are compiled into a cached shared object on each
+// reload, see aot.hh. if object_filename isn't empty, definitions are loaded
+// from that object instead, as long as it was built from the current source
+// with the same options. programs are optimized with inline_options on each
+// reload before anything else is done with them, and definitions are
+// compiled with compile_options
+void live(const std::string &filename, bool aot
+    , const std::string &object_filename
+    , const inline_options_t &inline_options
+    , const compile_options_t &compile_options);
 
@@ -1,54 +1,144 @@
+#include "aot.hh"
 #include "eval.hh"
 #include "lang.hh"
 #include "lex.hh"
 #include "live.hh"
+#include "optimize.hh"
 #include "utils.hh"
 #include "wav_writer.hh"
 #include "../thirdparty/clipp/clipp.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
 int main(int argc, char **argv) {
-  std::string filename = "", seq_filename = "";
-  bool seq = false;
+  std::string filename = "", seq_filename = "", object_filename = ""
+    , load_filename = "";
+  bool seq = false, compile = false, aot = false, exact = false;
+  inline_options_t inline_options;
+  compile_options_t compile_options;
 
-  auto cli = (clipp::value("source file name", filename),
+  auto cli = (clipp::value("source file name", filename).blocking(false),
       clipp::option("--seq", "-s").set(seq).doc("sequence mode")
-      & clipp::value("sequence file", seq_filename));
+      & clipp::value("sequence file", seq_filename),
+      clipp::option("--compile", "-c").set(compile)
+      .doc("compile definitions into a shared object given by -o and exit"),
+      clipp::option("-o") & clipp::value("object file", object_filename),
+      clipp::option("--aot", "-a").set(aot)
+      .doc("use definitions compiled ahead of time, caching the object"),
+      clipp::option("--load", "-l")
+      .doc("use definitions from a shared object built by --compile from the"
+        " same source with the same options")
+      & clipp::value("object file", load_filename),
+      clipp::option("--inline-size")
+      .doc("largest definition in nodes that is inlined, 0 to disable")
+      & clipp::value("nodes", inline_options.max_definition_nodes),
+      clipp::option("--control-period")
+      .doc("samples between exact values of terms marked with krate, which"
+        " are interpolated in between, 0 to compute them for every sample")
+      & clipp::value("samples", compile_options.control_period),
+      clipp::option("--exact", "-e").set(exact)
+      .doc("evaluate every sample on its own, without recurrences, control"
+        " rate or approximate math, so that renders are reproducible bit for"
+        " bit"));
 
-  if (!clipp::parse(argc, argv, cli)) {
+  if (!clipp::parse(argc, argv, cli)
+      || (compile && object_filename.empty())) {
     std::cout << make_man_page(cli, argv[0]);
     exit(1);
   }
+  if (exact) {
+    compile_options.recurrences = false;
+    compile_options.control_period = 0;
+    compile_options.approximate_math = false;
+  }
 
-  if (seq) {
+  if (compile) {
+    std::string source = read_file(filename), error;
+
+    term_t *program = lex_parse_string(source);
+    if (!program)
+      exit(1);
+    optimize_program(program, inline_options);
+
+    std::vector<message_t> messages;
+    const bool built = aot_build(program, compile_options
+        , aot_hash_source(source, compile_options, inline_options)
+        , object_filename, &messages, &error);
+    for (const message_t &message : messages)
+      printf("%s: %s\n", message_kind_to_string(message.kind).c_str()
+          , message.content.c_str());
+    if (!built)
+      die("%s", error.c_str());
+
+    delete program;
     exit(0);
+  }
 
+  if (seq) {
     std::string source = read_file(filename);
 
     term_t *program = lex_parse_string(source);
     if (!program)
       exit(1);
+    optimize_program(program, inline_options);
 
     samples_t samples = { std::vector<uint16_t>(), std::vector<uint16_t>() };
     double amplitude = 32760, sample_rate = 44100, frequency = 261.626 // C4
       , seconds = 2.5;
 
+    std::vector<message_t> messages;
+    validate_top_level_functions(program, &messages);
+    for (const message_t &message : messages)
+      printf("%s: %s\n", message_kind_to_string(message.kind).c_str()
+          , message.content.c_str());
+    std::vector<std::string> definitions
+      = get_evaluatable_top_level_functions(program);
+    if (std::find(definitions.begin(), definitions.end(), "main")
+        == definitions.end())
+      die("no evaluatable definition \"main\" in \"%s\"", filename.c_str());
+
+    aot_module_t module;
+    std::string error;
+    bool loaded = false;
+    messages.clear();
+    if (load_filename != "")
+      loaded = module.load(load_filename, aot_hash_source(source
+            , compile_options, inline_options), &error);
+    else if (aot)
+      loaded = aot_load_cached(source, program, compile_options
+          , inline_options, &module, &messages, &error);
+    if ((aot || load_filename != "") && !loaded)
+      messages.push_back({ message_k::warning
+          , "failed to load compiled object: " + error });
+    for (const message_t &message : messages)
+      printf("%s: %s\n", message_kind_to_string(message.kind).c_str()
+          , message.content.c_str());
+
+    evaluator_t *evaluator = new evaluator_t(program, "main"
+        , evaluation_tier_k::aot, loaded ? &module : nullptr, compile_options);
+    printf("evaluating with %s", evaluation_tier_kind_to_string(
+          evaluator->tier()).c_str());
+    if (evaluator->fallback_reason() != "")
+      printf(" (%s)", evaluator->fallback_reason().c_str());
+    printf("\n");
+    evaluation_context_t context(evaluator);
     uint64_t num_samples = sample_rate * seconds;
-    double seconds_per_sample = 1. / (double)sample_rate;
+    std::vector<float> values(num_samples);
+    context.eval_block(frequency, 0, sample_rate, values.data(), num_samples);
     for (uint64_t i = 0; i < num_samples; i++) {
-      double f = frequency, t = (double)i * seconds_per_sample
-        , value = evaluate_definition(program, "main", f, t);
-      uint16_t w_value = std::round(amplitude * value);
+      uint16_t w_value = std::round(amplitude * (double)values[i]);
       samples[0].push_back(w_value);
       samples[1].push_back(w_value);
     }
 
     write_wav("out.wav", sample_rate, samples);
 
+    delete evaluator;
     delete program;
+    exit(0);
   }
 
-  live(filename);
+  live(filename, aot, load_filename, inline_options, compile_options);
 }
 
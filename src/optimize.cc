@@ -0,0 +1,907 @@
+#include "optimize.hh"
+#include "utils.hh"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+
+// let bindings of enclosing lambdas and lets, innermost last. arguments of
+// lambdas aren't known before evaluation, so lambdas are represented by null
+typedef std::vector<const std::vector<term_t*>*> fold_frames_t;
+
+// passes process top-level definitions on first reference, so that the ones
+// they refer to are already processed regardless of the order they are
+// defined in. a reference to a definition that is still being visited is
+// recursive
+enum class visit_state_k {
+  visiting,
+  visited
+};
+
+typedef std::map<const term_t*, visit_state_k> visit_states_t;
+
+static void fold_term(term_t *term, fold_frames_t *frames
+    , visit_states_t *states);
+
+static bool is_number(const term_t *const term) {
+  return term->kind == term_k::value
+    && term->value->type.kind == type_k::number;
+}
+
+static bool is_builtin(const term_t *const term) {
+  return term->kind == term_k::value
+    && term->value->type.kind == type_k::builtin;
+}
+
+// "op x" where op is a binary builtin and x is a number
+static bool is_partial_builtin(const term_t *const term) {
+  return term->kind == term_k::application
+    && is_builtin(term->application.lambda)
+    && builtin_is_binary(term->application.lambda->value->builtin->kind)
+    && is_number(term->application.parameter);
+}
+
+// whether references to a binding with term as its body can be replaced by a
+// copy of term. it must not refer to anything and must be cheap to copy
+static bool is_substitutable(const term_t *const term) {
+  return is_number(term) || is_builtin(term) || is_partial_builtin(term);
+}
+
+static void adopt_children(term_t *term) {
+  switch (term->kind) {
+    case term_k::definition:
+      term->definition.body->parent = term;
+      break;
+    case term_k::application:
+      term->application.lambda->parent = term;
+      term->application.parameter->parent = term;
+      break;
+    case term_k::case_of:
+      term->case_of.value->parent = term;
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          statement.value->parent = term;
+        statement.result->parent = term;
+      }
+      break;
+    case term_k::if_else:
+      term->if_else.condition->parent = term;
+      term->if_else.then_expr->parent = term;
+      term->if_else.else_expr->parent = term;
+      break;
+    case term_k::let_in:
+      for (term_t *definition : *term->let_in.definitions)
+        definition->parent = term;
+      term->let_in.body->parent = term;
+      break;
+    case term_k::value:
+      if (term->value->type.kind == type_k::lambda)
+        term->value->lambda.body->parent = term;
+      break;
+    case term_k::unary_op:
+      term->unary_op.x->parent = term;
+      break;
+    case term_k::binary_op:
+      term->binary_op.x->parent = term;
+      term->binary_op.y->parent = term;
+      break;
+    default:
+      break;
+  }
+}
+
+// moves contents of replacement into term and frees what term had before.
+// term is changed in place, so that pointers to it stay valid. replacement
+// must not be owned by term
+static void replace_term(term_t *term, term_t *replacement) {
+  term_t *old = new term_t(*term);
+  term_t *parent = term->parent;
+  *term = *replacement;
+  term->parent = parent;
+  adopt_children(term);
+  // contents of replacement now belong to term, so only its shell is freed
+  replacement->kind = term_k::value;
+  replacement->value = nullptr;
+  delete replacement;
+  delete old;
+}
+
+static void replace_with_number(term_t *term, double number) {
+  replace_term(term, term_value(value_number(number)));
+}
+
+static void fold_definition(term_t *definition, visit_states_t *states) {
+  if (states->find(definition) != states->end())
+    return;
+  (*states)[definition] = visit_state_k::visiting;
+  fold_frames_t frames;
+  fold_term(definition->definition.body, &frames, states);
+  (*states)[definition] = visit_state_k::visited;
+}
+
+static void fold_identifier(term_t *term, fold_frames_t *frames
+    , visit_states_t *states) {
+  const term_t *binding;
+  switch (term->identifier.resolution) {
+    case resolution_k::constant:
+      replace_with_number(term, term->identifier.constant);
+      return;
+    case resolution_k::local: {
+      const std::vector<term_t*> *frame = frames->at(frames->size() - 1
+          - term->identifier.local.depth);
+      if (frame == nullptr)
+        return;
+      binding = frame->at(term->identifier.local.slot);
+      break;
+    }
+    case resolution_k::definition: {
+      // the program is being folded as a whole, so its definitions can be
+      // changed even though identifiers only refer to them
+      term_t *definition = const_cast<term_t*>(term->identifier.definition);
+      fold_definition(definition, states);
+      if (states->at(definition) != visit_state_k::visited)
+        return; // recursive reference
+      binding = definition;
+      break;
+    }
+    default:
+      return;
+  }
+  if (is_substitutable(binding->definition.body))
+    replace_term(term, term_copy(binding->definition.body));
+}
+
+static void fold_operator(term_t *term) {
+  if (term->kind == term_k::unary_op && is_number(term->unary_op.x))
+    replace_with_number(term, builtin_apply_unary(term->unary_op.kind
+          , term->unary_op.x->value->number));
+  else if (term->kind == term_k::binary_op && is_number(term->binary_op.x)
+      && is_number(term->binary_op.y))
+    replace_with_number(term, builtin_apply_binary(term->binary_op.kind
+          , term->binary_op.x->value->number
+          , term->binary_op.y->value->number));
+}
+
+// builtins applied to all of their operands, as left by substitution of
+// builtins and of partial applications like "(mult 2)", become operators
+static void fold_application(term_t *term) {
+  term_t *lambda = term->application.lambda
+    , *parameter = term->application.parameter;
+  if (is_builtin(lambda) && !builtin_is_binary(lambda->value->builtin->kind)) {
+    term->application.parameter = nullptr;
+    replace_term(term, term_unary_op(lambda->value->builtin->kind, parameter));
+  } else if (lambda->kind == term_k::application
+      && is_builtin(lambda->application.lambda)
+      && builtin_is_binary(lambda->application.lambda->value->builtin->kind)) {
+    term_t *x = lambda->application.parameter;
+    lambda->application.parameter = nullptr;
+    term->application.parameter = nullptr;
+    replace_term(term, term_binary_op(
+          lambda->application.lambda->value->builtin->kind, x, parameter));
+  } else
+    return;
+  fold_operator(term);
+}
+
+static void fold_term(term_t *term, fold_frames_t *frames
+    , visit_states_t *states) {
+  switch (term->kind) {
+    case term_k::program:
+      for (term_t *tl_term : *term->program.terms)
+        if (tl_term->kind == term_k::definition)
+          fold_definition(tl_term, states);
+      break;
+    case term_k::application:
+      fold_term(term->application.lambda, frames, states);
+      fold_term(term->application.parameter, frames, states);
+      fold_application(term);
+      break;
+    case term_k::identifier:
+      fold_identifier(term, frames, states);
+      break;
+    case term_k::case_of: {
+      fold_term(term->case_of.value, frames, states);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          fold_term(statement.value, frames, states);
+        fold_term(statement.result, frames, states);
+      }
+      if (!is_number(term->case_of.value))
+        break;
+      const double value = term->case_of.value->value->number;
+      for (term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value != nullptr && !is_number(statement.value))
+          break; // can't tell whether this one matches
+        if (statement.value == nullptr || std::llround(value)
+            == std::llround(statement.value->value->number)) {
+          term_t *result = statement.result;
+          statement.result = nullptr;
+          replace_term(term, result);
+          break;
+        }
+      }
+      break;
+    }
+    case term_k::if_else: {
+      fold_term(term->if_else.condition, frames, states);
+      fold_term(term->if_else.then_expr, frames, states);
+      fold_term(term->if_else.else_expr, frames, states);
+      if (!is_number(term->if_else.condition))
+        break;
+      term_t *taken;
+      if ((int64_t)term->if_else.condition->value->number == 0) {
+        taken = term->if_else.else_expr;
+        term->if_else.else_expr = nullptr;
+      } else {
+        taken = term->if_else.then_expr;
+        term->if_else.then_expr = nullptr;
+      }
+      replace_term(term, taken);
+      break;
+    }
+    case term_k::let_in:
+      frames->push_back(term->let_in.definitions);
+      for (term_t *definition : *term->let_in.definitions)
+        fold_term(definition->definition.body, frames, states);
+      fold_term(term->let_in.body, frames, states);
+      frames->pop_back();
+      break;
+    case term_k::value:
+      if (term->value->type.kind != type_k::lambda)
+        break;
+      // arguments of directly nested lambdas share one frame
+      frames->push_back(nullptr);
+      fold_term(term->value->lambda.inner_body, frames, states);
+      frames->pop_back();
+      break;
+    case term_k::unary_op:
+      fold_term(term->unary_op.x, frames, states);
+      fold_operator(term);
+      break;
+    case term_k::binary_op:
+      fold_term(term->binary_op.x, frames, states);
+      fold_term(term->binary_op.y, frames, states);
+      fold_operator(term);
+      break;
+    default:
+      break;
+  }
+}
+
+void fold_constants(term_t *program) {
+  fold_frames_t frames;
+  visit_states_t states;
+  fold_term(program, &frames, &states);
+}
+
+inline_options_t::inline_options_t()
+  : max_definition_nodes(48)
+  , max_inlined_nodes(1 << 16)
+  , max_depth(16) {
+}
+
+// a name bound by an enclosing lambda or let
+struct scope_entry_t {
+  std::string name;
+  const term_t *binding; // body of let binding, null for lambda arguments
+  size_t visible_end; // number of entries visible in binding, let's included
+};
+
+typedef std::vector<scope_entry_t> scope_t;
+
+struct inliner_t {
+  const inline_options_t *options;
+  std::map<std::string, term_t*> definitions; // top-level, last one wins
+  visit_states_t states;
+  std::set<const term_t*> recursive;
+  // definitions and bodies of let bindings inlined or being inlined on
+  // current path, which aren't inlined into themselves
+  std::vector<const term_t*> inlining;
+  size_t inlined_nodes;
+  uint32_t num_fresh_names;
+};
+
+static void inline_term(inliner_t *in, term_t *term, scope_t *scope
+    , bool head, int depth);
+
+// index of innermost entry among first end ones that binds name, -1 if none
+static int scope_lookup(const scope_t &scope, const std::string &name
+    , size_t end) {
+  for (size_t i = end; i-- > 0; )
+    if (scope[i].name == name)
+      return i;
+  return -1;
+}
+
+static bool is_lambda(const term_t *const term) {
+  return term->kind == term_k::value
+    && term->value->type.kind == type_k::lambda;
+}
+
+static void collect_free_names(const term_t *const term
+    , std::vector<std::string> *bound, std::set<std::string> *names) {
+  switch (term->kind) {
+    case term_k::application:
+      collect_free_names(term->application.lambda, bound, names);
+      collect_free_names(term->application.parameter, bound, names);
+      break;
+    case term_k::identifier:
+      if (std::find(bound->begin(), bound->end(), *term->identifier.name)
+          == bound->end())
+        names->insert(*term->identifier.name);
+      break;
+    case term_k::case_of:
+      collect_free_names(term->case_of.value, bound, names);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          collect_free_names(statement.value, bound, names);
+        collect_free_names(statement.result, bound, names);
+      }
+      break;
+    case term_k::if_else:
+      collect_free_names(term->if_else.condition, bound, names);
+      collect_free_names(term->if_else.then_expr, bound, names);
+      collect_free_names(term->if_else.else_expr, bound, names);
+      break;
+    case term_k::let_in:
+      for (const term_t *const definition : *term->let_in.definitions)
+        bound->push_back(*definition->definition.name);
+      for (const term_t *const definition : *term->let_in.definitions)
+        collect_free_names(definition->definition.body, bound, names);
+      collect_free_names(term->let_in.body, bound, names);
+      bound->resize(bound->size() - term->let_in.definitions->size());
+      break;
+    case term_k::value:
+      if (term->value->type.kind != type_k::lambda)
+        break;
+      bound->push_back(*term->value->lambda.arg);
+      collect_free_names(term->value->lambda.body, bound, names);
+      bound->pop_back();
+      break;
+    case term_k::unary_op:
+      collect_free_names(term->unary_op.x, bound, names);
+      break;
+    case term_k::binary_op:
+      collect_free_names(term->binary_op.x, bound, names);
+      collect_free_names(term->binary_op.y, bound, names);
+      break;
+    default:
+      break;
+  }
+}
+
+// whether names used but not bound in term, which was defined where only
+// the first visible_end entries of scope were visible, refer to the same
+// bindings at the end of scope
+static bool is_capture_free(const term_t *const term, const scope_t &scope
+    , size_t visible_end) {
+  std::vector<std::string> bound;
+  std::set<std::string> names;
+  collect_free_names(term, &bound, &names);
+  for (const std::string &name : names)
+    if (scope_lookup(scope, name, visible_end)
+        != scope_lookup(scope, name, scope.size()))
+      return false;
+  return true;
+}
+
+// names that can't be written in source, so they are never captured
+static std::string fresh_name(inliner_t *in, const std::string &name) {
+  return name.substr(0, name.find('\'')) + "'"
+    + std::to_string(in->num_fresh_names++);
+}
+
+// gives every lambda argument and let binding in term a fresh name
+static void rename_binders(inliner_t *in, term_t *term
+    , std::vector<std::pair<std::string, std::string>> *renames) {
+  switch (term->kind) {
+    case term_k::application:
+      rename_binders(in, term->application.lambda, renames);
+      rename_binders(in, term->application.parameter, renames);
+      break;
+    case term_k::identifier:
+      for (size_t i = renames->size(); i-- > 0; )
+        if (renames->at(i).first == *term->identifier.name) {
+          *term->identifier.name = renames->at(i).second;
+          break;
+        }
+      break;
+    case term_k::case_of:
+      rename_binders(in, term->case_of.value, renames);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          rename_binders(in, statement.value, renames);
+        rename_binders(in, statement.result, renames);
+      }
+      break;
+    case term_k::if_else:
+      rename_binders(in, term->if_else.condition, renames);
+      rename_binders(in, term->if_else.then_expr, renames);
+      rename_binders(in, term->if_else.else_expr, renames);
+      break;
+    case term_k::let_in:
+      for (term_t *definition : *term->let_in.definitions) {
+        std::string *name = definition->definition.name;
+        renames->push_back({ *name, fresh_name(in, *name) });
+        *name = renames->back().second;
+      }
+      for (term_t *definition : *term->let_in.definitions)
+        rename_binders(in, definition->definition.body, renames);
+      rename_binders(in, term->let_in.body, renames);
+      renames->resize(renames->size() - term->let_in.definitions->size());
+      break;
+    case term_k::value: {
+      if (term->value->type.kind != type_k::lambda)
+        break;
+      std::string *arg = term->value->lambda.arg;
+      renames->push_back({ *arg, fresh_name(in, *arg) });
+      *arg = renames->back().second;
+      rename_binders(in, term->value->lambda.body, renames);
+      renames->pop_back();
+      break;
+    }
+    case term_k::unary_op:
+      rename_binders(in, term->unary_op.x, renames);
+      break;
+    case term_k::binary_op:
+      rename_binders(in, term->binary_op.x, renames);
+      rename_binders(in, term->binary_op.y, renames);
+      break;
+    default:
+      break;
+  }
+}
+
+// counts uses of name, which must not be bound anywhere in term, and
+// whether any of them is inside a lambda, where it may be evaluated more than
+// once
+static void count_uses(const term_t *const term, const std::string &name
+    , bool in_lambda, size_t *uses, bool *used_in_lambda) {
+  switch (term->kind) {
+    case term_k::application:
+      count_uses(term->application.lambda, name, in_lambda, uses
+          , used_in_lambda);
+      count_uses(term->application.parameter, name, in_lambda, uses
+          , used_in_lambda);
+      break;
+    case term_k::identifier:
+      if (*term->identifier.name == name) {
+        ++*uses;
+        *used_in_lambda = *used_in_lambda || in_lambda;
+      }
+      break;
+    case term_k::case_of:
+      count_uses(term->case_of.value, name, in_lambda, uses, used_in_lambda);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          count_uses(statement.value, name, in_lambda, uses, used_in_lambda);
+        count_uses(statement.result, name, in_lambda, uses, used_in_lambda);
+      }
+      break;
+    case term_k::if_else:
+      count_uses(term->if_else.condition, name, in_lambda, uses
+          , used_in_lambda);
+      count_uses(term->if_else.then_expr, name, in_lambda, uses
+          , used_in_lambda);
+      count_uses(term->if_else.else_expr, name, in_lambda, uses
+          , used_in_lambda);
+      break;
+    case term_k::let_in:
+      for (const term_t *const definition : *term->let_in.definitions)
+        count_uses(definition->definition.body, name, in_lambda, uses
+            , used_in_lambda);
+      count_uses(term->let_in.body, name, in_lambda, uses, used_in_lambda);
+      break;
+    case term_k::value:
+      if (term->value->type.kind == type_k::lambda)
+        count_uses(term->value->lambda.body, name, true, uses
+            , used_in_lambda);
+      break;
+    case term_k::unary_op:
+      count_uses(term->unary_op.x, name, in_lambda, uses, used_in_lambda);
+      break;
+    case term_k::binary_op:
+      count_uses(term->binary_op.x, name, in_lambda, uses, used_in_lambda);
+      count_uses(term->binary_op.y, name, in_lambda, uses, used_in_lambda);
+      break;
+    default:
+      break;
+  }
+}
+
+// replaces uses of name, which must not be bound anywhere in term, with
+// copies of replacement
+static void substitute(term_t *term, const std::string &name
+    , const term_t *const replacement) {
+  switch (term->kind) {
+    case term_k::application:
+      substitute(term->application.lambda, name, replacement);
+      substitute(term->application.parameter, name, replacement);
+      break;
+    case term_k::identifier:
+      if (*term->identifier.name == name)
+        replace_term(term, term_copy(replacement));
+      break;
+    case term_k::case_of:
+      substitute(term->case_of.value, name, replacement);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          substitute(statement.value, name, replacement);
+        substitute(statement.result, name, replacement);
+      }
+      break;
+    case term_k::if_else:
+      substitute(term->if_else.condition, name, replacement);
+      substitute(term->if_else.then_expr, name, replacement);
+      substitute(term->if_else.else_expr, name, replacement);
+      break;
+    case term_k::let_in:
+      for (term_t *definition : *term->let_in.definitions)
+        substitute(definition->definition.body, name, replacement);
+      substitute(term->let_in.body, name, replacement);
+      break;
+    case term_k::value:
+      if (term->value->type.kind == type_k::lambda)
+        substitute(term->value->lambda.body, name, replacement);
+      break;
+    case term_k::unary_op:
+      substitute(term->unary_op.x, name, replacement);
+      break;
+    case term_k::binary_op:
+      substitute(term->binary_op.x, name, replacement);
+      substitute(term->binary_op.y, name, replacement);
+      break;
+    default:
+      break;
+  }
+}
+
+// rewrites application of lambda "(\x . body) parameter". parameter is
+// substituted into body when that doesn't duplicate work, and is bound by
+// let otherwise, which evaluates it once just like application does
+static void beta_reduce(inliner_t *in, term_t *term) {
+  term_t *lambda = term->application.lambda
+    , *parameter = term->application.parameter;
+  std::vector<std::pair<std::string, std::string>> renames;
+  rename_binders(in, lambda, &renames);
+  const std::string arg = *lambda->value->lambda.arg;
+  term_t *body = lambda->value->lambda.body;
+  lambda->value->lambda.body = nullptr;
+  term->application.parameter = nullptr;
+
+  size_t uses = 0;
+  bool used_in_lambda = false;
+  count_uses(body, arg, false, &uses, &used_in_lambda);
+  bool cheap = parameter->kind == term_k::identifier
+    || is_substitutable(parameter);
+  if (uses == 0 || cheap || (uses == 1 && !used_in_lambda)) {
+    substitute(body, arg, parameter);
+    delete parameter;
+    replace_term(term, body);
+    return;
+  }
+  std::vector<term_t*> *definitions = new std::vector<term_t*>;
+  definitions->push_back(term_definition(arg, parameter));
+  replace_term(term, term_let_in(definitions, body));
+}
+
+// "(let bindings in body) parameter", which is left by inlining and beta
+// reduction, becomes "let bindings in (body parameter)", which evaluates the
+// same. bindings get fresh names first, so that they can't capture names used
+// in parameter
+static void float_let(inliner_t *in, term_t *term) {
+  term_t *let = term->application.lambda
+    , *parameter = term->application.parameter;
+  std::vector<std::pair<std::string, std::string>> renames;
+  rename_binders(in, let, &renames);
+  term->application.lambda = nullptr;
+  term->application.parameter = nullptr;
+  let->let_in.body = term_application(let->let_in.body, parameter);
+  let->let_in.body->parent = let;
+  replace_term(term, let);
+}
+
+static void inline_definition(inliner_t *in, term_t *definition) {
+  if (in->states.find(definition) != in->states.end())
+    return;
+  in->states[definition] = visit_state_k::visiting;
+  // reducing a body that isn't a lambda could turn it into one, which would
+  // change what can be played, so such bodies are only reduced where inlined
+  scope_t scope;
+  if (is_lambda(definition->definition.body))
+    inline_term(in, definition->definition.body, &scope, false, 0);
+  in->states[definition] = visit_state_k::visited;
+}
+
+// replaces identifier applied to something with a copy of what it refers to,
+// if that is a small non-recursive top-level definition, or a let binding of
+// a lambda or of another name
+static void inline_reference(inliner_t *in, term_t *term, scope_t *scope
+    , int depth) {
+  const std::string &name = *term->identifier.name;
+  const term_t *inlined;
+  int local = scope_lookup(*scope, name, scope->size());
+  if (local != -1) {
+    inlined = scope->at(local).binding;
+    if (inlined == nullptr
+        || (!is_lambda(inlined) && inlined->kind != term_k::identifier)
+        || std::find(in->inlining.begin(), in->inlining.end(), inlined)
+          != in->inlining.end()
+        || !is_capture_free(inlined, *scope, scope->at(local).visible_end))
+      return;
+  } else {
+    auto definition_it = in->definitions.find(name);
+    if (definition_it == in->definitions.end())
+      return;
+    term_t *definition = definition_it->second;
+    inline_definition(in, definition);
+    if (in->states.at(definition) != visit_state_k::visited)
+      in->recursive.insert(definition);
+    if (in->recursive.count(definition)
+        || std::find(in->inlining.begin(), in->inlining.end(), definition)
+          != in->inlining.end())
+      return;
+    inlined = definition->definition.body;
+    if (!is_capture_free(inlined, *scope, 0))
+      return;
+  }
+  // conditionals are evaluated to functions only by name
+  if (inlined->kind == term_k::case_of || inlined->kind == term_k::if_else)
+    return;
+  size_t num_nodes = inlined->count_nodes();
+  if (num_nodes > in->options->max_definition_nodes
+      || in->inlined_nodes + num_nodes > in->options->max_inlined_nodes
+      || depth >= in->options->max_depth)
+    return;
+  in->inlined_nodes += num_nodes;
+  in->inlining.push_back(local == -1 ? in->definitions.at(name) : inlined);
+  replace_term(term, term_copy(inlined));
+  inline_term(in, term, scope, true, depth + 1);
+  in->inlining.pop_back();
+}
+
+static void inline_term(inliner_t *in, term_t *term, scope_t *scope
+    , bool head, int depth) {
+  switch (term->kind) {
+    case term_k::program:
+      for (term_t *tl_term : *term->program.terms)
+        if (tl_term->kind == term_k::definition)
+          inline_definition(in, tl_term);
+      break;
+    case term_k::application:
+      inline_term(in, term->application.lambda, scope, true, depth);
+      inline_term(in, term->application.parameter, scope, false, depth);
+      if (depth >= in->options->max_depth)
+        break;
+      if (term->application.lambda->kind == term_k::let_in) {
+        float_let(in, term);
+        inline_term(in, term, scope, head, depth + 1);
+      } else if (is_lambda(term->application.lambda)) {
+        beta_reduce(in, term);
+        inline_term(in, term, scope, head, depth + 1);
+      }
+      break;
+    case term_k::identifier:
+      if (head)
+        inline_reference(in, term, scope, depth);
+      break;
+    case term_k::case_of:
+      inline_term(in, term->case_of.value, scope, false, depth);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          inline_term(in, statement.value, scope, false, depth);
+        inline_term(in, statement.result, scope, false, depth);
+      }
+      break;
+    case term_k::if_else:
+      inline_term(in, term->if_else.condition, scope, false, depth);
+      inline_term(in, term->if_else.then_expr, scope, false, depth);
+      inline_term(in, term->if_else.else_expr, scope, false, depth);
+      break;
+    case term_k::let_in: {
+      const size_t visible_end = scope->size()
+        + term->let_in.definitions->size();
+      for (const term_t *const definition : *term->let_in.definitions)
+        scope->push_back({ *definition->definition.name
+            , definition->definition.body, visible_end });
+      for (term_t *definition : *term->let_in.definitions) {
+        in->inlining.push_back(definition->definition.body);
+        inline_term(in, definition->definition.body, scope, false, depth);
+        in->inlining.pop_back();
+      }
+      inline_term(in, term->let_in.body, scope, false, depth);
+      scope->resize(scope->size() - term->let_in.definitions->size());
+      break;
+    }
+    case term_k::value:
+      if (term->value->type.kind != type_k::lambda)
+        break;
+      scope->push_back({ *term->value->lambda.arg, nullptr, 0 });
+      inline_term(in, term->value->lambda.body, scope, false, depth);
+      scope->pop_back();
+      break;
+    case term_k::unary_op:
+      inline_term(in, term->unary_op.x, scope, false, depth);
+      break;
+    case term_k::binary_op:
+      inline_term(in, term->binary_op.x, scope, false, depth);
+      inline_term(in, term->binary_op.y, scope, false, depth);
+      break;
+    default:
+      break;
+  }
+}
+
+void inline_definitions(term_t *program, const inline_options_t &options) {
+  inliner_t in;
+  in.options = &options;
+  for (term_t *term : *program->program.terms)
+    if (term->kind == term_k::definition)
+      in.definitions[*term->definition.name] = term;
+  in.inlined_nodes = 0;
+  in.num_fresh_names = 0;
+  inline_term(&in, program, nullptr, false, 0);
+  resolve_identifiers(program);
+}
+
+// which bindings of let_in terms are used, by index
+typedef std::map<const term_t*, std::vector<bool>> liveness_t;
+
+static const std::vector<bool>& let_liveness(const term_t *const let
+    , liveness_t *live);
+
+// marks bindings of the frame depth frames out of term that term uses
+static void mark_uses(const term_t *const term, uint32_t depth
+    , std::vector<bool> *used, liveness_t *live) {
+  switch (term->kind) {
+    case term_k::application:
+      mark_uses(term->application.lambda, depth, used, live);
+      mark_uses(term->application.parameter, depth, used, live);
+      break;
+    case term_k::identifier:
+      if (term->identifier.resolution == resolution_k::local
+          && term->identifier.local.depth == depth)
+        used->at(term->identifier.local.slot) = true;
+      break;
+    case term_k::case_of:
+      mark_uses(term->case_of.value, depth, used, live);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          mark_uses(statement.value, depth, used, live);
+        mark_uses(statement.result, depth, used, live);
+      }
+      break;
+    case term_k::if_else:
+      mark_uses(term->if_else.condition, depth, used, live);
+      mark_uses(term->if_else.then_expr, depth, used, live);
+      mark_uses(term->if_else.else_expr, depth, used, live);
+      break;
+    case term_k::let_in: {
+      // dead bindings of inner lets don't keep anything alive
+      const std::vector<bool> &inner = let_liveness(term, live);
+      for (size_t i = 0; i < inner.size(); ++i)
+        if (inner[i])
+          mark_uses(term->let_in.definitions->at(i)->definition.body
+              , depth + 1, used, live);
+      mark_uses(term->let_in.body, depth + 1, used, live);
+      break;
+    }
+    case term_k::value:
+      if (term->value->type.kind == type_k::lambda)
+        mark_uses(term->value->lambda.inner_body, depth + 1, used, live);
+      break;
+    case term_k::unary_op:
+      mark_uses(term->unary_op.x, depth, used, live);
+      break;
+    case term_k::binary_op:
+      mark_uses(term->binary_op.x, depth, used, live);
+      mark_uses(term->binary_op.y, depth, used, live);
+      break;
+    default:
+      break;
+  }
+}
+
+// bindings of let used by its body, directly or through other used bindings
+static const std::vector<bool>& let_liveness(const term_t *const let
+    , liveness_t *live) {
+  auto live_it = live->find(let);
+  if (live_it != live->end())
+    return live_it->second;
+  const std::vector<term_t*> &definitions = *let->let_in.definitions;
+  std::vector<bool> used(definitions.size(), false);
+  mark_uses(let->let_in.body, 0, &used, live);
+  // bindings see each other, so uses are followed until no more are found
+  std::vector<bool> followed(definitions.size(), false);
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (size_t i = 0; i < definitions.size(); ++i)
+      if (used[i] && !followed[i]) {
+        followed[i] = true;
+        mark_uses(definitions[i]->definition.body, 0, &used, live);
+        changed = true;
+      }
+  }
+  return (*live)[let] = used;
+}
+
+// lets are visited before what they contain, so that liveness is computed
+// while identifiers still refer to frames as resolved
+static void remove_dead_bindings(term_t *term, liveness_t *live) {
+  switch (term->kind) {
+    case term_k::program:
+      for (term_t *tl_term : *term->program.terms)
+        remove_dead_bindings(tl_term, live);
+      break;
+    case term_k::definition:
+      remove_dead_bindings(term->definition.body, live);
+      break;
+    case term_k::application:
+      remove_dead_bindings(term->application.lambda, live);
+      remove_dead_bindings(term->application.parameter, live);
+      break;
+    case term_k::case_of:
+      remove_dead_bindings(term->case_of.value, live);
+      for (const term_t::case_statement &statement : *term->case_of.statements) {
+        if (statement.value)
+          remove_dead_bindings(statement.value, live);
+        remove_dead_bindings(statement.result, live);
+      }
+      break;
+    case term_k::if_else:
+      remove_dead_bindings(term->if_else.condition, live);
+      remove_dead_bindings(term->if_else.then_expr, live);
+      remove_dead_bindings(term->if_else.else_expr, live);
+      break;
+    case term_k::let_in: {
+      const std::vector<bool> used = let_liveness(term, live);
+      std::vector<term_t*> *definitions = term->let_in.definitions;
+      size_t num_kept = 0;
+      for (size_t i = 0; i < definitions->size(); ++i)
+        if (used[i])
+          definitions->at(num_kept++) = definitions->at(i);
+        else
+          delete definitions->at(i);
+      definitions->resize(num_kept);
+      if (num_kept == 0) {
+        // term is reused for the body, which may be a let of its own
+        live->erase(term);
+        term_t *body = term->let_in.body;
+        term->let_in.body = nullptr;
+        replace_term(term, body);
+        remove_dead_bindings(term, live);
+        break;
+      }
+      for (term_t *definition : *definitions)
+        remove_dead_bindings(definition->definition.body, live);
+      remove_dead_bindings(term->let_in.body, live);
+      break;
+    }
+    case term_k::value:
+      if (term->value->type.kind == type_k::lambda)
+        remove_dead_bindings(term->value->lambda.body, live);
+      break;
+    case term_k::unary_op:
+      remove_dead_bindings(term->unary_op.x, live);
+      break;
+    case term_k::binary_op:
+      remove_dead_bindings(term->binary_op.x, live);
+      remove_dead_bindings(term->binary_op.y, live);
+      break;
+    default:
+      break;
+  }
+}
+
+void eliminate_dead_bindings(term_t *program) {
+  liveness_t live;
+  remove_dead_bindings(program, &live);
+  resolve_identifiers(program);
+}
+
+void optimize_program(term_t *program, const inline_options_t &options) {
+  fold_constants(program);
+  inline_definitions(program, options);
+  fold_constants(program);
+  eliminate_dead_bindings(program);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "lang.hh"
+
+// folds closed constant subterms of a resolved program in place. pi and
+// builtins applied to numbers become numbers, conditionals on constant
+// conditions are replaced by the branch taken, and references to let bindings
+// and top-level definitions that are numbers, builtins or binary builtins
+// applied to a number are replaced by copies of them, so that such
+// definitions are evaluated once here instead of for every sample. folding
+// uses the same operations as evaluation, so results don't change
+void fold_constants(term_t *program);
+
+struct inline_options_t {
+  // largest body, in nodes, of a definition or let binding that is inlined
+  size_t max_definition_nodes;
+  // total number of nodes inlined into the program, to bound its growth
+  size_t max_inlined_nodes;
+  // how many inlinings and beta reductions may be nested in one another
+  int max_depth;
+  inline_options_t();
+};
+
+// replaces names of small non-recursive top-level definitions, and of let
+// bindings of lambdas, that are applied to something by copies of their
+// bodies, and beta-reduces applications of lambdas. arguments that are cheap
+// or used once are substituted into lambda bodies, others are bound by let,
+// so nothing is evaluated more often than before. binders of inlined copies
+// get fresh names, so identifiers are resolved anew afterwards
+void inline_definitions(term_t *program, const inline_options_t &options);
+
+// removes let bindings that the let's body doesn't use, directly or through
+// other bindings it uses, and lets that are left without bindings.
+// identifiers are resolved anew afterwards
+void eliminate_dead_bindings(term_t *program);
+
+// runs the passes above on a freshly parsed program, before it's evaluated
+// or compiled
+void optimize_program(term_t *program, const inline_options_t &options);
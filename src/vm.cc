@@ -0,0 +1,339 @@
+#include "vm.hh"
+#include "utils.hh"
+#include "vmath.hh"
+#include <algorithm>
+#include <cmath>
+
+vm_t::vm_t(const bytecode_t *bytecode)
+  : _bytecode(bytecode)
+  , _registers(bytecode->registers())
+  , _block_registers()
+  , _recurrence_values()
+  , _control_points()
+  , _control_values() {
+  if (!_bytecode->controls.empty())
+    _control_points.resize(_bytecode->controls.size()
+        * _bytecode->num_control_points(_bytecode->control_period - 1
+          , vm_block_size));
+  // without straight-line code, only values of time are computed in lanes.
+  // registers of t and constants come first, and those of time after them
+  // and values of note
+  const std::vector<instruction_t> &time = _bytecode->time_instructions;
+  size_t lanes = _bytecode->num_registers;
+  if (!_bytecode->straight_line) {
+    _control_values.resize(_bytecode->controls.size() * vm_block_size);
+    _recurrence_values.resize(_bytecode->recurrences.size() * vm_block_size);
+    lanes = time.empty() ? bytecode_register_t + 1 + _bytecode->constants.size()
+      : time.back().dst + 1;
+  }
+  _block_registers.resize(lanes * vm_block_size, 0);
+  for (const std::pair<uint32_t, double> &constant : _bytecode->constants)
+    for (size_t k = 0; k < vm_block_size; ++k)
+      _block_registers[constant.first * vm_block_size + k] = constant.second;
+}
+
+// computes r[i.dst] for instruction that computes a value from its operands
+static inline void compute(const instruction_t &i, double *r) {
+  switch (i.opcode) {
+    case opcode_k::sin:    r[i.dst] = sin(r[i.a]); break;
+    case opcode_k::cos:    r[i.dst] = cos(r[i.a]); break;
+    case opcode_k::exp:    r[i.dst] = exp(r[i.a]); break;
+    case opcode_k::inv:    r[i.dst] = -r[i.a]; break;
+    case opcode_k::abs:    r[i.dst] = std::fabs(r[i.a]); break;
+    case opcode_k::floor:  r[i.dst] = std::floor(r[i.a]); break;
+    case opcode_k::round:  r[i.dst] = std::round(r[i.a]); break;
+    case opcode_k::ceil:   r[i.dst] = std::ceil(r[i.a]); break;
+    case opcode_k::sqrt:   r[i.dst] = std::sqrt(r[i.a]); break;
+    case opcode_k::plus:   r[i.dst] = r[i.a] + r[i.b]; break;
+    case opcode_k::minus:  r[i.dst] = r[i.a] - r[i.b]; break;
+    case opcode_k::mult:   r[i.dst] = r[i.a] * r[i.b]; break;
+    case opcode_k::divide: r[i.dst] = r[i.a] / r[i.b]; break;
+    case opcode_k::ceq:
+      r[i.dst] = (int64_t)r[i.a] == (int64_t)r[i.b];
+      break;
+    case opcode_k::cneq:
+      r[i.dst] = (int64_t)r[i.a] != (int64_t)r[i.b];
+      break;
+    case opcode_k::clt:    r[i.dst] = r[i.a] < r[i.b]; break;
+    case opcode_k::clteq:  r[i.dst] = r[i.a] <= r[i.b]; break;
+    case opcode_k::cgt:    r[i.dst] = r[i.a] > r[i.b]; break;
+    case opcode_k::cgteq:  r[i.dst] = r[i.a] <= r[i.b]; break;
+    case opcode_k::mod:    r[i.dst] = std::fmod(r[i.a], r[i.b]); break;
+    case opcode_k::pow:    r[i.dst] = std::pow(r[i.a], r[i.b]); break;
+    case opcode_k::move:   r[i.dst] = r[i.a]; break;
+    default:
+      die("unexpected opcode <%s>", opcode_kind_to_string(i.opcode).c_str());
+  }
+}
+
+void vm_t::_run_note(double f) {
+  double *r = _registers.data();
+  r[bytecode_register_f] = f;
+  for (const instruction_t &i : _bytecode->note_instructions)
+    compute(i, r);
+}
+
+void vm_t::_run_time(double t) {
+  double *r = _registers.data();
+  r[bytecode_register_t] = t;
+  for (const instruction_t &i : _bytecode->time_instructions)
+    compute(i, r);
+}
+
+void vm_t::_load_time(size_t k) {
+  const double *const r = _block_registers.data();
+  _registers[bytecode_register_t] = r[bytecode_register_t * vm_block_size + k];
+  for (const instruction_t &i : _bytecode->time_instructions)
+    _registers[i.dst] = r[i.dst * vm_block_size + k];
+}
+
+void vm_t::_run_recurrences(uint64_t start, double sample_rate, size_t m) {
+  if (!_bytecode->straight_line) {
+    _bytecode->run_recurrences(_registers.data(), start, sample_rate, m
+        , _recurrence_values.data());
+    return;
+  }
+  for (const recurrence_t &recurrence : _bytecode->recurrences)
+    recurrence.run(_registers.data(), start, sample_rate, m
+        , _block_registers.data() + recurrence.dst * vm_block_size, 1);
+}
+
+void vm_t::_load_recurrences(size_t k) {
+  const std::vector<recurrence_t> &recurrences = _bytecode->recurrences;
+  if (!recurrences.empty())
+    std::copy_n(_recurrence_values.data() + k * recurrences.size()
+        , recurrences.size(), _registers.data() + recurrences.front().dst);
+}
+
+void vm_t::_run_controls(uint64_t start, double sample_rate, size_t m) {
+  const std::vector<std::pair<uint32_t, uint32_t>> &controls
+    = _bytecode->controls;
+  if (controls.empty())
+    return;
+  double *r = _registers.data();
+  const uint64_t first = _bytecode->first_control_point(start);
+  for (size_t p = 0; p < _bytecode->num_control_points(start, m); ++p) {
+    r[bytecode_register_t] = (double)(first + p * _bytecode->control_period)
+      / sample_rate;
+    for (const instruction_t &i : _bytecode->control_instructions)
+      compute(i, r);
+    for (size_t j = 0; j < controls.size(); ++j)
+      _control_points[p * controls.size() + j] = r[controls[j].second];
+  }
+  if (!_bytecode->straight_line)
+    _bytecode->interpolate_controls(_control_points.data(), start, m
+        , _control_values.data(), controls.size(), 1);
+  else
+    _bytecode->interpolate_controls(_control_points.data(), start, m
+        , _block_registers.data() + controls.front().first * vm_block_size
+        , 1, vm_block_size);
+}
+
+void vm_t::_load_controls(size_t k) {
+  const std::vector<std::pair<uint32_t, uint32_t>> &controls
+    = _bytecode->controls;
+  if (!controls.empty())
+    std::copy_n(_control_values.data() + k * controls.size()
+        , controls.size(), _registers.data() + controls.front().first);
+}
+
+double vm_t::_run_sample() {
+  double *r = _registers.data();
+  const instruction_t *const instructions = _bytecode->instructions.data();
+  const instruction_t *ip = instructions;
+  while (true) {
+    const instruction_t &i = *ip++;
+    switch (i.opcode) {
+      case opcode_k::select:
+        if ((int64_t)r[i.a] != 0)
+          r[i.dst] = r[i.b];
+        break;
+      case opcode_k::jump:
+        ip = instructions + i.dst;
+        break;
+      case opcode_k::jump_if_zero:
+        if ((int64_t)r[i.a] == 0)
+          ip = instructions + i.dst;
+        break;
+      case opcode_k::jump_if_no_case:
+        if (std::llround(r[i.a]) != std::llround(r[i.b]))
+          ip = instructions + i.dst;
+        break;
+      case opcode_k::jump_table:
+        ip = instructions
+          + _bytecode->jump_tables[i.b].target(std::llround(r[i.a]));
+        break;
+      case opcode_k::fail:
+        die("no matching clause in case statement");
+      case opcode_k::ret:
+        return r[i.a];
+      default:
+        compute(i, r);
+        break;
+    }
+  }
+}
+
+double vm_t::run(double f, double t) {
+  _run_note(f);
+  _run_time(t);
+  // exact values, as if there was a control point at every sample
+  for (const instruction_t &i : _bytecode->control_instructions)
+    compute(i, _registers.data());
+  for (const std::pair<uint32_t, uint32_t> &control : _bytecode->controls)
+    _registers[control.first] = _registers[control.second];
+  for (const recurrence_t &recurrence : _bytecode->recurrences)
+    _registers[recurrence.dst] = recurrence.value(_registers.data(), t);
+  return _run_sample();
+}
+
+#define unary_loop(EXPR) \
+  for (size_t k = 0; k < m; ++k) { \
+    const double x = a[k]; \
+    d[k] = (EXPR); \
+  } \
+  break
+#define binary_loop(EXPR) \
+  for (size_t k = 0; k < m; ++k) { \
+    const double x = a[k], y = b[k]; \
+    d[k] = (EXPR); \
+  } \
+  break
+
+void vm_t::_run_lanes(const std::vector<instruction_t> &instructions
+    , size_t m, float *out) {
+  double *const r = _block_registers.data();
+  const bool approximate = _bytecode->approximate_math;
+  for (const instruction_t &i : instructions) {
+    double *const d = r + i.dst * vm_block_size;
+    const double *const a = r + i.a * vm_block_size
+      , *const b = r + i.b * vm_block_size;
+    switch (i.opcode) {
+      case opcode_k::sin:
+        if (approximate) {
+          vmath_sin(a, d, m);
+          break;
+        }
+        unary_loop(sin(x));
+      case opcode_k::cos:
+        if (approximate) {
+          vmath_cos(a, d, m);
+          break;
+        }
+        unary_loop(cos(x));
+      case opcode_k::exp:
+        if (approximate) {
+          vmath_exp(a, d, m);
+          break;
+        }
+        unary_loop(exp(x));
+      case opcode_k::inv:    unary_loop(-x);
+      case opcode_k::abs:    vmath_abs(a, d, m); break;
+      case opcode_k::floor:  vmath_floor(a, d, m); break;
+      case opcode_k::round:  vmath_round(a, d, m); break;
+      case opcode_k::ceil:   vmath_ceil(a, d, m); break;
+      case opcode_k::sqrt:   vmath_sqrt(a, d, m); break;
+      case opcode_k::plus:   binary_loop(x + y);
+      case opcode_k::minus:  binary_loop(x - y);
+      case opcode_k::mult:   binary_loop(x * y);
+      case opcode_k::divide: binary_loop(x / y);
+      case opcode_k::ceq:    binary_loop((int64_t)x == (int64_t)y);
+      case opcode_k::cneq:   binary_loop((int64_t)x != (int64_t)y);
+      case opcode_k::clt:    binary_loop(x < y);
+      case opcode_k::clteq:  binary_loop(x <= y);
+      case opcode_k::cgt:    binary_loop(x > y);
+      case opcode_k::cgteq:  binary_loop(x <= y);
+      case opcode_k::mod:    vmath_mod(a, b, d, m); break;
+      case opcode_k::pow:    vmath_pow(a, b, d, m); break;
+      case opcode_k::move:   unary_loop(x);
+      case opcode_k::select:
+        for (size_t k = 0; k < m; ++k)
+          d[k] = (int64_t)a[k] != 0 ? b[k] : d[k];
+        break;
+      case opcode_k::ret:
+        for (size_t k = 0; k < m; ++k)
+          out[k] = a[k];
+        break;
+      default:
+        die("unexpected opcode <%s> in straight-line code"
+            , opcode_kind_to_string(i.opcode).c_str());
+    }
+  }
+}
+
+#undef unary_loop
+#undef binary_loop
+
+void vm_t::_spread_note(double f) {
+  // values of note are computed once and are the same in every lane
+  double *const r = _block_registers.data();
+  _run_note(f);
+  std::fill_n(r + bytecode_register_f * vm_block_size, vm_block_size, f);
+  for (const instruction_t &i : _bytecode->note_instructions)
+    std::fill_n(r + i.dst * vm_block_size, vm_block_size, _registers[i.dst]);
+}
+
+void vm_t::_run_time_lanes(uint64_t start, double sample_rate, size_t m) {
+  double *const r_t = _block_registers.data()
+    + bytecode_register_t * vm_block_size;
+  for (size_t k = 0; k < m; ++k)
+    r_t[k] = (double)(start + k) / sample_rate;
+  _run_lanes(_bytecode->time_instructions, m, nullptr);
+}
+
+void vm_t::run_block(double f, uint64_t start, double sample_rate, float *out
+    , size_t n) {
+  if (_bytecode->straight_line) {
+    _spread_note(f);
+    for (size_t offset = 0; offset < n; offset += vm_block_size) {
+      const size_t m = std::min(vm_block_size, n - offset);
+      _run_time_lanes(start + offset, sample_rate, m);
+      _run_controls(start + offset, sample_rate, m);
+      _run_recurrences(start + offset, sample_rate, m);
+      _run_lanes(_bytecode->instructions, m, out + offset);
+    }
+    return;
+  }
+  _run_note(f);
+  for (size_t offset = 0; offset < n; offset += vm_block_size) {
+    const size_t m = std::min(vm_block_size, n - offset);
+    _run_time_lanes(start + offset, sample_rate, m);
+    _run_controls(start + offset, sample_rate, m);
+    _run_recurrences(start + offset, sample_rate, m);
+    for (size_t k = 0; k < m; ++k) {
+      _load_time(k);
+      _load_controls(k);
+      _load_recurrences(k);
+      out[offset + k] = _run_sample();
+    }
+  }
+}
+
+void vm_t::run_notes(const double *f, size_t num_notes, uint64_t start
+    , double sample_rate, float *const *out, size_t n) {
+  for (size_t offset = 0; offset < n; offset += vm_block_size) {
+    const size_t m = std::min(vm_block_size, n - offset);
+    // instructions don't write registers of time or of controls, so they are
+    // kept for all notes
+    _run_time_lanes(start + offset, sample_rate, m);
+    _run_controls(start + offset, sample_rate, m);
+    if (_bytecode->straight_line) {
+      for (size_t j = 0; j < num_notes; ++j) {
+        _spread_note(f[j]);
+        _run_recurrences(start + offset, sample_rate, m);
+        _run_lanes(_bytecode->instructions, m, out[j] + offset);
+      }
+      continue;
+    }
+    for (size_t j = 0; j < num_notes; ++j) {
+      _run_note(f[j]);
+      _run_recurrences(start + offset, sample_rate, m);
+      for (size_t k = 0; k < m; ++k) {
+        _load_time(k);
+        _load_controls(k);
+        _load_recurrences(k);
+        out[j][offset + k] = _run_sample();
+      }
+    }
+  }
+}
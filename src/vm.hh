@@ -0,0 +1,55 @@
+#pragma once
+
+#include "compile.hh"
+
+// number of samples processed at once by run_block() for straight-line code
+const size_t vm_block_size = 64;
+
+// runs bytecode produced by compile_definition(). bytecode must outlive vm
+class vm_t {
+  const bytecode_t *_bytecode;
+  std::vector<double> _registers;
+  // vm_block_size values per register, register r starts at r * vm_block_size.
+  // unless code is straight-line, only t, constants and values of time have
+  // them
+  std::vector<double> _block_registers;
+  // values of recurrences for vm_block_size samples, unless code is
+  // straight-line and they are computed right into block registers
+  std::vector<double> _recurrence_values;
+  // values of controls at control points for vm_block_size samples, and
+  // interpolated for each of them unless code is straight-line and they are
+  // interpolated right into block registers
+  std::vector<double> _control_points;
+  std::vector<double> _control_values;
+
+  // compute values of note or of time of a sample in registers
+  void _run_note(double f);
+  void _run_time(double t);
+  // moves t and values of time of lane k to registers
+  void _load_time(size_t k);
+  // compute values of recurrences for m samples of note computed last, and
+  // move those of sample k to registers
+  void _run_recurrences(uint64_t start, double sample_rate, size_t m);
+  void _load_recurrences(size_t k);
+  // compute values of controls for m samples from start, and move those of
+  // sample k to registers
+  void _run_controls(uint64_t start, double sample_rate, size_t m);
+  void _load_controls(size_t k);
+  // runs instructions for a sample of note and time computed last
+  double _run_sample();
+  // block evaluation of straight-line code, on m lanes of block registers.
+  // returned values are written to out
+  void _run_lanes(const std::vector<instruction_t> &instructions, size_t m
+      , float *out);
+  void _spread_note(double f);
+  void _run_time_lanes(uint64_t start, double sample_rate, size_t m);
+public:
+  vm_t(const bytecode_t *bytecode);
+  double run(double f, double t);
+  void run_block(double f, uint64_t start, double sample_rate, float *out
+      , size_t n);
+  // like run_block() for each of num_notes frequencies, into out[j],
+  // computing values of time once for all of them
+  void run_notes(const double *f, size_t num_notes, uint64_t start
+      , double sample_rate, float *const *out, size_t n);
+};
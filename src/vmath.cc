@@ -0,0 +1,343 @@
+#include "vmath.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// kernels are written once on gcc vectors of doubles D and of int64_t I, and
+// inlined into functions compiled for each instruction set with vectors of
+// its width. reductions and polynomials are those of fdlibm
+
+typedef double f64x1 __attribute__((vector_size(8)));
+typedef int64_t i64x1 __attribute__((vector_size(8)));
+typedef double f64x2 __attribute__((vector_size(16)));
+typedef int64_t i64x2 __attribute__((vector_size(16)));
+typedef double f64x4 __attribute__((vector_size(32)));
+typedef int64_t i64x4 __attribute__((vector_size(32)));
+
+// kernels are always inlined, and vectors are passed to them by pointer, so
+// that those wider than the default target supports never cross the abi
+#define kernel_inline inline __attribute__((always_inline))
+
+static const int64_t sign_bit = INT64_MIN;
+// adding 1.5 * 2^52 rounds numbers below 2^51 in magnitude to integers,
+// which then are the low bits of the sum minus those of 1.5 * 2^52
+static const double shifter = 6755399441055744.0;
+static const int64_t shifter_bits = 0x4338000000000000LL;
+static const double two_52 = 4503599627370496.0;
+
+// largest |x| that approximations are used for. for sin and cos, products of
+// quadrants up to 2^20 and first parts of pi / 2 are exact
+static const double sin_cos_limit = 1.6e6, exp_limit = 708;
+
+static const double two_over_pi = 6.36619772367581382433e-01;
+// pi / 2 in parts of 33 bits and the rest
+static const double pi_2_1 = 1.57079632673412561417e+00
+  , pi_2_2 = 6.07710050630396597660e-11
+  , pi_2_3 = 2.02226624871116645580e-21
+  , pi_2_3t = 8.47842766036889956997e-32;
+// sin and cos on [-pi / 4, pi / 4]
+static const double s1 = -1.66666666666666324348e-01
+  , s2 = 8.33333333332248946124e-03
+  , s3 = -1.98412698298579493134e-04
+  , s4 = 2.75573137070700676789e-06
+  , s5 = -2.50507602534068634195e-08
+  , s6 = 1.58969099521155010221e-10;
+static const double c1 = 4.16666666666666019037e-02
+  , c2 = -1.38888888888741095749e-03
+  , c3 = 2.48015872894767294178e-05
+  , c4 = -2.75573143513906633035e-07
+  , c5 = 2.08757232129817482790e-09
+  , c6 = -1.13596475577881948265e-11;
+
+static const double inv_ln2 = 1.44269504088896338700e+00;
+// ln 2 in a part of 32 bits and the rest
+static const double ln2_hi = 6.93147180369123816490e-01
+  , ln2_lo = 1.90821492927058770002e-10;
+// exp on [-ln 2 / 2, ln 2 / 2]
+static const double p1 = 1.66666666666666019037e-01
+  , p2 = -2.77777777770155933842e-03
+  , p3 = 6.61375632143793436117e-05
+  , p4 = -1.65339022054652515390e-06
+  , p5 = 4.13813679705723846039e-08;
+
+// sin of x + quadrant * pi / 2
+template <typename D, typename I>
+static kernel_inline void sin_quadrant(D *x, int64_t quadrant) {
+  const D n_shifted = *x * two_over_pi + shifter, n = n_shifted - shifter;
+  // r = x - n * pi / 2. products of n with the first parts are exact, and so
+  // is the first difference. the error e of the second is kept
+  const D a = *x - n * pi_2_1, b = n * pi_2_2, s = a - b, b_s = s - a
+    , e = (a - (s - b_s)) - (b + b_s);
+  // and then is r + r_tail, as that's still more than a double holds
+  const D tail = (e - n * pi_2_3) - n * pi_2_3t, r = s + tail
+    , r_tail = (s - r) + tail, z = r * r, w = z * z, v = z * r;
+  const D sin_r = r - ((z * (0.5 * r_tail - v * (s2 + z * (s3 + z * s4)
+            + z * w * (s5 + z * s6))) - r_tail) - v * s1);
+  const D half_z = 0.5 * z, one_minus = 1.0 - half_z;
+  const D cos_r = one_minus + (((1.0 - one_minus) - half_z)
+      + (z * (z * (c1 + z * (c2 + z * c3)) + w * w * (c4 + z * (c5 + z * c6)))
+        - r * r_tail));
+  const I q = ((I)n_shifted - shifter_bits) + quadrant;
+  *x = (D)((I)((q & 1) != 0 ? cos_r : sin_r) ^ (q & 2) << 62);
+}
+
+// replaces approximations y of F at x by F::exact() where |x| is out of
+// the range of F::kernel(), or x isn't a number
+template <typename D, typename I, typename F>
+static kernel_inline void outside_range(const D *x, D *y) {
+  const I in_range = (D)((I)*x & ~sign_bit) <= F::limit();
+  const size_t lanes = sizeof(D) / sizeof(double);
+  int64_t all_in_range = -1;
+  for (size_t l = 0; l < lanes; ++l)
+    all_in_range &= in_range[l];
+  if (all_in_range != 0)
+    return;
+  for (size_t l = 0; l < lanes; ++l)
+    if (in_range[l] == 0)
+      (*y)[l] = F::exact((*x)[l]);
+}
+
+struct sin_t {
+  static double limit() { return sin_cos_limit; }
+  static double exact(double x) { return std::sin(x); }
+  template <typename D, typename I>
+  static kernel_inline void kernel(D *x) {
+    const D v = *x;
+    sin_quadrant<D, I>(x, 0);
+    // reduction of -0 gives +0, while sin(-0) is -0
+    const I zero = v == 0.0;
+    *x = (D)(((I)*x & ~zero) | ((I)v & zero));
+    outside_range<D, I, sin_t>(&v, x);
+  }
+};
+
+struct cos_t {
+  static double limit() { return sin_cos_limit; }
+  static double exact(double x) { return std::cos(x); }
+  template <typename D, typename I>
+  static kernel_inline void kernel(D *x) {
+    const D v = *x;
+    sin_quadrant<D, I>(x, 1);
+    outside_range<D, I, cos_t>(&v, x);
+  }
+};
+
+struct exp_t {
+  static double limit() { return exp_limit; }
+  static double exact(double x) { return std::exp(x); }
+  template <typename D, typename I>
+  static kernel_inline void kernel(D *x) {
+    // exp(x) = 2^k exp(r), x = k ln 2 + r
+    const D v = *x, k_shifted = v * inv_ln2 + shifter
+      , k = k_shifted - shifter;
+    const D hi = v - k * ln2_hi, lo = k * ln2_lo, r = hi - lo, t = r * r;
+    const D c = r - t * (p1 + t * (p2 + t * (p3 + t * (p4 + t * p5))));
+    const D y = 1.0 - ((lo - r * c / (2.0 - c)) - hi);
+    *x = y * (D)(((I)k_shifted - shifter_bits + 1023) << 52);
+    outside_range<D, I, exp_t>(&v, x);
+  }
+};
+
+// floor, ceil and round of numbers below 2^52 in magnitude, which are the
+// only ones with fractions, are rounded to nearest by adding and subtracting
+// 2^52 and corrected. results have the sign of x, also when they're zero
+enum class rounding_k {
+  floor,
+  ceil,
+  round // halfway cases away from zero
+};
+
+template <typename D, typename I, rounding_k R>
+static kernel_inline void round_kernel(D *x) {
+  const I sign = (I)*x & sign_bit;
+  const D a = (D)((I)*x & ~sign_bit), t = (a + two_52) - two_52;
+  D y;
+  if (R == rounding_k::round)
+    y = t - a == -0.5 ? t + 1.0 : t;
+  else {
+    const D signed_t = (D)((I)t | sign);
+    y = R == rounding_k::floor ? (signed_t > *x ? signed_t - 1.0 : signed_t)
+      : (signed_t < *x ? signed_t + 1.0 : signed_t);
+  }
+  y = (D)(((I)y & ~sign_bit) | sign);
+  *x = a < two_52 ? y : *x;
+}
+
+struct floor_t {
+  template <typename D, typename I>
+  static kernel_inline void kernel(D *x) {
+    round_kernel<D, I, rounding_k::floor>(x);
+  }
+};
+
+struct ceil_t {
+  template <typename D, typename I>
+  static kernel_inline void kernel(D *x) {
+    round_kernel<D, I, rounding_k::ceil>(x);
+  }
+};
+
+struct round_t {
+  template <typename D, typename I>
+  static kernel_inline void kernel(D *x) {
+    round_kernel<D, I, rounding_k::round>(x);
+  }
+};
+
+struct abs_t {
+  template <typename D, typename I>
+  static kernel_inline void kernel(D *x) { *x = (D)((I)*x & ~sign_bit); }
+};
+
+// out[k] = F(x[k]) for k < n by vectors of D. the last one is padded with
+// zeros, so that elements are computed the same wherever they are
+template <typename D, typename I, typename F>
+static kernel_inline void map(const double *x, double *out, size_t n) {
+  const size_t lanes = sizeof(D) / sizeof(double);
+  size_t k = 0;
+  for (; k + lanes <= n; k += lanes) {
+    D v;
+    memcpy(&v, x + k, sizeof(D));
+    F::template kernel<D, I>(&v);
+    memcpy(out + k, &v, sizeof(D));
+  }
+  if (k == n)
+    return;
+  D v = D();
+  memcpy(&v, x + k, (n - k) * sizeof(double));
+  F::template kernel<D, I>(&v);
+  memcpy(out + k, &v, (n - k) * sizeof(double));
+}
+
+struct kernels_t {
+  const char *isa;
+  void (*sin)(const double *x, double *out, size_t n);
+  void (*cos)(const double *x, double *out, size_t n);
+  void (*exp)(const double *x, double *out, size_t n);
+  void (*abs)(const double *x, double *out, size_t n);
+  void (*sqrt)(const double *x, double *out, size_t n);
+  void (*floor)(const double *x, double *out, size_t n);
+  void (*ceil)(const double *x, double *out, size_t n);
+  void (*round)(const double *x, double *out, size_t n);
+};
+
+// functions of kernels_t of an instruction set, compiled with ATTRIBUTES.
+// sqrt is defined separately since it's an instruction gcc vectors lack
+#define define_kernels(ISA, D, I, ATTRIBUTES) \
+  ATTRIBUTES static void ISA##_sin(const double *x, double *out, size_t n) { \
+    map<D, I, sin_t>(x, out, n); \
+  } \
+  ATTRIBUTES static void ISA##_cos(const double *x, double *out, size_t n) { \
+    map<D, I, cos_t>(x, out, n); \
+  } \
+  ATTRIBUTES static void ISA##_exp(const double *x, double *out, size_t n) { \
+    map<D, I, exp_t>(x, out, n); \
+  } \
+  ATTRIBUTES static void ISA##_abs(const double *x, double *out, size_t n) { \
+    map<D, I, abs_t>(x, out, n); \
+  } \
+  ATTRIBUTES static void ISA##_floor(const double *x, double *out \
+      , size_t n) { \
+    map<D, I, floor_t>(x, out, n); \
+  } \
+  ATTRIBUTES static void ISA##_ceil(const double *x, double *out, size_t n) { \
+    map<D, I, ceil_t>(x, out, n); \
+  } \
+  ATTRIBUTES static void ISA##_round(const double *x, double *out \
+      , size_t n) { \
+    map<D, I, round_t>(x, out, n); \
+  } \
+  static const kernels_t ISA##_kernels = { #ISA, ISA##_sin, ISA##_cos \
+    , ISA##_exp, ISA##_abs, ISA##_sqrt, ISA##_floor, ISA##_ceil \
+    , ISA##_round }
+
+#if defined(__x86_64__)
+static void sse2_sqrt(const double *x, double *out, size_t n) {
+  size_t k = 0;
+  for (; k + 2 <= n; k += 2)
+    _mm_storeu_pd(out + k, _mm_sqrt_pd(_mm_loadu_pd(x + k)));
+  for (; k < n; ++k)
+    out[k] = std::sqrt(x[k]);
+}
+
+__attribute__((target("avx2")))
+static void avx2_sqrt(const double *x, double *out, size_t n) {
+  size_t k = 0;
+  for (; k + 4 <= n; k += 4)
+    _mm256_storeu_pd(out + k, _mm256_sqrt_pd(_mm256_loadu_pd(x + k)));
+  for (; k < n; ++k)
+    out[k] = std::sqrt(x[k]);
+}
+
+define_kernels(sse2, f64x2, i64x2, );
+define_kernels(avx2, f64x4, i64x4, __attribute__((target("avx2"))));
+#else
+static void scalar_sqrt(const double *x, double *out, size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = std::sqrt(x[k]);
+}
+
+define_kernels(scalar, f64x1, i64x1, );
+#endif
+
+#undef define_kernels
+
+static const kernels_t& kernels() {
+#if defined(__x86_64__)
+  static const kernels_t &chosen = __builtin_cpu_supports("avx2")
+    ? avx2_kernels : sse2_kernels;
+  return chosen;
+#else
+  return scalar_kernels;
+#endif
+}
+
+void vmath_sin(const double *x, double *out, size_t n) {
+  kernels().sin(x, out, n);
+}
+
+void vmath_cos(const double *x, double *out, size_t n) {
+  kernels().cos(x, out, n);
+}
+
+void vmath_exp(const double *x, double *out, size_t n) {
+  kernels().exp(x, out, n);
+}
+
+void vmath_abs(const double *x, double *out, size_t n) {
+  kernels().abs(x, out, n);
+}
+
+void vmath_sqrt(const double *x, double *out, size_t n) {
+  kernels().sqrt(x, out, n);
+}
+
+void vmath_floor(const double *x, double *out, size_t n) {
+  kernels().floor(x, out, n);
+}
+
+void vmath_ceil(const double *x, double *out, size_t n) {
+  kernels().ceil(x, out, n);
+}
+
+void vmath_round(const double *x, double *out, size_t n) {
+  kernels().round(x, out, n);
+}
+
+void vmath_pow(const double *x, const double *y, double *out, size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = std::pow(x[k], y[k]);
+}
+
+void vmath_mod(const double *x, const double *y, double *out, size_t n) {
+  for (size_t k = 0; k < n; ++k)
+    out[k] = std::fmod(x[k], y[k]);
+}
+
+const char* vmath_isa() {
+  return kernels().isa;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+// math on arrays of doubles for block evaluation of builtins: out[k] is f of
+// x[k], or of x[k] and y[k], for k < n. out may be the same array as x or y
+// but must not overlap them otherwise. kernels for avx2 or for sse2 are
+// chosen by cpuid on first use, other machines get portable ones that take
+// an element at a time.
+//
+// abs, sqrt, floor, ceil and round are exact, the same as their <cmath>
+// counterparts, and pow and mod are computed by <cmath> an element at a
+// time. sin and cos for |x| up to 1.6e6 and exp for |x| up to 708 are
+// approximations with an error of at most 1 ulp. they're computed by <cmath>
+// outside of that and for non-finite x, where they're rarely needed. kernels
+// aren't compiled for fma, so no instruction set can contract operations
+// into it, and approximations are the same on every machine
+void vmath_sin(const double *x, double *out, size_t n);
+void vmath_cos(const double *x, double *out, size_t n);
+void vmath_exp(const double *x, double *out, size_t n);
+void vmath_abs(const double *x, double *out, size_t n);
+void vmath_sqrt(const double *x, double *out, size_t n);
+void vmath_floor(const double *x, double *out, size_t n);
+void vmath_ceil(const double *x, double *out, size_t n);
+void vmath_round(const double *x, double *out, size_t n);
+void vmath_pow(const double *x, const double *y, double *out, size_t n);
+void vmath_mod(const double *x, const double *y, double *out, size_t n);
+
+// instruction set of kernels in use: "avx2", "sse2" or "scalar"
+const char* vmath_isa();
@@ -0,0 +1,68 @@
+#include "../src/eval.hh"
+#include "../src/lex.hh"
+#include "../src/optimize.hh"
+#include <cmath>
+#include <cstdio>
+
+static int g_failures = 0;
+
+// evaluates definition name of source on every tier up to native and
+// compares it with expected at a few times
+static void check_definition(const char *source, const char *name
+    , double (*expected)(double f, double t)) {
+  term_t *program = lex_parse_string(source);
+  if (!program) {
+    printf("FAIL: %s: can't parse\n", name);
+    ++g_failures;
+    return;
+  }
+  std::vector<message_t> messages;
+  validate_top_level_functions(program, &messages);
+  for (const message_t &message : messages)
+    if (message.kind == message_k::error) {
+      printf("FAIL: %s: %s\n", name, message.content.c_str());
+      ++g_failures;
+    }
+  if (!messages_contain_no_errors(messages))
+    return;
+  optimize_program(program, inline_options_t());
+  for (evaluation_tier_k tier : { evaluation_tier_k::tree
+      , evaluation_tier_k::bytecode, evaluation_tier_k::native }) {
+    evaluator_t evaluator(program, name, tier);
+    evaluation_context_t context(&evaluator);
+    for (int k = 0; k < 8; ++k) {
+      const double f = 440, t = k / 48000., y = context.eval(f, t);
+      if (std::fabs(y - expected(f, t)) <= 1e-12)
+        continue;
+      printf("FAIL: %s on %s tier at t = %.17g: got %.17g, expected %.17g\n"
+          , name, evaluation_tier_kind_to_string(evaluator.tier()).c_str(), t
+          , y, expected(f, t));
+      ++g_failures;
+    }
+  }
+}
+
+static void test_recursive_binding() {
+  check_definition(
+      "rec f t = let go n acc = case n of\n"
+      "                           0 -> acc,\n"
+      "                           _ -> (go (n - 1) (acc + n * t))\n"
+      "                         end\n"
+      "          in (go 40 0)\n"
+      , "rec", [](double f, double t) { return 820 * t; });
+}
+
+static void test_later_binding() {
+  // f in g is the binding after it, not the argument of c3
+  check_definition("c3 f t = let g = (\\y . y * f), f = 2 in (g t)\n"
+      , "c3", [](double f, double t) { return t * 2; });
+  check_definition("fwd f t = let a = b + 1, b = t * 3 in a\n"
+      , "fwd", [](double f, double t) { return t * 3 + 1; });
+}
+
+int main() {
+  test_recursive_binding();
+  test_later_binding();
+  printf("let: %s\n", g_failures == 0 ? "ok" : "FAILED");
+  return g_failures == 0 ? 0 : 1;
+}
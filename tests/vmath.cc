@@ -0,0 +1,171 @@
+#include "../src/vmath.hh"
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// limits of approximations as documented in vmath.hh
+static const double sin_cos_limit = 1.6e6, exp_limit = 708;
+
+static int g_failures = 0;
+
+static void check(bool condition, const char *what, double x, double y) {
+  if (condition)
+    return;
+  printf("FAIL: %s at x = %.17g: got %.17g\n", what, x, y);
+  ++g_failures;
+}
+
+// distance between a and b in units in the last place
+static uint64_t ulps(double a, double b) {
+  int64_t i, j;
+  memcpy(&i, &a, sizeof(i));
+  memcpy(&j, &b, sizeof(j));
+  // map negative numbers so that integers are ordered like doubles
+  if (i < 0)
+    i = INT64_MIN - i;
+  if (j < 0)
+    j = INT64_MIN - j;
+  return i > j ? (uint64_t)i - (uint64_t)j : (uint64_t)j - (uint64_t)i;
+}
+
+static void check_close(void (*kernel)(const double*, double*, size_t)
+    , double (*exact)(double), const char *what
+    , const std::vector<double> &x) {
+  std::vector<double> y(x.size());
+  kernel(x.data(), y.data(), x.size());
+  for (size_t k = 0; k < x.size(); ++k)
+    check(ulps(y[k], exact(x[k])) <= 1, what, x[k], y[k]);
+}
+
+// within 1 ulp of exact for |x| up to limit, where approximations are used,
+// and the same as exact beyond it and for non-finite x
+static void check_around_limit(void (*kernel)(const double*, double*
+      , size_t), double (*exact)(double), const char *what, double limit
+    , const std::vector<double> &x) {
+  std::vector<double> y(x.size());
+  kernel(x.data(), y.data(), x.size());
+  for (size_t k = 0; k < x.size(); ++k) {
+    const double e = exact(x[k]);
+    if (std::fabs(x[k]) <= limit)
+      check(ulps(y[k], e) <= 1, what, x[k], y[k]);
+    else
+      check(std::isnan(e) ? std::isnan(y[k])
+          : memcmp(&y[k], &e, sizeof(e)) == 0, what, x[k], y[k]);
+  }
+}
+
+// deterministic numbers in [-limit, limit], spread uniformly and by
+// magnitude from the smallest normal number up
+static std::vector<double> sweep(double limit) {
+  std::vector<double> x;
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  for (int k = 0; k < 100001; ++k) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    const double u = (double)(state >> 11) / (double)(1ULL << 53);
+    x.push_back((2 * u - 1) * limit);
+  }
+  const double smallest = std::log2(DBL_MIN), largest = std::log2(limit);
+  for (int k = 0; k <= 20000; ++k) {
+    const double m = std::exp2(smallest + (largest - smallest) * k / 20000);
+    x.push_back(std::fmin(m, limit));
+    x.push_back(-std::fmin(m, limit));
+  }
+  return x;
+}
+
+static void test_sweep() {
+  std::vector<double> x = sweep(sin_cos_limit);
+  // multiples of pi / 2 are where reduction loses most
+  for (int k = 1; k < 1000000; k += 997) {
+    const double m = k * M_PI_2;
+    x.push_back(m);
+    x.push_back(std::nextafter(m, 0));
+    x.push_back(std::nextafter(m, HUGE_VAL));
+    x.push_back(-m);
+  }
+  check_close(vmath_sin, static_cast<double (*)(double)>(std::sin), "sin", x);
+  check_close(vmath_cos, static_cast<double (*)(double)>(std::cos), "cos", x);
+  x = sweep(exp_limit);
+  check_close(vmath_exp, static_cast<double (*)(double)>(std::exp), "exp", x);
+}
+
+// numbers on both sides of limit and far beyond it, and non-finite ones,
+// mixed with ones well within it, so that vectors of kernels have lanes of
+// each kind
+static std::vector<double> around(double limit
+    , const std::vector<double> &beyond) {
+  std::vector<double> x;
+  for (double sign : { 1.0, -1.0 }) {
+    double below = limit, above = limit;
+    for (int k = 0; k < 4; ++k) {
+      x.push_back(sign * below);
+      x.push_back(sign * 0.5);
+      x.push_back(sign * above);
+      below = std::nextafter(below, 0);
+      above = std::nextafter(above, HUGE_VAL);
+    }
+    for (double m : beyond) {
+      x.push_back(sign * m);
+      x.push_back(sign);
+    }
+  }
+  const double inf = HUGE_VAL;
+  for (double m : { std::nan(""), -std::nan(""), inf, -inf }) {
+    x.push_back(m);
+    x.push_back(0.25);
+  }
+  return x;
+}
+
+static void test_limits() {
+  std::vector<double> x = around(sin_cos_limit, { 2e6, 1e9, 1e22, 1e300
+      , DBL_MAX });
+  check_around_limit(vmath_sin, static_cast<double (*)(double)>(std::sin)
+      , "sin around limit", sin_cos_limit, x);
+  check_around_limit(vmath_cos, static_cast<double (*)(double)>(std::cos)
+      , "cos around limit", sin_cos_limit, x);
+  // overflow, subnormal results and underflow to zero
+  x = around(exp_limit, { 709, 709.782712893384, 709.8, 745, 745.2, 746
+      , 1e10, DBL_MAX });
+  check_around_limit(vmath_exp, static_cast<double (*)(double)>(std::exp)
+      , "exp around limit", exp_limit, x);
+}
+
+static void test_signed_zeros() {
+  const std::vector<double> x { -0.0, 0.0, -0.0 };
+  std::vector<double> y(x.size());
+  vmath_sin(x.data(), y.data(), x.size());
+  for (size_t k = 0; k < x.size(); ++k)
+    check(y[k] == 0 && std::signbit(y[k]) == std::signbit(x[k])
+        , "sin keeps sign of zero", x[k], y[k]);
+  vmath_cos(x.data(), y.data(), x.size());
+  for (size_t k = 0; k < x.size(); ++k)
+    check(y[k] == 1, "cos of zero", x[k], y[k]);
+  vmath_exp(x.data(), y.data(), x.size());
+  for (size_t k = 0; k < x.size(); ++k)
+    check(y[k] == 1, "exp of zero", x[k], y[k]);
+}
+
+static void test_accuracy() {
+  std::vector<double> x;
+  // odd count, so that a padded last vector is tested too
+  for (int k = -5001; k <= 5001; ++k)
+    x.push_back(k * 1.23456789e-2);
+  for (int k = 0; k < 64; ++k)
+    x.push_back(std::ldexp(1.0, -k) * (k % 2 == 0 ? 1 : -1));
+  check_close(vmath_sin, static_cast<double (*)(double)>(std::sin), "sin", x);
+  check_close(vmath_cos, static_cast<double (*)(double)>(std::cos), "cos", x);
+  check_close(vmath_exp, static_cast<double (*)(double)>(std::exp), "exp", x);
+}
+
+int main() {
+  test_signed_zeros();
+  test_accuracy();
+  test_sweep();
+  test_limits();
+  printf("vmath (%s): %s\n", vmath_isa(), g_failures == 0 ? "ok" : "FAILED");
+  return g_failures == 0 ? 0 : 1;
+}